@@ -7,15 +7,42 @@
 
 void printHelp()
 {
-    std::cout << "\nUsage: eva-em [options]\n\n"
+    std::cout << "\nUsage: eva-em [--register] [--jit] [--tier-stats] [--timeout <ms>] [options]\n\n"
               << "Options:\n"
               << "    -e, Expression to parse\n"
-              << "    -f, File to parse\n\n";
+              << "    -f, File to parse\n"
+              << "    --register, Run on the register-based instruction set\n"
+              << "    --jit, Compile hot functions and loops to machine code\n"
+              << "    --tier-stats, Log code moving up the execution tiers\n"
+              << "    --timeout <ms>, Stop the program after this long\n\n";
 }
 
 // Eva VM main executable
 int main(int argc, char const *argv[])
 {
+    // Instruction set to run on, whether to JIT compile
+    // and to log tier transitions, time limit
+    auto tier = ExecutionTier::STACK;
+    auto jit = false;
+    auto tierStats = false;
+    long timeout = 0;
+    for (; argc > 1 && std::string(argv[1]).rfind("--", 0) == 0; argv++, argc--)
+    {
+        if (std::string(argv[1]) == "--register")
+            tier = ExecutionTier::REGISTER;
+        else if (std::string(argv[1]) == "--jit")
+            jit = true;
+        else if (std::string(argv[1]) == "--tier-stats")
+            tierStats = true;
+        else if (std::string(argv[1]) == "--timeout" && argc > 2)
+        {
+            timeout = strtol(argv[2], nullptr, 10);
+            argv++, argc--;
+        }
+        else
+            break;
+    }
+
     if (argc != 3)
     {
         printHelp();
@@ -39,10 +66,25 @@ int main(int argc, char const *argv[])
 
         program = buffer.str();
     }
-    EvaVM vm;
+    EvaVM vm(tier);
+    if (jit)
+        vm.enableJit();
+    if (tierStats)
+        vm.tiering.stats.onTransition = [](const TierTransition &transition)
+        { std::cout << "Tier: " << transition << std::endl; };
+    if (timeout > 0)
+        vm.setDeadline(Preemption::Clock::now() + std::chrono::milliseconds(timeout));
     auto result = vm.exec(program);
 
+    if (vm.status == ExecStatus::TIMED_OUT)
+    {
+        std::cerr << "Timed out after " << timeout << " ms" << std::endl;
+        return EXIT_FAILURE;
+    }
+
     log(result);
+    if (tierStats)
+        std::cout << "OSR entries: " << std::dec << vm.tiering.stats.osrEntries << std::endl;
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,122 @@
+// Eva VM benchmarks.
+// Build twice (e.g. with -DEVA_COMPUTED_GOTO=ON/OFF or -DEVA_NAN_BOXING=ON/OFF) to compare
+// VM configurations on the same programs. Every program runs on the stack and the
+// register tier; eva_bench_dispatch also counts the executed instructions.
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "src/vm/EvaVM.h"
+
+struct Benchmark
+{
+    std::string name;
+    std::string program;
+};
+
+// Loop heavy: global counters in a tight while loop.
+// Local loop: function-local counter compared against a constant.
+// Call heavy: naive recursive fibonacci.
+// Closure heavy: a lambda capturing a local, passed as a callback.
+std::vector<Benchmark> benchmarks = {
+    {"loop", R"(
+        (var i 0)
+        (var sum 0)
+        (while (< i 1000000)
+            (begin
+                (set i (+ i 1))
+                (set sum (+ sum i))))
+        sum
+    )"},
+    {"locals", R"(
+        (def count (n)
+            (begin
+                (var i 0)
+                (var sum 0)
+                (while (< i 1000000)
+                    (begin
+                        (set i (+ i 1))
+                        (set sum (+ sum i))))
+                sum))
+        (count 0)
+    )"},
+    {"calls", R"(
+        (def fib (n)
+            (if (< n 2)
+                n
+                (+ (fib (- n 1)) (fib (- n 2)))))
+        (fib 25)
+    )"},
+    {"closures", R"(
+        (def twice (f x) (f (f x)))
+        (def addTwice (n x) (twice (lambda (v) (+ v n)) x))
+        (var i 0)
+        (var sum 0)
+        (while (< i 200000)
+            (begin
+                (set sum (+ sum (addTwice i 1)))
+                (set i (+ i 1))))
+        sum
+    )"},
+};
+
+// Runs a program, silencing the VM's own output (disassembly, GC stats).
+double runOnce(const Benchmark &benchmark, ExecutionTier tier, EvaValue &result, size_t &dispatches)
+{
+    std::stringstream sink;
+    auto coutBuf = std::cout.rdbuf(sink.rdbuf());
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        EvaVM vm(tier);
+        result = vm.exec(benchmark.program);
+        dispatches = vm.dispatches;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::cout.rdbuf(coutBuf);
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main(int argc, char const *argv[])
+{
+    auto runs = argc > 1 ? std::stoi(argv[1]) : 5;
+
+    std::cout << "Dispatch: " << (EVA_COMPUTED_GOTO ? "computed-goto" : "switch")
+              << ", values: " << (EVA_NAN_BOXING ? "nan-boxed" : "tagged union")
+              << " (" << sizeof(EvaValue) << " bytes)"
+              << ", runs: " << runs << std::endl;
+
+    std::vector<std::pair<std::string, ExecutionTier>> tiers = {
+        {"stack", ExecutionTier::STACK},
+        {"register", ExecutionTier::REGISTER},
+    };
+
+    for (const auto &benchmark : benchmarks)
+    {
+        for (const auto &tier : tiers)
+        {
+            double best = 0;
+            EvaValue result;
+            size_t dispatches = 0;
+            for (auto i = 0; i < runs; i++)
+            {
+                auto ms = runOnce(benchmark, tier.second, result, dispatches);
+                if (i == 0 || ms < best)
+                    best = ms;
+            }
+            std::cout << std::left << std::setw(10) << benchmark.name
+                      << std::setw(10) << tier.first
+                      << " best: " << best << " ms, ";
+            if (EVA_DISPATCH_STATS)
+                std::cout << "dispatches: " << std::dec << dispatches << ", ";
+            std::cout << "result: " << result << std::endl;
+        }
+    }
+
+    return 0;
+}
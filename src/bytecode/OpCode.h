@@ -3,6 +3,8 @@
 #ifndef OpCode_h
 #define OpCode_h
 
+#include <vector>
+
 #include "src/vm/Logger.h"
 
 // Stops the program
@@ -49,42 +51,217 @@
 #define OP_GET_PROP 0x16
 #define OP_SET_PROP 0x17
 
+// Quickened (type-specialized) instructions. Never emitted by the
+// compiler: the VM rewrites a generic instruction in place once it
+// has seen its operand types, and rewrites it back (deoptimizes) when
+// the guard fails. Same length as the generic instruction.
+#define OP_ADD_NUM 0x18
+#define OP_LT_NUM 0x19
+#define OP_GT_NUM 0x1A
+#define OP_EQ_NUM 0x1B
+#define OP_LE_NUM 0x1C
+#define OP_GE_NUM 0x1D
+#define OP_NE_NUM 0x1E
+
+// Fused compare-and-branch: compares the two values on top of the
+// stack and jumps to the 16-bit address if the comparison is false.
+#define OP_JMP_IF_NOT_LT 0x1F
+#define OP_JMP_IF_NOT_GT 0x20
+#define OP_JMP_IF_NOT_EQ 0x21
+#define OP_JMP_IF_NOT_LE 0x22
+#define OP_JMP_IF_NOT_GE 0x23
+#define OP_JMP_IF_NOT_NE 0x24
+
+// Compares a local against a numeric constant, jumps if false:
+// <compare op> <local index> <constant index> <16-bit address>
+#define OP_JMP_IF_NOT_CMP_LC 0x25
+
+// Prefix: the next instruction has 16-bit index operands (constants,
+// locals, globals, cells, counts, caches) and a 32-bit jump address.
+// Compare operators stay one byte.
+#define OP_WIDE 0x26
+
+// Call in tail position: <args count>. The callee and its arguments
+// replace the current frame, which the callee returns from.
+#define OP_TAIL_CALL 0x27
+
+// Method calls. The receiver and the arguments are on the stack, the
+// method is inserted below them as the callee:
+// <name constant> <cache> <args count> looks it up on the receiver,
+// <method constant> <args count> is a statically bound super call.
+#define OP_INVOKE 0x28
+#define OP_INVOKE_SUPER 0x29
+
+// Variables of the frame that made the running function, for functions
+// that don't escape it (see Scope::useInPlace): <slot index>, read and
+// written in place through the function's `outer` frame pointer.
+#define OP_GET_OUTER 0x2A
+#define OP_SET_OUTER 0x2B
+
 // --------------------
+// List of all opcodes, in numeric order. Used to build the
+// dispatch table and the opcode names.
+#define FOR_EACH_OPCODE(V) \
+    V(HALT)                \
+    V(CONST)               \
+    V(ADD)                 \
+    V(SUB)                 \
+    V(MUL)                 \
+    V(DIV)                 \
+    V(COMPARE)             \
+    V(JMP_IF_FALSE)        \
+    V(JMP)                 \
+    V(GET_GLOBAL)          \
+    V(SET_GLOBAL)          \
+    V(POP)                 \
+    V(GET_LOCAL)           \
+    V(SET_LOCAL)           \
+    V(SCOPE_EXIT)          \
+    V(CALL)                \
+    V(RETURN)              \
+    V(GET_CELL)            \
+    V(SET_CELL)            \
+    V(LOAD_CELL)           \
+    V(MAKE_FUNCTION)       \
+    V(NEW)                 \
+    V(GET_PROP)            \
+    V(SET_PROP)            \
+    V(ADD_NUM)             \
+    V(LT_NUM)              \
+    V(GT_NUM)              \
+    V(EQ_NUM)              \
+    V(LE_NUM)              \
+    V(GE_NUM)              \
+    V(NE_NUM)              \
+    V(JMP_IF_NOT_LT)       \
+    V(JMP_IF_NOT_GT)       \
+    V(JMP_IF_NOT_EQ)       \
+    V(JMP_IF_NOT_LE)       \
+    V(JMP_IF_NOT_GE)       \
+    V(JMP_IF_NOT_NE)       \
+    V(JMP_IF_NOT_CMP_LC)   \
+    V(WIDE)                \
+    V(TAIL_CALL)           \
+    V(INVOKE)              \
+    V(INVOKE_SUPER)        \
+    V(GET_OUTER)           \
+    V(SET_OUTER)
+
 #define OP_STR(op) \
     case OP_##op:  \
-        return #op
+        return #op;
 
 std::string opcodeToString(uint8_t opcode)
 {
     switch (opcode)
     {
-        OP_STR(HALT);
-        OP_STR(CONST);
-        OP_STR(ADD);
-        OP_STR(SUB);
-        OP_STR(MUL);
-        OP_STR(DIV);
-        OP_STR(COMPARE);
-        OP_STR(JMP_IF_FALSE);
-        OP_STR(JMP);
-        OP_STR(GET_GLOBAL);
-        OP_STR(SET_GLOBAL);
-        OP_STR(POP);
-        OP_STR(GET_LOCAL);
-        OP_STR(SET_LOCAL);
-        OP_STR(SCOPE_EXIT);
-        OP_STR(CALL);
-        OP_STR(RETURN);
-        OP_STR(GET_CELL);
-        OP_STR(SET_CELL);
-        OP_STR(LOAD_CELL);
-        OP_STR(MAKE_FUNCTION);
-        OP_STR(NEW);
-        OP_STR(GET_PROP);
-        OP_STR(SET_PROP);
+        FOR_EACH_OPCODE(OP_STR)
     default:
         DIE << "opcodeToString: unknown opcode: " << std::hex << (int)opcode;
     }
     return "Unknown";
 }
+
+// Size in bytes of an instruction (opcode + operands)
+size_t instructionSize(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case OP_HALT:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_POP:
+    case OP_RETURN:
+    case OP_NEW:
+    case OP_ADD_NUM:
+        return 1;
+    case OP_JMP_IF_FALSE:
+    case OP_JMP:
+    case OP_GET_PROP:
+    case OP_SET_PROP:
+    case OP_JMP_IF_NOT_LT:
+    case OP_JMP_IF_NOT_GT:
+    case OP_JMP_IF_NOT_EQ:
+    case OP_JMP_IF_NOT_LE:
+    case OP_JMP_IF_NOT_GE:
+    case OP_JMP_IF_NOT_NE:
+    case OP_INVOKE_SUPER:
+        return 3;
+    case OP_INVOKE:
+        return 4;
+    case OP_JMP_IF_NOT_CMP_LC:
+        return 6;
+    default:
+        return 2;
+    }
+}
+
+// Size in bytes of an instruction prefixed with OP_WIDE
+// (prefix + opcode + operands)
+size_t wideInstructionSize(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case OP_JMP_IF_FALSE:
+    case OP_JMP:
+    case OP_JMP_IF_NOT_LT:
+    case OP_JMP_IF_NOT_GT:
+    case OP_JMP_IF_NOT_EQ:
+    case OP_JMP_IF_NOT_LE:
+    case OP_JMP_IF_NOT_GE:
+    case OP_JMP_IF_NOT_NE:
+        return 6;
+    case OP_JMP_IF_NOT_CMP_LC:
+        return 11;
+    case OP_GET_PROP:
+    case OP_SET_PROP:
+    case OP_INVOKE_SUPER:
+        return 6;
+    case OP_INVOKE:
+        return 8;
+    default:
+        return 4;
+    }
+}
+
+// Size of the instruction at `offset`, prefix included
+size_t instructionLength(const std::vector<uint8_t> &code, size_t offset)
+{
+    return code[offset] == OP_WIDE ? wideInstructionSize(code[offset + 1])
+                                   : instructionSize(code[offset]);
+}
+
+// Whether the opcode is a jump with an address operand
+bool isJump(uint8_t opcode)
+{
+    return opcode == OP_JMP || opcode == OP_JMP_IF_FALSE ||
+           (opcode >= OP_JMP_IF_NOT_LT && opcode <= OP_JMP_IF_NOT_CMP_LC);
+}
+
+// Whether the opcode is a quickened variant of a generic instruction
+bool isQuickened(uint8_t opcode)
+{
+    return opcode >= OP_ADD_NUM && opcode <= OP_NE_NUM;
+}
+
+// Generic instruction a quickened one was specialized from
+uint8_t genericOpcode(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case OP_ADD_NUM:
+        return OP_ADD;
+    case OP_LT_NUM:
+    case OP_GT_NUM:
+    case OP_EQ_NUM:
+    case OP_LE_NUM:
+    case OP_GE_NUM:
+    case OP_NE_NUM:
+        return OP_COMPARE;
+    default:
+        return opcode;
+    }
+}
 #endif //__OpCode_h
\ No newline at end of file
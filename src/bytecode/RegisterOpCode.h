@@ -0,0 +1,154 @@
+// Register-based instruction set for Eva VM.
+//
+// Three-address instructions naming frame slots ("registers", relative
+// to the base pointer) and constants directly, instead of going through
+// the operand stack. A register is the stack slot the stack tier would
+// use at that point, so locals and call frames keep the same layout.
+//
+// Operands marked RK are a register if below RK_CONST, otherwise a
+// constant index (+ RK_CONST).
+
+#ifndef RegisterOpCode_h
+#define RegisterOpCode_h
+
+#include "src/vm/Logger.h"
+
+// Operand tag for constants
+#define RK_CONST 0x80
+
+// Stops the program: <RK result>
+#define ROP_HALT 0x00
+
+// Moves: <dst> <constant index>, <dst> <register>
+#define ROP_LOADK 0x01
+#define ROP_MOVE 0x02
+
+// Math: <dst> <RK> <RK>
+#define ROP_ADD 0x03
+#define ROP_SUB 0x04
+#define ROP_MUL 0x05
+#define ROP_DIV 0x06
+
+// Comparison: <dst> <compare op> <RK> <RK>
+#define ROP_COMPARE 0x07
+
+// Control flow: <16-bit address>, <RK> <16-bit address>,
+// <compare op> <RK> <RK> <16-bit address>
+#define ROP_JMP 0x08
+#define ROP_JMP_IF_FALSE 0x09
+#define ROP_JMP_IF_NOT 0x0A
+
+// Global vars: <dst> <global index>, <global index> <RK>
+#define ROP_GET_GLOBAL 0x0B
+#define ROP_SET_GLOBAL 0x0C
+
+// Closures: <dst> <cell index>, <cell index> <RK>, <dst> <cell index>,
+// <dst> <code constant index> <cells count> (cells in dst...)
+#define ROP_GET_CELL 0x0D
+#define ROP_SET_CELL 0x0E
+#define ROP_LOAD_CELL 0x0F
+#define ROP_MAKE_FUNCTION 0x10
+
+// Classes/OOP: <dst> (class in dst, constructor and instance
+// written to dst and dst + 1), <dst> <RK object> <name> <cache>,
+// <RK object> <RK value> <name> <cache>
+#define ROP_NEW 0x11
+#define ROP_GET_PROP 0x12
+#define ROP_SET_PROP 0x13
+
+// Function calls: <base> <args count> (function in base, arguments
+// after it, result written to base), <RK result>
+#define ROP_CALL 0x14
+#define ROP_RETURN 0x15
+
+// Tail call: <base> <args count>, the function and arguments in
+// base... are moved to the current frame, which is reused
+#define ROP_TAIL_CALL 0x16
+
+// Method calls: <base> <name> <cache> <args count>, <base> <method
+// constant> <args count>. Receiver and arguments in base..., the
+// method is inserted below them, the result written to base
+#define ROP_INVOKE 0x17
+#define ROP_INVOKE_SUPER 0x18
+
+// Variables of the frame that made the running function (see
+// OP_GET_OUTER): <dst> <slot index>, <slot index> <RK>
+#define ROP_GET_OUTER 0x19
+#define ROP_SET_OUTER 0x1A
+
+// --------------------
+// List of all register opcodes, in numeric order.
+#define FOR_EACH_REGISTER_OPCODE(V) \
+    V(HALT)                         \
+    V(LOADK)                        \
+    V(MOVE)                         \
+    V(ADD)                          \
+    V(SUB)                          \
+    V(MUL)                          \
+    V(DIV)                          \
+    V(COMPARE)                      \
+    V(JMP)                          \
+    V(JMP_IF_FALSE)                 \
+    V(JMP_IF_NOT)                   \
+    V(GET_GLOBAL)                   \
+    V(SET_GLOBAL)                   \
+    V(GET_CELL)                     \
+    V(SET_CELL)                     \
+    V(LOAD_CELL)                    \
+    V(MAKE_FUNCTION)                \
+    V(NEW)                          \
+    V(GET_PROP)                     \
+    V(SET_PROP)                     \
+    V(CALL)                         \
+    V(RETURN)                       \
+    V(TAIL_CALL)                    \
+    V(INVOKE)                       \
+    V(INVOKE_SUPER)                 \
+    V(GET_OUTER)                    \
+    V(SET_OUTER)
+
+#define ROP_STR(op) \
+    case ROP_##op:  \
+        return #op;
+
+std::string registerOpcodeToString(uint8_t opcode)
+{
+    switch (opcode)
+    {
+        FOR_EACH_REGISTER_OPCODE(ROP_STR)
+    default:
+        DIE << "registerOpcodeToString: unknown opcode: " << std::hex << (int)opcode;
+    }
+    return "Unknown";
+}
+
+// Size in bytes of a register instruction (opcode + operands)
+size_t registerInstructionSize(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case ROP_HALT:
+    case ROP_NEW:
+    case ROP_RETURN:
+        return 2;
+    case ROP_ADD:
+    case ROP_SUB:
+    case ROP_MUL:
+    case ROP_DIV:
+    case ROP_JMP_IF_FALSE:
+    case ROP_MAKE_FUNCTION:
+    case ROP_INVOKE_SUPER:
+        return 4;
+    case ROP_COMPARE:
+    case ROP_GET_PROP:
+    case ROP_SET_PROP:
+    case ROP_INVOKE:
+        return 5;
+    case ROP_JMP_IF_NOT:
+        return 6;
+    default:
+        return 3;
+    }
+}
+
+#endif // RegisterOpCode_h
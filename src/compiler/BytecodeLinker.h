@@ -0,0 +1,152 @@
+// Eva Bytecode Linker.
+// Turns verified bytecode into the form the interpreter runs, with
+// operands resolved to the addresses they name.
+
+#ifndef BytecodeLinker_h
+#define BytecodeLinker_h
+
+#include <cstring>
+#include <vector>
+
+#include "src/bytecode/OpCode.h"
+#include "src/vm/EvaValue.h"
+#include "src/vm/Global.h"
+
+// Reads/writes a pointer operand of linked code (unaligned)
+template <typename T>
+T *loadPointer(const uint8_t *at)
+{
+    T *pointer;
+    memcpy(&pointer, at, sizeof(pointer));
+    return pointer;
+}
+
+template <typename T>
+void storePointer(uint8_t *at, T *pointer)
+{
+    memcpy(at, &pointer, sizeof(pointer));
+}
+
+// Linked code (co->linked) has the instructions of co->code, with the
+// operands that need dependent loads at runtime replaced by pointers:
+//  - constant indices by the address of the constant,
+//  - global indices by the address of the global's value,
+//  - jump addresses by the address of the target in linked code.
+// Pointer operands are pointer-sized whether or not the instruction
+// has an OP_WIDE prefix, which keeps widening its index operands
+// (locals, cells, property caches, OP_INVOKE_SUPER's method).
+// co->linkedAt and co->codeAt map instruction offsets between the two
+// forms, for the JITs, which work on co->code.
+class BytecodeLinker
+{
+public:
+    // Links verified `co`. The linked code points into `globals`,
+    // it has to be linked again if they move.
+    void link(CodeObject *co, std::vector<GlobalVar> &globals)
+    {
+        auto &code = co->code;
+
+        co->linkedAt.assign(code.size(), 0);
+        size_t size = 0;
+        for (size_t offset = 0; offset < code.size(); offset += instructionLength(code, offset))
+        {
+            co->linkedAt[offset] = size;
+            size += linkedLength(code, offset);
+        }
+
+        co->linked.assign(size, 0);
+        co->codeAt.assign(size, 0);
+        for (size_t offset = 0; offset < code.size(); offset += instructionLength(code, offset))
+        {
+            co->codeAt[co->linkedAt[offset]] = offset;
+            emit(co, offset, globals);
+        }
+    }
+
+private:
+    // Size of the instruction at `offset` once linked
+    static size_t linkedLength(const std::vector<uint8_t> &code, size_t offset)
+    {
+        auto wide = code[offset] == OP_WIDE;
+        auto opcode = code[offset + wide];
+        auto header = 1 + wide;
+
+        switch (opcode)
+        {
+        case OP_CONST:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+            return header + POINTER;
+        case OP_JMP_IF_NOT_CMP_LC:
+            // Comparison, local, constant, address
+            return header + 1 + (wide ? 2 : 1) + 2 * POINTER;
+        default:
+            return isJump(opcode) ? header + POINTER : instructionLength(code, offset);
+        }
+    }
+
+    // Writes the instruction at `offset` to its place in co->linked
+    static void emit(CodeObject *co, size_t offset, std::vector<GlobalVar> &globals)
+    {
+        auto &code = co->code;
+        auto wide = code[offset] == OP_WIDE;
+        auto opcode = code[offset + wide];
+        auto length = instructionLength(code, offset);
+
+        auto out = &co->linked[co->linkedAt[offset]];
+        auto pos = offset + 1 + wide;
+        auto read = [&](size_t bytes)
+        {
+            size_t value = 0;
+            for (size_t i = 0; i < bytes; i++)
+                value = (value << 8) | code[pos++];
+            return value;
+        };
+        auto index = [&]()
+        { return read(wide ? 2 : 1); };
+        auto address = [&]()
+        { return &co->linked[co->linkedAt[read(wide ? 4 : 2)]]; };
+        auto put = [&](auto *pointer)
+        {
+            storePointer(out, pointer);
+            out += POINTER;
+        };
+
+        // Prefix and opcode
+        for (size_t i = offset; i < offset + 1 + wide; i++)
+            *out++ = code[i];
+
+        switch (opcode)
+        {
+        case OP_CONST:
+            put(&co->constants[index()]);
+            break;
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+            put(&globals[index()].value);
+            break;
+        case OP_JMP_IF_NOT_CMP_LC:
+        {
+            *out++ = code[pos++];
+            for (auto bytes = wide ? 2 : 1; bytes > 0; bytes--)
+                *out++ = code[pos++];
+            put(&co->constants[index()]);
+            put(address());
+            break;
+        }
+        default:
+            if (isJump(opcode))
+            {
+                put(address());
+                break;
+            }
+            // Operands unchanged
+            while (pos < offset + length)
+                *out++ = code[pos++];
+        }
+    }
+
+    static constexpr size_t POINTER = sizeof(void *);
+};
+
+#endif // BytecodeLinker_h
@@ -0,0 +1,393 @@
+// Eva Bytecode Verifier.
+// Checks the stack bytecode of a code object once after compilation,
+// so the VM can run it without per-instruction stack guards.
+
+#ifndef BytecodeVerifier_h
+#define BytecodeVerifier_h
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "src/bytecode/OpCode.h"
+#include "src/vm/EvaValue.h"
+
+// Every reachable instruction is visited once with the stack depth
+// (relative to the frame's base pointer) it runs at, following both
+// edges of branches. The code is accepted if:
+//  - every instruction is known and fits in the code,
+//  - operands name existing constants, globals, locals, cells and
+//    property caches, and jumps land on instruction boundaries,
+//  - all paths reaching an instruction agree on the stack depth,
+//  - no instruction pops below the frame, and RETURN leaves exactly
+//    the result in it.
+// The deepest stack reached is recorded in co->maxStack.
+class BytecodeVerifier
+{
+public:
+    // Verifies `co`, `depth` is the number of stack slots in use on
+    // entry (callee and arguments) and `globalsCount` the number of
+    // defined globals. On failure, `error` describes the first problem.
+    bool verify(CodeObject *co, size_t depth, size_t globalsCount)
+    {
+        this->co = co;
+        globalsCount_ = globalsCount;
+        error.clear();
+
+        if (!decode())
+            return false;
+
+        depths_.assign(co->code.size(), -1);
+        worklist_.clear();
+        maxDepth_ = depth;
+        if (!reach(0, depth))
+            return false;
+
+        while (!worklist_.empty())
+        {
+            auto offset = worklist_.back();
+            worklist_.pop_back();
+            if (!step(offset))
+                return false;
+        }
+
+        co->maxStack = maxDepth_;
+        co->verified = true;
+        return true;
+    }
+
+    // Why the last code object was rejected
+    std::string error;
+
+private:
+    // Marks instruction boundaries, rejecting unknown opcodes and
+    // instructions running past the end of the code.
+    bool decode()
+    {
+        auto &code = co->code;
+        starts_.assign(code.size(), false);
+
+        for (size_t offset = 0; offset < code.size();)
+        {
+            auto opcode = code[offset];
+            if (opcode == OP_WIDE)
+            {
+                if (offset + 1 >= code.size() || !isWidenable(code[offset + 1]))
+                    return fail(offset, "invalid OP_WIDE prefix");
+            }
+            else if (!isKnown(opcode))
+            {
+                return fail(offset, "unknown opcode");
+            }
+
+            auto size = instructionLength(code, offset);
+            if (offset + size > code.size())
+                return fail(offset, "truncated instruction");
+
+            starts_[offset] = true;
+            offset += size;
+        }
+        return true;
+    }
+
+    // Checks the instruction at `offset` and queues its successors
+    bool step(size_t offset)
+    {
+        auto &code = co->code;
+        auto depth = (size_t)depths_[offset];
+
+        auto wide = code[offset] == OP_WIDE;
+        auto opcode = code[offset + wide];
+        auto next = offset + instructionLength(code, offset);
+
+        // Operands after the opcode: indices are 1 byte (2 when wide),
+        // jump addresses 2 bytes (4 when wide)
+        auto pos = offset + 1 + wide;
+        auto read = [&](size_t bytes)
+        {
+            size_t value = 0;
+            for (size_t i = 0; i < bytes; i++)
+                value = (value << 8) | code[pos++];
+            return value;
+        };
+        auto index = [&]()
+        { return read(wide ? 2 : 1); };
+        auto address = [&]()
+        { return read(wide ? 4 : 2); };
+
+        // Stack effect: needs `count` values, leaves `depth` values
+        auto needs = [&](size_t count)
+        { return depth >= count || fail(offset, "stack underflow"); };
+
+        switch (opcode)
+        {
+        case OP_HALT:
+            return needs(1);
+        case OP_RETURN:
+            // The scope exit left just the result in the frame
+            return depth == 1 || fail(offset, "unbalanced stack on return");
+        case OP_CONST:
+            if (index() >= co->constants.size())
+                return fail(offset, "constant index out of range");
+            depth++;
+            break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_ADD_NUM:
+            if (!needs(2))
+                return false;
+            depth--;
+            break;
+        case OP_COMPARE:
+        case OP_LT_NUM:
+        case OP_GT_NUM:
+        case OP_EQ_NUM:
+        case OP_LE_NUM:
+        case OP_GE_NUM:
+        case OP_NE_NUM:
+            if (read(1) > COMPARE_OPS_MAX)
+                return fail(offset, "invalid comparison");
+            if (!needs(2))
+                return false;
+            depth--;
+            break;
+        case OP_JMP_IF_NOT_LT:
+        case OP_JMP_IF_NOT_GT:
+        case OP_JMP_IF_NOT_EQ:
+        case OP_JMP_IF_NOT_LE:
+        case OP_JMP_IF_NOT_GE:
+        case OP_JMP_IF_NOT_NE:
+            if (!needs(2))
+                return false;
+            depth -= 2;
+            return reach(address(), depth, offset) && reach(next, depth, offset);
+        case OP_JMP_IF_NOT_CMP_LC:
+        {
+            if (read(1) > COMPARE_OPS_MAX)
+                return fail(offset, "invalid comparison");
+            auto localIndex = index();
+            auto constIndex = index();
+            if (localIndex >= depth)
+                return fail(offset, "local index out of range");
+            if (constIndex >= co->constants.size())
+                return fail(offset, "constant index out of range");
+            return reach(address(), depth, offset) && reach(next, depth, offset);
+        }
+        case OP_JMP_IF_FALSE:
+            if (!needs(1))
+                return false;
+            depth--;
+            return reach(address(), depth, offset) && reach(next, depth, offset);
+        case OP_JMP:
+            return reach(address(), depth, offset);
+        case OP_GET_GLOBAL:
+            if (index() >= globalsCount_)
+                return fail(offset, "global index out of range");
+            depth++;
+            break;
+        case OP_SET_GLOBAL:
+            if (index() >= globalsCount_)
+                return fail(offset, "global index out of range");
+            if (!needs(1))
+                return false;
+            break;
+        case OP_POP:
+            if (!needs(1))
+                return false;
+            depth--;
+            break;
+        case OP_GET_LOCAL:
+            if (index() >= depth)
+                return fail(offset, "local index out of range");
+            depth++;
+            break;
+        case OP_SET_LOCAL:
+            if (!needs(1))
+                return false;
+            if (index() >= depth)
+                return fail(offset, "local index out of range");
+            break;
+        case OP_SCOPE_EXIT:
+        {
+            auto count = index();
+            if (!needs(count + 1))
+                return false;
+            depth -= count;
+            break;
+        }
+        case OP_CALL:
+        {
+            auto argsCount = index();
+            if (!needs(argsCount + 1))
+                return false;
+            depth -= argsCount;
+            break;
+        }
+        case OP_TAIL_CALL:
+        {
+            // Replaces the frame: nothing runs after it
+            auto argsCount = index();
+            return needs(argsCount + 1);
+        }
+        case OP_INVOKE:
+        case OP_INVOKE_SUPER:
+        {
+            auto methodIndex = index();
+            if (methodIndex >= co->constants.size())
+                return fail(offset, "constant index out of range");
+            auto &method = co->constants[methodIndex];
+            if (opcode == OP_INVOKE ? !IS_STRING(method) : !IS_FUNCTION(method))
+                return fail(offset, "invalid method operand");
+            if (opcode == OP_INVOKE && index() >= co->propCaches.size())
+                return fail(offset, "property cache out of range");
+
+            // Receiver and arguments, the method goes below them
+            auto argsCount = index();
+            if (argsCount == 0)
+                return fail(offset, "method call without a receiver");
+            if (!needs(argsCount))
+                return false;
+            maxDepth_ = std::max(maxDepth_, depth + 1);
+            depth -= argsCount - 1;
+            break;
+        }
+        case OP_GET_CELL:
+        case OP_LOAD_CELL:
+            if (index() >= co->cellNames.size())
+                return fail(offset, "cell index out of range");
+            depth++;
+            break;
+        case OP_SET_CELL:
+            if (index() >= co->cellNames.size())
+                return fail(offset, "cell index out of range");
+            if (!needs(1))
+                return false;
+            break;
+        case OP_GET_OUTER:
+            if (index() >= co->outerNames.size())
+                return fail(offset, "outer slot out of range");
+            depth++;
+            break;
+        case OP_SET_OUTER:
+            if (index() >= co->outerNames.size())
+                return fail(offset, "outer slot out of range");
+            if (!needs(1))
+                return false;
+            break;
+        case OP_MAKE_FUNCTION:
+        {
+            auto cellsCount = index();
+            if (!needs(cellsCount + 1))
+                return false;
+            depth -= cellsCount;
+            break;
+        }
+        case OP_NEW:
+            if (!needs(1))
+                return false;
+            depth++;
+            break;
+        case OP_GET_PROP:
+        case OP_SET_PROP:
+        {
+            auto propIndex = index();
+            auto cacheIndex = index();
+            if (propIndex >= co->constants.size() || !IS_STRING(co->constants[propIndex]))
+                return fail(offset, "property name out of range");
+            if (cacheIndex >= co->propCaches.size())
+                return fail(offset, "property cache out of range");
+            if (!needs(opcode == OP_GET_PROP ? 1 : 2))
+                return false;
+            depth -= opcode == OP_SET_PROP;
+            break;
+        }
+        default:
+            return fail(offset, "unknown opcode");
+        }
+
+        return reach(next, depth, offset);
+    }
+
+    // Records that `target` runs with `depth` stack slots in use
+    bool reach(size_t target, size_t depth, size_t from = 0)
+    {
+        if (target >= co->code.size() || !starts_[target])
+            return fail(from, "jump to an invalid address");
+
+        if (depths_[target] == -1)
+        {
+            depths_[target] = (int)depth;
+            maxDepth_ = std::max(maxDepth_, depth);
+            worklist_.push_back(target);
+        }
+        else if ((size_t)depths_[target] != depth)
+        {
+            return fail(target, "stack depth mismatch at merge point");
+        }
+        return true;
+    }
+
+    bool fail(size_t offset, const std::string &message)
+    {
+        std::stringstream ss;
+        ss << co->name << " @ " << offset << ": " << message;
+        error = ss.str();
+        return false;
+    }
+
+    static bool isKnown(uint8_t opcode)
+    {
+        switch (opcode)
+        {
+#define KNOWN_OPCODE(op) case OP_##op:
+            FOR_EACH_OPCODE(KNOWN_OPCODE)
+#undef KNOWN_OPCODE
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Instructions the VM runs with an OP_WIDE prefix
+    static bool isWidenable(uint8_t opcode)
+    {
+        switch (opcode)
+        {
+        case OP_CONST:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_SCOPE_EXIT:
+        case OP_GET_CELL:
+        case OP_SET_CELL:
+        case OP_LOAD_CELL:
+        case OP_GET_OUTER:
+        case OP_SET_OUTER:
+        case OP_GET_PROP:
+        case OP_SET_PROP:
+        case OP_INVOKE:
+        case OP_INVOKE_SUPER:
+            return true;
+        default:
+            return isJump(opcode);
+        }
+    }
+
+    // Largest comparison operator (see compareOps_ in EvaCompiler.h)
+    static constexpr size_t COMPARE_OPS_MAX = 5;
+
+    CodeObject *co;
+    size_t globalsCount_;
+
+    // Instruction boundaries, and stack depth at each
+    // instruction (-1 until reached)
+    std::vector<bool> starts_;
+    std::vector<int> depths_;
+    std::vector<size_t> worklist_;
+    size_t maxDepth_;
+};
+
+#endif // BytecodeVerifier_h
@@ -3,17 +3,23 @@
 #ifndef EvaCompiler_h
 #define EvaCompiler_h
 
+#include <algorithm>
 #include <map>
+#include <optional>
 #include <unordered_map>
 #include <string>
 
 #include "src/bytecode/OpCode.h"
+#include "src/compiler/BytecodeLinker.h"
+#include "src/compiler/BytecodeVerifier.h"
+#include "src/compiler/RegisterCompiler.h"
 #include "src/compiler/Scope.h"
 #include "src/disassembler/EvaDisassembler.h"
 #include "src/parser/EvaParser.h"
 #include "src/vm/EvaValue.h"
 #include "src/vm/Logger.h"
 #include "src/vm/Global.h"
+#include "src/vm/SymbolTable.h"
 
 // Allocates new constant in the constant pool
 #define ALLOC_CONST(tester, converter, allocator, value) \
@@ -44,7 +50,7 @@
 
 // Call a function
 // Push function onto the stack:
-#define FUNCTION_CALL(exp)                         \
+#define FUNCTION_CALL(exp, tail)                   \
     do                                             \
     {                                              \
         gen(exp.list[0]);                          \
@@ -52,15 +58,15 @@
         {                                          \
             gen(exp.list[i]);                      \
         }                                          \
-        emit(OP_CALL);                             \
-        emit(exp.list.size() - 1);                 \
+        emitCall(exp.list.size() - 1, tail);       \
     } while (false)
 
 // Compiler class, emits bytecode, records constant pool, vars, etc.
 class EvaCompiler
 {
 public:
-    EvaCompiler(std::shared_ptr<Global> global) : disassembler(std::make_unique<EvaDisassembler>(global)), global(global) {}
+    EvaCompiler(std::shared_ptr<Global> global, std::shared_ptr<SymbolTable> symbols)
+        : disassembler(std::make_unique<EvaDisassembler>(global)), global(global), symbols(symbols) {}
 
     // Main compile API
     void compile(const Exp &exp)
@@ -68,9 +74,6 @@ public:
         // Allocate new code object
         co = AS_CODE(createCodeObjectValue("main"));
 
-        main = AS_FUNCTION(ALLOC_FUNCTION(co));
-        constantObjects_.insert((Traceable *)main);
-
         // Scope analysis.
         analyze(exp, nullptr);
 
@@ -79,6 +82,11 @@ public:
 
         // Explicitly stop execution
         emit(OP_HALT);
+        relaxJumps();
+
+        // Made once compiled, it has a cell for each of main's
+        main = AS_FUNCTION(ALLOC_FUNCTION(co));
+        constantObjects_.insert((Traceable *)main);
     }
 
     // Scope analysis
@@ -147,19 +155,7 @@ public:
                 // Lambda functions
                 else if (op == "lambda")
                 {
-                    auto arity = exp.list[1].list.size();
-
-                    auto newScope = std::make_shared<Scope>(ScopeType::FUNCTION, scope);
-                    scopeInfo_[&exp] = newScope;
-
-                    // Params
-                    for (auto i = 0; i < arity; i++)
-                    {
-                        newScope->addLocal(exp.list[1].list[i].string);
-                    }
-
-                    // Body
-                    analyze(exp.list[2], newScope);
+                    analyzeLambda(exp, scope, true);
                 }
                 // Class declaration
                 else if (op == "class")
@@ -180,8 +176,13 @@ public:
                 {
                     analyze(exp.list[1], scope);
                 }
+                // Function calls
                 else
                 {
+                    // The function, if it's a variable
+                    if (scope->findDeclaration(op) != nullptr)
+                        scope->maybePromote(op);
+
                     for (auto i = 1; i < exp.list.size(); i++)
                     {
                         analyze(exp.list[i], scope);
@@ -190,6 +191,14 @@ public:
             }
             else
             {
+                // Lambdas called right away don't escape. Functions
+                // they're passed to may keep them, so those do.
+                auto &callee = exp.list[0];
+                if (isLambda(callee))
+                    analyzeLambda(callee, scope, callee.list[1].list.size() != exp.list.size() - 1);
+                else
+                    analyze(callee, scope);
+
                 for (auto i = 1; i < exp.list.size(); i++)
                 {
                     analyze(exp.list[i], scope);
@@ -198,25 +207,47 @@ public:
         }
     }
 
+    // Scope of a lambda. One that doesn't escape (it's only ever called
+    // while the frame making it runs) uses that frame's variables in
+    // place, they aren't promoted to cells (see Scope::useInPlace).
+    void analyzeLambda(const Exp &exp, std::shared_ptr<Scope> scope, bool escapes)
+    {
+        auto arity = exp.list[1].list.size();
+
+        auto newScope = std::make_shared<Scope>(ScopeType::FUNCTION, scope);
+        newScope->escapes = escapes;
+        scopeInfo_[&exp] = newScope;
+
+        // Params
+        for (auto i = 0; i < arity; i++)
+        {
+            newScope->addLocal(exp.list[1].list[i].string);
+        }
+
+        // Body
+        analyze(exp.list[2], newScope);
+    }
+
     // Generate bytecode for an expression
     void gen(const Exp &exp)
     {
+        // Only this expression is in tail position, not its parts
+        auto tail = tailPosition_;
+        tailPosition_ = false;
+
         switch (exp.type)
         {
         case ExpType::NUMBER:
-            emit(OP_CONST);
-            emit(numericConstIdx(exp.number));
+            emitOp(OP_CONST, numericConstIdx(exp.number));
             break;
         case ExpType::STRING:
-            emit(OP_CONST);
-            emit(stringConstIdx(exp.string));
+            emitOp(OP_CONST, stringConstIdx(exp.string));
             break;
         case ExpType::SYMBOL:
             // Booleans
             if (exp.string == "true" || exp.string == "false")
             {
-                emit(OP_CONST);
-                emit(booleanConstIdx(exp.string == "true" ? true : false));
+                emitOp(OP_CONST, booleanConstIdx(exp.string == "true" ? true : false));
             }
             // Variables
             else
@@ -225,17 +256,21 @@ public:
 
                 // Get the appropriate opcode for this variable based on its scope
                 auto opCodeGetter = scopeStack_.top()->getNameGetter(varName);
-                emit(opCodeGetter);
 
                 // Check if its local
                 if (opCodeGetter == OP_GET_LOCAL)
                 {
-                    emit(co->getLocalIndex(varName));
+                    emitOp(opCodeGetter, co->getLocalIndex(varName));
                 }
                 // or if its a cell
                 else if (opCodeGetter == OP_GET_CELL)
                 {
-                    emit(co->getCellIndex(varName));
+                    emitOp(opCodeGetter, co->getCellIndex(varName));
+                }
+                // or a variable of the frame that made this function
+                else if (opCodeGetter == OP_GET_OUTER)
+                {
+                    emitOp(opCodeGetter, outerSlot(varName));
                 }
                 // if not, it must be global
                 else
@@ -244,7 +279,7 @@ public:
                     {
                         DIE << "[EvaCompiler]: Reference error: " << varName << " does not exist, could not get its value." << std::endl;
                     }
-                    emit(global->getGlobalIndex(varName));
+                    emitOp(opCodeGetter, global->getGlobalIndex(varName));
                 }
             }
             break;
@@ -255,6 +290,22 @@ public:
             {
                 auto op = tag.string;
 
+                // Arithmetic and comparisons on constants are computed
+                // here, and operations leaving an operand as is dropped
+                if (isArithmetic(exp) || isCompare(exp))
+                {
+                    if (auto constant = constantValue(exp))
+                    {
+                        emitOp(OP_CONST, constantIdx(*constant));
+                        break;
+                    }
+                    if (auto operand = identityOperand(exp))
+                    {
+                        gen(*operand);
+                        break;
+                    }
+                }
+
                 if (op == "+")
                 {
                     GEN_BINARY_OP(OP_ADD);
@@ -283,18 +334,20 @@ public:
                 // Branch: (if <test> <consequent> <alternate>)
                 else if (op == "if")
                 {
-                    // Emit <test>
-                    gen(exp.list[1]);
-                    emit(OP_JMP_IF_FALSE);
-
-                    // Else branch. Init with 0 address, will be
-                    // patched.
-                    emit(0);
-                    emit(0);
+                    // A constant test always takes the same branch
+                    if (auto branch = constantBranch(exp))
+                    {
+                        tailPosition_ = tail;
+                        gen(exp.list[branch]);
+                        break;
+                    }
 
-                    auto elseJmpAddr = getOffset() - 2;
+                    // Emit <test>, jumping to the else branch if it's
+                    // false. Init with 0 address, will be patched.
+                    auto elseJmpAddr = genJumpIfFalse(exp.list[1]);
 
                     // Emit <consequent>
+                    tailPosition_ = tail;
                     gen(exp.list[2]);
                     emit(OP_JMP);
 
@@ -310,6 +363,7 @@ public:
                     // Emit <alternate> if we have it
                     if (exp.list.size() == 4)
                     {
+                        tailPosition_ = tail;
                         gen(exp.list[3]);
                     }
 
@@ -322,22 +376,14 @@ public:
                 {
                     auto loopStartAddr = getOffset();
 
-                    // Emit <test>
-                    gen(exp.list[1]);
-
-                    // Jump to loop end. init with 0 address, will be patched.
-                    emit(OP_JMP_IF_FALSE);
-
-                    // Loop start: 2-byte dummy address
-                    emit(0);
-                    emit(0);
-
-                    // The point in the bytecode where we'll patch the jump
-                    // address for loop end
-                    auto loopEndJmpAddr = getOffset() - 2;
+                    // Emit <test>, jumping to loop end if it's false.
+                    // Init with 0 address, will be patched.
+                    auto loopEndJmpAddr = genJumpIfFalse(exp.list[1]);
 
-                    // Emit <body>
+                    // Emit <body>, its value is discarded
+                    // on every iteration
                     gen(exp.list[2]);
+                    emit(OP_POP);
 
                     // Jump to start of loop
                     emit(OP_JMP);
@@ -362,25 +408,17 @@ public:
                     // Loop start
                     auto loopStartAddr = getOffset();
 
-                    // Emit <test>
-                    gen(exp.list[2]);
-
-                    // Jump to loop end. init with 0 address, will be patched.
-                    emit(OP_JMP_IF_FALSE);
-
-                    // Loop start: 2-byte dummy address
-                    emit(0);
-                    emit(0);
-
-                    // The point in the bytecode where we'll patch the jump
-                    // address for loop end
-                    auto loopEndJmpAddr = getOffset() - 2;
+                    // Emit <test>, jumping to loop end if it's false.
+                    // Init with 0 address, will be patched.
+                    auto loopEndJmpAddr = genJumpIfFalse(exp.list[2]);
 
                     // Emit <varchange>
                     gen(exp.list[3]);
+                    emit(OP_POP);
 
                     // Emit <body>
                     gen(exp.list[4]);
+                    emit(OP_POP);
 
                     // Jump to start of loop
                     emit(OP_JMP);
@@ -422,15 +460,13 @@ public:
                     if (opCodeSetter == OP_SET_GLOBAL)
                     {
                         global->define(varName);
-                        emit(OP_SET_GLOBAL);
-                        emit(global->getGlobalIndex(varName));
+                        emitOp(OP_SET_GLOBAL, global->getGlobalIndex(varName));
                     }
                     // 2. Cells
                     else if (opCodeSetter == OP_SET_CELL)
                     {
                         co->cellNames.push_back(varName);
-                        emit(OP_SET_CELL);
-                        emit(co->cellNames.size() - 1);
+                        emitOp(OP_SET_CELL, co->cellNames.size() - 1);
                         // Explicitly pop the value from the stack,
                         // since it's promoted to the heap:
                         emit(OP_POP);
@@ -439,8 +475,7 @@ public:
                     else
                     {
                         co->addLocal(varName);
-                        emit(OP_SET_LOCAL);
-                        emit(co->getLocalIndex(varName));
+                        emitOp(OP_SET_LOCAL, co->getLocalIndex(varName));
                     }
 
                     break;
@@ -459,8 +494,7 @@ public:
                         gen(exp.list[1].list[1]);
 
                         // Property name:
-                        emit(OP_SET_PROP);
-                        emit(stringConstIdx(exp.list[1].list[2].string));
+                        emitOp(OP_SET_PROP, stringConstIdx(exp.list[1].list[2].string), propCacheIdx());
                     }
                     else
                     {
@@ -473,16 +507,19 @@ public:
                         // 1. Local vars
                         if (opCodeSetter == OP_SET_LOCAL)
                         {
-                            emit(OP_SET_LOCAL);
-                            emit(co->getLocalIndex(varName));
+                            emitOp(OP_SET_LOCAL, co->getLocalIndex(varName));
                         }
                         // 2. Cell vars
                         else if (opCodeSetter == OP_SET_CELL)
                         {
-                            emit(OP_SET_CELL);
-                            emit(co->getCellIndex(varName));
+                            emitOp(OP_SET_CELL, co->getCellIndex(varName));
                         }
-                        // 3. Global vars
+                        // 3. Vars of the frame that made this function
+                        else if (opCodeSetter == OP_SET_OUTER)
+                        {
+                            emitOp(OP_SET_OUTER, outerSlot(varName));
+                        }
+                        // 4. Global vars
                         else
                         {
                             auto globalIndex = global->getGlobalIndex(varName);
@@ -490,8 +527,7 @@ public:
                             {
                                 DIE << "[EvaCompiler] Reference error: " << varName << " does not exist, cannot set it." << std::endl;
                             }
-                            emit(OP_SET_GLOBAL);
-                            emit(globalIndex);
+                            emitOp(OP_SET_GLOBAL, globalIndex);
                         }
                     }
                 }
@@ -511,6 +547,7 @@ public:
                         bool isDecl = isDeclaration(exp.list[i]);
 
                         // Generate the code for this expression
+                        tailPosition_ = tail && isLast;
                         gen(exp.list[i]);
 
                         if (!isLast && !isDecl)
@@ -541,14 +578,12 @@ public:
                         if (isGlobalScope())
                         {
                             global->define(fnName);
-                            emit(OP_SET_GLOBAL);
-                            emit(global->getGlobalIndex(fnName));
+                            emitOp(OP_SET_GLOBAL, global->getGlobalIndex(fnName));
                         }
                         else
                         {
                             co->addLocal(fnName);
-                            emit(OP_SET_LOCAL);
-                            emit(co->getLocalIndex(fnName));
+                            emitOp(OP_SET_LOCAL, co->getLocalIndex(fnName));
                         }
                     }
                     else
@@ -603,13 +638,6 @@ public:
                         scopeStack_.pop();
                         classObject_ = prevClassObject;
                     }
-
-                    // Update the constructor to explicitly return 'self'
-                    // which is the argument at index 1
-                    auto constrFn = AS_FUNCTION(classObject->getProp("constructor"));
-                    constrFn->co->insertAtOffset(-3, OP_POP);
-                    constrFn->co->insertAtOffset(-3, OP_GET_LOCAL);
-                    constrFn->co->insertAtOffset(-3, 1);
                 }
                 // New operator (instances of classes)
                 else if (op == "new")
@@ -621,8 +649,7 @@ public:
                         DIE << "[EvaCompiler]: Unknown class " << className;
 
                     // Load class
-                    emit(OP_GET_GLOBAL);
-                    emit(global->getGlobalIndex(className));
+                    emitOp(OP_GET_GLOBAL, global->getGlobalIndex(className));
 
                     // New instance
                     emit(OP_NEW);
@@ -633,8 +660,7 @@ public:
                         gen(exp.list[i]);
 
                     // Call the constructor
-                    emit(OP_CALL);
-                    emit(AS_FUNCTION(cls->getProp("constructor"))->co->arity);
+                    emitCall(AS_FUNCTION(cls->getProp(symbols->intern("constructor")))->co->arity);
                 }
                 // Property access
                 else if (op == "prop")
@@ -643,8 +669,7 @@ public:
                     gen(exp.list[1]);
 
                     // Property name:
-                    emit(OP_GET_PROP);
-                    emit(stringConstIdx(exp.list[2].string));
+                    emitOp(OP_GET_PROP, stringConstIdx(exp.list[2].string), propCacheIdx());
                 }
                 // Super (parent) class operator
                 else if (op == "super")
@@ -658,31 +683,87 @@ public:
                     if (cls->superClass == nullptr)
                         DIE << "[EvaCompiler]: Class " << className << " doesn't have a super class.";
 
-                    emit(OP_GET_GLOBAL);
-                    emit(global->getGlobalIndex(cls->superClass->name));
+                    emitOp(OP_GET_GLOBAL, global->getGlobalIndex(cls->superClass->name));
                 }
                 // Named function calls
                 else
                 {
-                    FUNCTION_CALL(exp);
+                    genCall(exp, tail);
                 }
             }
             // Expression is a list but tag is not a symbol
+            // Method calls, on a variable or on the super class.
+            // Calls in tail position keep the generic form,
+            // so they reuse the frame.
+            else if (!tail && isMethodCall(exp))
+            {
+                genMethodCall(exp);
+            }
             // Lambda function calls
             else
             {
-                FUNCTION_CALL(exp);
+                genCall(exp, tail);
             }
             break; // TODO
         }
     }
 
+    // Lowers the code objects compiled so far to the register tier.
+    // Returns false if some of them can't run on it.
+    bool lowerToRegisters()
+    {
+        for (; loweredCount_ < codeObjects_.size(); loweredCount_++)
+        {
+            auto co = codeObjects_[loweredCount_];
+
+            // Main starts with an empty stack, functions with
+            // the callee and its arguments
+            auto depth = co == main->co ? 0 : co->arity + 1;
+            if (!registerCompiler_.compile(co, depth))
+                registerCodeComplete_ = false;
+        }
+        return registerCodeComplete_;
+    }
+
+    // Verifies the code objects compiled so far. Returns false if some
+    // of them were rejected, they have to run with runtime checks.
+    bool verifyBytecode()
+    {
+        for (; verifiedCount_ < codeObjects_.size(); verifiedCount_++)
+        {
+            auto co = codeObjects_[verifiedCount_];
+            auto depth = co == main->co ? 0 : co->arity + 1;
+            if (!verifier_.verify(co, depth, global->globals.size()))
+            {
+                std::cout << "Bytecode verification failed: " << verifier_.error << std::endl;
+                bytecodeVerified_ = false;
+            }
+        }
+        return bytecodeVerified_;
+    }
+
+    // Links the verified code objects compiled so far (see
+    // BytecodeLinker.h). Linked code points into the globals, so all
+    // of it is linked again when defining globals moved them.
+    void linkBytecode()
+    {
+        if (global->globals.data() != linkedGlobals_)
+        {
+            linkedGlobals_ = global->globals.data();
+            linkedCount_ = 0;
+        }
+        for (; linkedCount_ < codeObjects_.size(); linkedCount_++)
+            linker_.link(codeObjects_[linkedCount_], global->globals);
+    }
+
     // Disassemble all compilation units
     void disassembleBytecode()
     {
         for (auto &co : codeObjects_)
         {
             disassembler->disassemble(co);
+            if (!co->regCode.empty())
+                disassembler->disassembleRegisterCode(co);
         }
     }
 
@@ -699,9 +780,24 @@ private:
     // Global vars object
     std::shared_ptr<Global> global;
 
+    // Interned strings
+    std::shared_ptr<SymbolTable> symbols;
+
     // Scope info
     std::map<const Exp *, std::shared_ptr<Scope>> scopeInfo_;
 
+    // Value of an expression computed at compile time: a number,
+    // a boolean (comparisons) or a string (kept as characters)
+    struct ConstantValue
+    {
+        EvaValue value;
+        bool isString = false;
+        std::string string;
+
+        bool isNumber() const { return !isString && IS_NUMBER(value); }
+        bool isBoolean() const { return !isString && IS_BOOLEAN(value); }
+    };
+
     // Scopes stack
     std::stack<std::shared_ptr<Scope>> scopeStack_;
 
@@ -714,6 +810,36 @@ private:
     // All code objects
     std::vector<CodeObject *> codeObjects_;
 
+    // Jump addresses over 16 bits: (code object, address offset) -> target
+    std::map<std::pair<CodeObject *, size_t>, size_t> farJumps_;
+
+    // Offset of the last emitted OP_SCOPE_EXIT
+    size_t lastScopeExit_ = 0;
+
+    // Whether the value of the expression being generated
+    // is what the current function returns
+    bool tailPosition_ = false;
+
+    // Register tier code generator
+    RegisterCompiler registerCompiler_;
+
+    // Code objects lowered to the register tier so far, and
+    // whether all of them could be
+    size_t loweredCount_ = 0;
+    bool registerCodeComplete_ = true;
+
+    // Bytecode verifier, code objects verified so far and
+    // whether all of them passed
+    BytecodeVerifier verifier_;
+    size_t verifiedCount_ = 0;
+    bool bytecodeVerified_ = true;
+
+    // Bytecode linker, code objects linked so far and
+    // the globals they were linked against
+    BytecodeLinker linker_;
+    size_t linkedCount_ = 0;
+    const GlobalVar *linkedGlobals_ = nullptr;
+
     // GC Roots (things that should live as long as the VM)
     std::set<Traceable *> constantObjects_;
 
@@ -721,7 +847,7 @@ private:
     std::vector<ClassObject *> classObjects_;
 
     // Currently compiling class object
-    ClassObject *classObject_;
+    ClassObject *classObject_ = nullptr;
 
     // Comparison operators map
     static std::map<std::string, uint8_t> compareOps_;
@@ -729,6 +855,142 @@ private:
     // Emits bytecode
     void emit(uint8_t code) { co->code.push_back(code); }
 
+    // Emits an instruction with index operands. If some operand
+    // doesn't fit a byte, it's prefixed with OP_WIDE and all its
+    // operands are 16-bit.
+    template <typename... Operands>
+    void emitOp(uint8_t opcode, Operands... operands)
+    {
+        std::initializer_list<size_t> values = {(size_t)operands...};
+
+        auto wide = false;
+        for (auto value : values)
+        {
+            if (value > 0xFFFF)
+                DIE << "[EvaCompiler]: " << opcodeToString(opcode) << " operand out of range: "
+                    << (int64_t)value;
+            wide = wide || value > 0xFF;
+        }
+
+        if (wide)
+            emit(OP_WIDE);
+        emit(opcode);
+        for (auto value : values)
+        {
+            if (wide)
+                emit((value >> 8) & 0xFF);
+            emit(value & 0xFF);
+        }
+    }
+
+    // Emits a call, the argument count is a single byte. Calls in
+    // tail position reuse the caller's frame.
+    void emitCall(size_t argsCount, bool tail = false)
+    {
+        if (argsCount > 0xFF)
+            DIE << "[EvaCompiler]: Too many arguments in a call: " << argsCount;
+        emit(tail ? OP_TAIL_CALL : OP_CALL);
+        emit(argsCount);
+    }
+
+    // Lambdas called right away that don't escape (see analyze()) aren't
+    // tail calls, they use the caller's frame
+    void genCall(const Exp &exp, bool tail)
+    {
+        if (isLambda(exp.list[0]) && !scopeInfo_.at(&exp.list[0])->escapes)
+            tail = false;
+        FUNCTION_CALL(exp, tail);
+    }
+
+    // Slot of a variable of the frame that made
+    // the function being compiled, used in place
+    size_t outerSlot(const std::string &name)
+    {
+        auto &names = co->outerNames;
+        return std::find(names.begin(), names.end(), name) - names.begin();
+    }
+
+    // Method call: the receiver is evaluated once, as the first
+    // argument, and the VM inserts the method below the arguments.
+    // Super methods are bound at compile time.
+    void genMethodCall(const Exp &exp)
+    {
+        auto &callee = exp.list[0];
+        auto argsCount = exp.list.size() - 1;
+        if (argsCount > 0xFF)
+            DIE << "[EvaCompiler]: Too many arguments in a call: " << argsCount;
+
+        for (size_t i = 1; i < exp.list.size(); i++)
+            gen(exp.list[i]);
+
+        auto &methodName = callee.list[2].string;
+        if (isSuper(callee.list[1]))
+        {
+            auto method = findSuperMethod(callee.list[1], methodName);
+            emitOp(OP_INVOKE_SUPER, methodConstIdx(method), argsCount);
+        }
+        else
+        {
+            emitOp(OP_INVOKE, stringConstIdx(methodName), propCacheIdx(), argsCount);
+        }
+    }
+
+    // Finds the method a super call (prop (super <class>) <name>)
+    // refers to, nullptr if it's not a method of the super classes
+    FunctionObject *findSuperMethod(const Exp &superExp, const std::string &name)
+    {
+        auto cls = getClassByName(superExp.list[1].string);
+        if (cls == nullptr)
+            return nullptr;
+
+        auto prop = symbols->intern(name);
+        for (auto holder = cls->superClass; holder != nullptr; holder = holder->superClass)
+        {
+            auto slot = holder->shape->getSlot(prop);
+            if (slot != -1)
+                return IS_FUNCTION(holder->slots[slot]) ? AS_FUNCTION(holder->slots[slot]) : nullptr;
+        }
+        return nullptr;
+    }
+
+    // Emits a conditional jump taken when <test> is false, returns the
+    // offset of its (2-byte, to be patched) address. Comparisons are
+    // fused with the jump; a local compared against a number literal
+    // gets its own instruction with no stack traffic.
+    size_t genJumpIfFalse(const Exp &test)
+    {
+        if (isCompare(test) && !constantValue(test))
+        {
+            auto compareOp = compareOps_[test.list[0].string];
+            auto &lhs = test.list[1];
+            auto &rhs = test.list[2];
+
+            if (isLocalVar(lhs) && rhs.type == ExpType::NUMBER &&
+                co->getLocalIndex(lhs.string) <= 0xFF && numericConstIdx(rhs.number) <= 0xFF)
+            {
+                emit(OP_JMP_IF_NOT_CMP_LC);
+                emit(compareOp);
+                emit(co->getLocalIndex(lhs.string));
+                emit(numericConstIdx(rhs.number));
+            }
+            else
+            {
+                gen(lhs);
+                gen(rhs);
+                emit(OP_JMP_IF_NOT_LT + compareOp);
+            }
+        }
+        else
+        {
+            gen(test);
+            emit(OP_JMP_IF_FALSE);
+        }
+
+        emit(0);
+        emit(0);
+        return getOffset() - 2;
+    }
+
     // Compile a function
     void compileFunction(const Exp &exp, const std::string fnName, const Exp &params, const Exp &body)
     {
@@ -756,6 +1018,17 @@ private:
         co->cellNames.insert(co->cellNames.end(), scopeInfo->cell.begin(),
                              scopeInfo->cell.end());
 
+        // Variables of this frame used in place, by slot
+        for (const auto &name : scopeInfo->outer)
+        {
+            auto slot = prevCo->getLocalIndex(name);
+            if (slot == -1)
+                DIE << "[EvaCompiler]: " << name << " is not a local of " << prevCo->name;
+            if (co->outerNames.size() <= (size_t)slot)
+                co->outerNames.resize(slot + 1);
+            co->outerNames[slot] = name;
+        }
+
         // Store new co as a constant
         prevCo->addConstant(coValue);
 
@@ -766,34 +1039,48 @@ private:
         // parameters are added as variables
         for (auto i = 0; i < arity; i++)
         {
-            auto argName = params.list[i].string;
-            co->addLocal(argName);
+            co->addLocal(params.list[i].string);
+        }
 
-            // NOTE: if the param is captured by a cell, emit the code
-            // for it. We also don't pop the param value in this case,
-            // since OP_SCOPE_EXIT would pop it.
-            auto cellIndex = co->getCellIndex(argName);
-            if (cellIndex != -1)
+        // NOTE: if the function name or a param is captured by a cell,
+        // emit the code copying it there. Cells are allocated as they're
+        // first set, so in the order of their indices.
+        for (auto cellIndex = co->freeCount; cellIndex < co->cellNames.size(); cellIndex++)
+        {
+            auto localIndex = co->getLocalIndex(co->cellNames[cellIndex]);
+            if (localIndex != -1)
             {
-                emit(OP_SET_CELL);
-                emit(cellIndex);
+                emitOp(OP_GET_LOCAL, localIndex);
+                emitOp(OP_SET_CELL, cellIndex);
+                emit(OP_POP);
             }
         }
 
-        // Compile body in the new code object
+        // Compile body in the new code object. Its value is returned,
+        // so a call producing it is a tail call, except in constructors
+        // (they return 'self').
         auto prevClassObject = classObject_;
         classObject_ = nullptr;
+        tailPosition_ = prevClassObject == nullptr || fnName != "constructor";
         gen(body);
         classObject_ = prevClassObject;
 
         if (!isBlock(body))
         {
-            emit(OP_SCOPE_EXIT);
-            emit(arity + 1);
+            lastScopeExit_ = getOffset();
+            emitOp(OP_SCOPE_EXIT, arity + 1);
+        }
+
+        // Class constructors explicitly return 'self', which
+        // is the argument at index 1
+        if (classObject_ != nullptr && fnName == "constructor")
+        {
+            co->code.insert(co->code.begin() + lastScopeExit_, {OP_POP, OP_GET_LOCAL, 1});
         }
 
         // Explicit return to restore caller address
         emit(OP_RETURN);
+        relaxJumps();
 
         // Class methods are stored directly in the class.
         if (classObject_ != nullptr)
@@ -806,7 +1093,7 @@ private:
             co = prevCo;
 
             // Add method to the class object
-            classObject_->properties[fnName] = fn;
+            classObject_->setProp(symbols->intern(fnName), fn);
         }
 
         // 1. Simple functions (allocated at compile time):
@@ -814,7 +1101,7 @@ private:
         // have free variables), allocate it at compile time
         // and store as a constant. Closures are allocated at
         // runtime, but reuse the same code object.
-        if (scopeInfo->free.size() == 0)
+        if (scopeInfo->free.size() == 0 && co->outerNames.empty())
         {
             // Create the function:
             auto fn = ALLOC_FUNCTION(co);
@@ -827,50 +1114,105 @@ private:
             co->addConstant(fn);
 
             // And emit code for this new constant:
-            emit(OP_CONST);
-            emit(co->constants.size() - 1);
+            emitOp(OP_CONST, co->constants.size() - 1);
         }
         // 2. Closures
         // 2.1 Load all free vars to capture (indices are taken
         // from the cells of the parent co)
         // 2.2 Load code object for the current function
         // 2.3 Make function
+        // Functions using the frame making them in place are made
+        // at runtime too, from the object allocated here when they can.
         else
         {
+            if (!co->outerNames.empty())
+            {
+                auto fn = ALLOC_FUNCTION(co);
+                constantObjects_.insert((Traceable *)AS_OBJECT(fn));
+                co->frameFunction = AS_FUNCTION(fn);
+            }
+
             // Restore the code object
             co = prevCo;
 
-            for (const auto &freeVar : scopeInfo->free)
+            // In reverse, OP_MAKE_FUNCTION pops them
+            for (auto freeVar = scopeInfo->free.rbegin(); freeVar != scopeInfo->free.rend(); freeVar++)
             {
-                emit(OP_LOAD_CELL);
-                emit(prevCo->getCellIndex(freeVar));
+                emitOp(OP_LOAD_CELL, prevCo->getCellIndex(*freeVar));
             }
 
             // Load code object
-            emit(OP_CONST);
-            emit(co->constants.size() - 1);
+            emitOp(OP_CONST, co->constants.size() - 1);
 
             // Create the function
             emit(OP_MAKE_FUNCTION);
 
             // How many cells to capture:
+            if (scopeInfo->free.size() > 0xFF)
+                DIE << "[EvaCompiler]: " << fnName << " captures more than 255 variables";
             emit(scopeInfo->free.size());
         }
         scopeStack_.pop();
     }
 
-    // Allocates a numeric constant
-    size_t numericConstIdx(double value)
+    // Allocates a numeric constant for an integer literal: an integer
+    // value, or a double past the integer range (NaN-boxed values)
+    size_t numericConstIdx(int64_t value)
     {
-        ALLOC_CONST(IS_NUMBER, AS_NUMBER, NUMBER, value);
+        if (value < INTEGER_MIN || value > INTEGER_MAX)
+        {
+            auto number = (double)value;
+            ALLOC_CONST(IS_DOUBLE, AS_NUMBER, NUMBER, number);
+        }
+        else
+        {
+            ALLOC_CONST(IS_INTEGER, AS_INTEGER, INTEGER, value);
+        }
         return co->constants.size() - 1;
     }
 
-    // Allocates a string constant
+    // Allocates a double constant. They're told apart by their
+    // bits: 0 and -0 are different constants, NaN is found.
+    size_t doubleConstIdx(double value)
+    {
+        for (size_t i = 0; i < co->constants.size(); i++)
+        {
+            if (!IS_DOUBLE(co->constants[i]))
+                continue;
+            auto number = AS_NUMBER(co->constants[i]);
+            if (memcmp(&number, &value, sizeof(double)) == 0)
+                return i;
+        }
+        co->addConstant(NUMBER(value));
+        return co->constants.size() - 1;
+    }
+
+    // Allocates a constant computed at compile time
+    size_t constantIdx(const ConstantValue &constant)
+    {
+        if (constant.isString)
+            return stringConstIdx(constant.string);
+        if (constant.isBoolean())
+            return booleanConstIdx(AS_BOOLEAN(constant.value));
+        if (IS_INTEGER(constant.value))
+            return numericConstIdx(AS_INTEGER(constant.value));
+        return doubleConstIdx(AS_NUMBER(constant.value));
+    }
+
+    // Allocates a string constant. String constants are symbols
+    // (interned), so they're compared by pointer.
     size_t stringConstIdx(const std::string &value)
     {
-        ALLOC_CONST(IS_STRING, AS_CPPSTRING, ALLOC_STRING, value);
-        constantObjects_.insert((Traceable *)co->constants.back().object);
+        auto symbol = symbols->intern(value);
+        ALLOC_CONST(IS_STRING, AS_STRING, OBJECT, symbol);
+        return co->constants.size() - 1;
+    }
+
+    // Allocates a constant for a statically bound method
+    size_t methodConstIdx(FunctionObject *method)
+    {
+        constantObjects_.insert((Traceable *)method);
+        ALLOC_CONST(IS_FUNCTION, AS_FUNCTION, OBJECT, method);
         return co->constants.size() - 1;
     }
 
@@ -881,20 +1223,96 @@ private:
         return co->constants.size() - 1;
     }
 
+    // Allocates an inline cache for a property access site
+    size_t propCacheIdx()
+    {
+        co->propCaches.emplace_back();
+        return co->propCaches.size() - 1;
+    }
+
     // Writes byte at offset in code object
     void writeByteAtOffset(size_t offset, uint8_t value)
     {
         co->code[offset] = value;
     }
 
-    // Patches jump addresses for branching. Implicitly assumes that
-    // addresses are two bytes long.
-    void patchJumpAddress(size_t offset, uint16_t value)
+    // Patches jump addresses for branching. Addresses are two bytes
+    // long, the ones that don't fit are kept aside until relaxJumps()
+    // widens the jumps of the code object.
+    void patchJumpAddress(size_t offset, size_t value)
     {
+        if (value > 0xFFFF)
+            farJumps_[{co, offset}] = value;
+
         writeByteAtOffset(offset, (value >> 8) & 0xFF);
         writeByteAtOffset(offset + 1, value & 0xFF);
     }
 
+    // Once the code object is complete: if its code is too long for
+    // 16-bit addresses, rewrites every jump as an OP_WIDE jump with a
+    // 32-bit address.
+    void relaxJumps()
+    {
+        auto &code = co->code;
+        if (code.size() <= 0xFFFF)
+            return;
+
+        std::vector<uint8_t> wideCode;
+
+        // New offset of every old byte, and the jumps to patch:
+        // (address offset in the new code, old target)
+        std::vector<size_t> newOffsets(code.size() + 1);
+        std::vector<std::pair<size_t, size_t>> jumps;
+
+        for (size_t offset = 0; offset < code.size();)
+        {
+            auto opcode = code[offset];
+            auto size = instructionLength(code, offset);
+
+            if (!isJump(opcode))
+            {
+                for (size_t i = 0; i < size; i++)
+                {
+                    newOffsets[offset + i] = wideCode.size();
+                    wideCode.push_back(code[offset + i]);
+                }
+                offset += size;
+                continue;
+            }
+
+            newOffsets[offset] = wideCode.size();
+            wideCode.push_back(OP_WIDE);
+            wideCode.push_back(opcode);
+
+            if (opcode == OP_JMP_IF_NOT_CMP_LC)
+            {
+                // Compare op, then local and constant index
+                wideCode.push_back(code[offset + 1]);
+                wideCode.insert(wideCode.end(), {0, code[offset + 2], 0, code[offset + 3]});
+            }
+
+            auto addressOffset = offset + size - 2;
+            auto far = farJumps_.find({co, addressOffset});
+            auto target = far != farJumps_.end()
+                              ? far->second
+                              : (size_t)((code[addressOffset] << 8) | code[addressOffset + 1]);
+            jumps.push_back({wideCode.size(), target});
+            wideCode.insert(wideCode.end(), 4, 0);
+
+            offset += size;
+        }
+        newOffsets[code.size()] = wideCode.size();
+
+        for (const auto &jump : jumps)
+        {
+            auto address = newOffsets[jump.second];
+            for (auto i = 0; i < 4; i++)
+                wideCode[jump.first + i] = (address >> (8 * (3 - i))) & 0xFF;
+        }
+
+        code = std::move(wideCode);
+    }
+
     // Returns a class object by name.
     ClassObject *getClassByName(const std::string name)
     {
@@ -926,17 +1344,16 @@ private:
         // within this specific scope
         auto varsCount = getVarsCountOnScopeExit();
 
-        if (varsCount > 0 || co->arity > 0)
+        if (varsCount > 0 || isFunctionBody())
         {
-            emit(OP_SCOPE_EXIT);
-
             // For functions, do caller cleanup: pop all arguments
             // plus the function name from the stack
             if (isFunctionBody())
             {
                 varsCount += co->arity + 1;
             }
-            emit(varsCount);
+            lastScopeExit_ = getOffset();
+            emitOp(OP_SCOPE_EXIT, varsCount);
         }
 
         co->scopeLevel--;
@@ -969,6 +1386,173 @@ private:
     // (prop ...)
     bool isProp(const Exp &exp) { return isTaggedList(exp, "prop"); }
 
+    // (super <class>)
+    bool isSuper(const Exp &exp) { return isTaggedList(exp, "super"); }
+
+    // ((prop <var> <name>) <var> <args>...), a method called on a
+    // receiver held in a variable, or ((prop (super <class>) <name>) ...)
+    // for a method the super classes define
+    bool isMethodCall(const Exp &exp)
+    {
+        auto &callee = exp.list[0];
+        if (!isProp(callee) || exp.list.size() < 2)
+            return false;
+
+        auto &receiver = callee.list[1];
+        if (isSuper(receiver))
+            return findSuperMethod(receiver, callee.list[2].string) != nullptr;
+
+        return receiver.type == ExpType::SYMBOL && exp.list[1].type == ExpType::SYMBOL &&
+               receiver.string == exp.list[1].string;
+    }
+
+    // Value of an expression on literals (numbers and strings, not
+    // variables), computed as the VM would (see numberOp and
+    // compareValues). Operations it doesn't define a value for, such
+    // as adding a number to a string, are left to run.
+    std::optional<ConstantValue> constantValue(const Exp &exp)
+    {
+        if (exp.type == ExpType::NUMBER)
+        {
+            // Integer literals too large for an integer value are doubles
+            if (exp.number < INTEGER_MIN || exp.number > INTEGER_MAX)
+                return ConstantValue{NUMBER((double)exp.number)};
+            return ConstantValue{INTEGER(exp.number)};
+        }
+        if (exp.type == ExpType::STRING)
+            return ConstantValue{BOOLEAN(false), true, exp.string};
+        if (!isArithmetic(exp) && !isCompare(exp))
+            return std::nullopt;
+
+        auto lhs = constantValue(exp.list[1]);
+        if (!lhs)
+            return std::nullopt;
+        auto rhs = constantValue(exp.list[2]);
+        if (!rhs)
+            return std::nullopt;
+
+        auto numbers = lhs->isNumber() && rhs->isNumber();
+        auto op = exp.list[0].string;
+
+        if (isCompare(exp))
+        {
+            auto compareOp = compareOps_[op];
+            if (numbers)
+                return ConstantValue{BOOLEAN(compareNumbers(compareOp, lhs->value, rhs->value))};
+            if (lhs->isString && rhs->isString)
+                return ConstantValue{BOOLEAN(compareAs(compareOp, lhs->string, rhs->string))};
+            if (lhs->isBoolean() && rhs->isBoolean() && (compareOp == 2 || compareOp == 5))
+                return ConstantValue{BOOLEAN((AS_BOOLEAN(lhs->value) == AS_BOOLEAN(rhs->value)) == (compareOp == 2))};
+
+            // Different types are never ordered nor equal
+            return ConstantValue{BOOLEAN(compareOp == 5)};
+        }
+
+        if (op == "+" && lhs->isString && rhs->isString)
+            return ConstantValue{BOOLEAN(false), true, lhs->string + rhs->string};
+        if (!numbers)
+            return std::nullopt;
+
+        switch (op[0])
+        {
+        case '+':
+            return ConstantValue{numberOp<'+'>(lhs->value, rhs->value)};
+        case '-':
+            return ConstantValue{numberOp<'-'>(lhs->value, rhs->value)};
+        case '*':
+            return ConstantValue{numberOp<'*'>(lhs->value, rhs->value)};
+        default:
+            return ConstantValue{numberOp<'/'>(lhs->value, rhs->value)};
+        }
+    }
+
+    // The operand of an operation that leaves it as is, known to
+    // be a number: (* x 1), (* 1 x), (- x 0), (/ x 1) on a quotient
+    // (a double). Adding 0 isn't one (-0 + 0 is 0), nor is
+    // multiplying by 0 (NaN * 0 is NaN), so both run.
+    const Exp *identityOperand(const Exp &exp)
+    {
+        if (!isArithmetic(exp))
+            return nullptr;
+
+        auto op = exp.list[0].string;
+        auto &lhs = exp.list[1];
+        auto &rhs = exp.list[2];
+
+        if (op == "*" && isIntegerConstant(rhs, 1) && isNumeric(lhs))
+            return &lhs;
+        if (op == "*" && isIntegerConstant(lhs, 1) && isNumeric(rhs))
+            return &rhs;
+        if (op == "-" && isIntegerConstant(rhs, 0) && isNumeric(lhs))
+            return &lhs;
+        if (op == "/" && isIntegerConstant(rhs, 1) && isTaggedList(lhs, "/"))
+            return &lhs;
+        return nullptr;
+    }
+
+    // Index of the branch an (if <test> ...) always takes, when <test>
+    // is a constant boolean, or 0. A branch declaring a variable stays,
+    // and so does an if without an alternate that's never taken.
+    size_t constantBranch(const Exp &exp)
+    {
+        auto test = constantValue(exp.list[1]);
+        if (!test || !test->isBoolean())
+            return 0;
+
+        size_t branch = AS_BOOLEAN(test->value) ? 2 : 3;
+        size_t skipped = branch == 2 ? 3 : 2;
+        if (branch >= exp.list.size())
+            return 0;
+        if (skipped < exp.list.size() && (isTaggedList(exp.list[skipped], "var") ||
+                                          isTaggedList(exp.list[skipped], "def") ||
+                                          isTaggedList(exp.list[skipped], "class")))
+            return 0;
+        return branch;
+    }
+
+    // Whether an expression evaluates to a number, whatever
+    // its operands: arithmetic other than +, which also
+    // concatenates strings, gives numbers
+    bool isNumeric(const Exp &exp)
+    {
+        if (exp.type == ExpType::NUMBER)
+            return true;
+        if (!isArithmetic(exp))
+            return false;
+        if (exp.list[0].string != "+")
+            return true;
+        return isNumeric(exp.list[1]) && isNumeric(exp.list[2]);
+    }
+
+    bool isIntegerConstant(const Exp &exp, int64_t value)
+    {
+        auto constant = constantValue(exp);
+        return constant && constant->isNumber() && IS_INTEGER(constant->value) &&
+               AS_INTEGER(constant->value) == value;
+    }
+
+    // Arithmetic (+ a b), (- a b), ...
+    bool isArithmetic(const Exp &exp)
+    {
+        static const std::set<std::string> ops = {"+", "-", "*", "/"};
+        return exp.type == ExpType::LIST && exp.list.size() == 3 &&
+               exp.list[0].type == ExpType::SYMBOL && ops.count(exp.list[0].string) != 0;
+    }
+
+    // Comparisons (< a b), (== a b), ...
+    bool isCompare(const Exp &exp)
+    {
+        return exp.type == ExpType::LIST && exp.list.size() == 3 &&
+               exp.list[0].type == ExpType::SYMBOL && compareOps_.count(exp.list[0].string) != 0;
+    }
+
+    // A variable stored in a stack slot of the current frame
+    bool isLocalVar(const Exp &exp)
+    {
+        return exp.type == ExpType::SYMBOL && exp.string != "true" && exp.string != "false" &&
+               scopeStack_.top()->getNameGetter(exp.string) == OP_GET_LOCAL;
+    }
+
     // Blocks
     bool isBlock(const Exp &exp)
     {
@@ -1000,7 +1584,7 @@ private:
     }
 
     // Returns current bytecode offset.
-    uint16_t getOffset() { return (uint16_t)co->code.size(); }
+    size_t getOffset() { return co->code.size(); }
 };
 
 // Comparison operators map
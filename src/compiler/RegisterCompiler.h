@@ -0,0 +1,564 @@
+// Eva Register Compiler.
+// Lowers the stack bytecode of a code object to the register
+// instruction set (see RegisterOpCode.h).
+
+#ifndef RegisterCompiler_h
+#define RegisterCompiler_h
+
+#include <map>
+#include <vector>
+
+#include "src/bytecode/OpCode.h"
+#include "src/bytecode/RegisterOpCode.h"
+#include "src/vm/EvaValue.h"
+
+// The stack code is walked once while tracking, for every stack slot,
+// where its value currently is: in its own register, in another one
+// (a local read by GET_LOCAL) or in the constant pool (CONST). Values
+// are only copied into their slot when an instruction needs them there
+// (calls, jumps), so `(set i (+ i 1))` becomes a single ADD i, i, K.
+class RegisterCompiler
+{
+public:
+    // Lowers `co` into co->regCode, `depth` is the number of stack
+    // slots already in use on entry (callee and arguments). Returns
+    // false if the code can't be expressed in registers (operands out
+    // of range, unknown stack depth), leaving co->regCode empty.
+    bool compile(CodeObject *co, size_t depth)
+    {
+        this->co = co;
+        out_.clear();
+        stack_.clear();
+        patches_.clear();
+        lastDst_ = NO_DST;
+        scopeExitMove_ = NO_DST;
+        maxDepth_ = depth;
+
+        for (size_t i = 0; i < depth; i++)
+        {
+            stack_.push_back(reg(i));
+        }
+
+        if (!lower())
+        {
+            return false;
+        }
+
+        co->regCode = std::move(out_);
+        co->regFrameSize = maxDepth_;
+        return true;
+    }
+
+private:
+    // Where the value of a stack slot is
+    struct Operand
+    {
+        bool isConst;
+        size_t index;
+
+        bool operator==(const Operand &other) const
+        {
+            return isConst == other.isConst && index == other.index;
+        }
+        bool operator!=(const Operand &other) const { return !(*this == other); }
+    };
+
+    static Operand reg(size_t index) { return {false, index}; }
+    static Operand constant(size_t index) { return {true, index}; }
+
+    static constexpr size_t NO_DST = (size_t)-1;
+
+    bool lower()
+    {
+        auto &code = co->code;
+
+        // Stack depth at each jump target, -1 until known
+        std::map<size_t, int> targets;
+        for (size_t offset = 0; offset < code.size(); offset += instructionSize(code[offset]))
+        {
+            // Wide operands don't fit register operands
+            if (code[offset] == OP_WIDE)
+                return false;
+
+            auto addressOffset = jumpAddressOffset(code[offset]);
+            if (addressOffset != 0)
+            {
+                targets[readAddress(offset + addressOffset)] = -1;
+            }
+        }
+
+        // Register code offset of each (reachable) jump target
+        std::map<size_t, size_t> labels;
+
+        auto reachable = true;
+
+        for (size_t offset = 0; offset < code.size(); offset += instructionSize(code[offset]))
+        {
+            auto target = targets.find(offset);
+            if (target != targets.end())
+            {
+                if (reachable)
+                {
+                    // Fall through: all paths agree on registers
+                    flush();
+                    if (target->second != -1 && target->second != (int)stack_.size())
+                        return false;
+                    target->second = stack_.size();
+                }
+                else if (target->second != -1)
+                {
+                    // Only reached by jumps
+                    stack_.clear();
+                    for (size_t i = 0; i < (size_t)target->second; i++)
+                        stack_.push_back(reg(i));
+                    reachable = true;
+                }
+
+                // Targets of unreachable jumps only stay unreachable
+                if (reachable)
+                {
+                    labels[offset] = out_.size();
+                    lastDst_ = NO_DST;
+                    scopeExitMove_ = NO_DST;
+                }
+            }
+
+            if (!reachable)
+            {
+                continue;
+            }
+
+            auto opcode = genericOpcode(code[offset]);
+            auto operand = [&](size_t i)
+            { return code[offset + i]; };
+
+            switch (opcode)
+            {
+            case OP_HALT:
+            case OP_RETURN:
+            {
+                // Return straight from the register the
+                // function body's scope exit moved from
+                if (scopeExitMove_ != NO_DST && scopeExitMove_ + 3 == out_.size() &&
+                    stack_.back() == reg(out_[scopeExitMove_ + 1]))
+                {
+                    stack_.back() = reg(out_[scopeExitMove_ + 2]);
+                    out_.resize(scopeExitMove_);
+                }
+
+                auto result = rk(top());
+                emit(opcode == OP_HALT ? ROP_HALT : ROP_RETURN);
+                emit(result);
+                reachable = false;
+                break;
+            }
+            case OP_CONST:
+                stack_.push_back(constant(operand(1)));
+                lastDst_ = NO_DST;
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            {
+                auto dst = top() - 1;
+                auto op1 = rk(dst);
+                auto op2 = rk(top());
+                stack_.pop_back();
+                emitResult(ROP_ADD + (opcode - OP_ADD), dst, {op1, op2});
+                break;
+            }
+            case OP_COMPARE:
+            {
+                auto dst = top() - 1;
+                auto op1 = rk(dst);
+                auto op2 = rk(top());
+                stack_.pop_back();
+                emitResult(ROP_COMPARE, dst, {operand(1), op1, op2});
+                break;
+            }
+            case OP_JMP_IF_FALSE:
+            {
+                auto cond = rk(top());
+                stack_.pop_back();
+                flush();
+                emit(ROP_JMP_IF_FALSE);
+                emit(cond);
+                if (!emitJump(targets, readAddress(offset + 1)))
+                    return false;
+                break;
+            }
+            case OP_JMP_IF_NOT_LT:
+            case OP_JMP_IF_NOT_GT:
+            case OP_JMP_IF_NOT_EQ:
+            case OP_JMP_IF_NOT_LE:
+            case OP_JMP_IF_NOT_GE:
+            case OP_JMP_IF_NOT_NE:
+            {
+                auto op1 = rk(top() - 1);
+                auto op2 = rk(top());
+                stack_.resize(stack_.size() - 2);
+                flush();
+                emit(ROP_JMP_IF_NOT);
+                emit(opcode - OP_JMP_IF_NOT_LT);
+                emit(op1);
+                emit(op2);
+                if (!emitJump(targets, readAddress(offset + 1)))
+                    return false;
+                break;
+            }
+            case OP_JMP_IF_NOT_CMP_LC:
+            {
+                auto localIndex = operand(2);
+                if (localIndex >= stack_.size() || operand(3) >= RK_CONST)
+                    return false;
+                auto op1 = rk(localIndex);
+                flush();
+                emit(ROP_JMP_IF_NOT);
+                emit(operand(1));
+                emit(op1);
+                emit(operand(3) | RK_CONST);
+                if (!emitJump(targets, readAddress(offset + 4)))
+                    return false;
+                break;
+            }
+            case OP_JMP:
+                flush();
+                emit(ROP_JMP);
+                if (!emitJump(targets, readAddress(offset + 1)))
+                    return false;
+                reachable = false;
+                break;
+            case OP_GET_GLOBAL:
+            case OP_GET_CELL:
+            case OP_LOAD_CELL:
+            case OP_GET_OUTER:
+            {
+                auto dst = stack_.size();
+                stack_.push_back(reg(dst));
+                auto ropcode = opcode == OP_GET_GLOBAL ? ROP_GET_GLOBAL
+                               : opcode == OP_GET_CELL ? ROP_GET_CELL
+                               : opcode == OP_GET_OUTER ? ROP_GET_OUTER
+                                                        : ROP_LOAD_CELL;
+                emitResult(ropcode, dst, {operand(1)});
+                break;
+            }
+            case OP_SET_GLOBAL:
+            case OP_SET_CELL:
+            case OP_SET_OUTER:
+            {
+                auto value = rk(top());
+                emit(opcode == OP_SET_GLOBAL  ? ROP_SET_GLOBAL
+                     : opcode == OP_SET_CELL ? ROP_SET_CELL
+                                             : ROP_SET_OUTER);
+                emit(operand(1));
+                emit(value);
+                break;
+            }
+            case OP_POP:
+                stack_.pop_back();
+                lastDst_ = NO_DST;
+                break;
+            case OP_GET_LOCAL:
+            {
+                auto localIndex = operand(1);
+                if (localIndex >= stack_.size())
+                    return false;
+                stack_.push_back(stack_[localIndex]);
+                lastDst_ = NO_DST;
+                break;
+            }
+            case OP_SET_LOCAL:
+                if (!setLocal(operand(1)))
+                    return false;
+                break;
+            case OP_SCOPE_EXIT:
+            {
+                auto count = operand(1);
+                auto result = stack_.back();
+                auto dst = top() - count;
+
+                if (!result.isConst && result.index > dst)
+                {
+                    // The value lives in a slot that is going away
+                    if (!retarget(result.index, dst))
+                    {
+                        scopeExitMove_ = out_.size();
+                        emit(ROP_MOVE);
+                        emit(dst);
+                        emit(result.index);
+                    }
+                    result = reg(dst);
+                }
+                stack_.resize(dst);
+                stack_.push_back(result);
+                break;
+            }
+            case OP_CALL:
+            {
+                auto argsCount = operand(1);
+                auto base = top() - argsCount;
+                flush();
+                emit(ROP_CALL);
+                emit(base);
+                emit(argsCount);
+                stack_.resize(base);
+                stack_.push_back(reg(base));
+                break;
+            }
+            case OP_TAIL_CALL:
+            {
+                auto argsCount = operand(1);
+                auto base = top() - argsCount;
+                flush();
+                emit(ROP_TAIL_CALL);
+                emit(base);
+                emit(argsCount);
+                reachable = false;
+                break;
+            }
+            case OP_INVOKE:
+            case OP_INVOKE_SUPER:
+            {
+                auto invoke = opcode == OP_INVOKE;
+                auto argsCount = operand(invoke ? 3 : 2);
+                auto base = top() - argsCount + 1;
+                flush();
+                emit(invoke ? ROP_INVOKE : ROP_INVOKE_SUPER);
+                emit(base);
+                emit(operand(1));
+                if (invoke)
+                    emit(operand(2));
+                emit(argsCount);
+
+                // The method is inserted below the arguments
+                maxDepth_ = std::max(maxDepth_, base + argsCount + 1);
+                stack_.resize(base);
+                stack_.push_back(reg(base));
+                break;
+            }
+            case OP_MAKE_FUNCTION:
+            {
+                auto coOperand = stack_.back();
+                if (!coOperand.isConst)
+                    return false;
+                stack_.pop_back();
+                flush();
+
+                auto cellsCount = operand(1);
+                auto dst = stack_.size() - cellsCount;
+                stack_.resize(dst);
+                stack_.push_back(reg(dst));
+                emitResult(ROP_MAKE_FUNCTION, dst, {(uint8_t)coOperand.index, cellsCount});
+                lastDst_ = NO_DST;
+                break;
+            }
+            case OP_NEW:
+            {
+                flush();
+                auto dst = top();
+                emit(ROP_NEW);
+                emit(dst);
+                stack_.push_back(reg(dst + 1));
+                break;
+            }
+            case OP_GET_PROP:
+            {
+                auto dst = top();
+                auto object = rk(dst);
+                emitResult(ROP_GET_PROP, dst, {object, operand(1), operand(2)});
+                break;
+            }
+            case OP_SET_PROP:
+            {
+                auto object = rk(top());
+                auto value = rk(top() - 1);
+                stack_.pop_back();
+                emit(ROP_SET_PROP);
+                emit(object);
+                emit(value);
+                emit(operand(1));
+                emit(operand(2));
+                break;
+            }
+            default:
+                return false;
+            }
+
+            maxDepth_ = std::max(maxDepth_, stack_.size());
+        }
+
+        if (maxDepth_ > RK_CONST)
+            return false;
+
+        // Patch jump addresses to register code offsets
+        for (const auto &patch : patches_)
+        {
+            auto label = labels.find(patch.second);
+            if (label == labels.end() || label->second > 0xFFFF)
+                return false;
+            out_[patch.first] = (label->second >> 8) & 0xFF;
+            out_[patch.first + 1] = label->second & 0xFF;
+        }
+
+        return true;
+    }
+
+    // Offset of the 16-bit address operand of a jump, 0 otherwise
+    static size_t jumpAddressOffset(uint8_t opcode)
+    {
+        switch (opcode)
+        {
+        case OP_JMP_IF_FALSE:
+        case OP_JMP:
+        case OP_JMP_IF_NOT_LT:
+        case OP_JMP_IF_NOT_GT:
+        case OP_JMP_IF_NOT_EQ:
+        case OP_JMP_IF_NOT_LE:
+        case OP_JMP_IF_NOT_GE:
+        case OP_JMP_IF_NOT_NE:
+            return 1;
+        case OP_JMP_IF_NOT_CMP_LC:
+            return 4;
+        default:
+            return 0;
+        }
+    }
+
+    uint16_t readAddress(size_t offset)
+    {
+        return (uint16_t)((co->code[offset] << 8) | co->code[offset + 1]);
+    }
+
+    // Index of the top stack slot
+    size_t top() { return stack_.size() - 1; }
+
+    void emit(uint8_t byte) { out_.push_back(byte); }
+
+    // Emits an instruction writing its result to register `dst`,
+    // which now holds the value of that slot.
+    void emitResult(uint8_t opcode, size_t dst, std::initializer_list<uint8_t> operands)
+    {
+        emit(opcode);
+        lastDst_ = out_.size();
+        emit(dst);
+        for (auto byte : operands)
+            emit(byte);
+        lastEnd_ = out_.size();
+        stack_[dst] = reg(dst);
+    }
+
+    // Emits the (to be patched) address of a jump, recording the
+    // stack depth at the target.
+    bool emitJump(std::map<size_t, int> &targets, size_t address)
+    {
+        auto &depth = targets[address];
+        if (depth != -1 && depth != (int)stack_.size())
+            return false;
+        depth = stack_.size();
+
+        patches_.push_back({out_.size(), address});
+        emit(0);
+        emit(0);
+        lastDst_ = NO_DST;
+        return true;
+    }
+
+    // If the last instruction just wrote register `from`, makes
+    // it write to `to` instead.
+    bool retarget(size_t from, size_t to)
+    {
+        if (lastDst_ == NO_DST || lastEnd_ != out_.size() || out_[lastDst_] != from)
+            return false;
+        out_[lastDst_] = to;
+        lastDst_ = NO_DST;
+        return true;
+    }
+
+    // RK operand for the value of a stack slot
+    uint8_t rk(size_t slot)
+    {
+        auto operand = stack_[slot];
+        if (operand.isConst && operand.index >= RK_CONST)
+        {
+            materialize(slot);
+            operand = stack_[slot];
+        }
+        return operand.isConst ? operand.index | RK_CONST : operand.index;
+    }
+
+    // Copies the value of a stack slot into its own register
+    void materialize(size_t slot)
+    {
+        auto operand = stack_[slot];
+        if (operand == reg(slot))
+            return;
+
+        emit(operand.isConst ? ROP_LOADK : ROP_MOVE);
+        emit(slot);
+        emit(operand.index);
+        stack_[slot] = reg(slot);
+        lastDst_ = NO_DST;
+    }
+
+    // Copies all slots into their registers (before jumps and calls)
+    void flush()
+    {
+        for (size_t slot = 0; slot < stack_.size(); slot++)
+            materialize(slot);
+    }
+
+    // SET_LOCAL: the value on top is stored into the local's slot
+    // and stays on the stack.
+    bool setLocal(size_t localIndex)
+    {
+        auto slot = top();
+        if (localIndex > slot)
+            return false;
+
+        // Pending reads of the local must keep the old value
+        for (size_t i = 0; i < slot; i++)
+        {
+            if (i != localIndex && stack_[i] == reg(localIndex))
+                materialize(i);
+        }
+
+        auto value = stack_[slot];
+        if (value != reg(localIndex) && !(value == reg(slot) && retarget(slot, localIndex)))
+        {
+            emit(value.isConst ? ROP_LOADK : ROP_MOVE);
+            emit(localIndex);
+            emit(value.index);
+        }
+        lastDst_ = NO_DST;
+
+        stack_[localIndex] = reg(localIndex);
+        stack_[slot] = reg(localIndex);
+        return true;
+    }
+
+    // Code object being lowered
+    CodeObject *co;
+
+    // Register code
+    std::vector<uint8_t> out_;
+
+    // Value location of each stack slot
+    std::vector<Operand> stack_;
+
+    // Jump address operands to patch: (offset in out_, stack target)
+    std::vector<std::pair<size_t, size_t>> patches_;
+
+    // Offset of the destination operand of the last instruction
+    // with a retargetable result, and where that instruction ends.
+    size_t lastDst_;
+    size_t lastEnd_ = 0;
+
+    // Offset of the MOVE emitted by the last scope exit
+    size_t scopeExitMove_;
+
+    // Registers needed by a frame
+    size_t maxDepth_;
+};
+
+#endif // RegisterCompiler_h
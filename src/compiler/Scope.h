@@ -23,6 +23,7 @@ enum class AllocType
     GLOBAL,
     LOCAL,
     CELL,
+    OUTER,
 };
 
 // Scope analysis structure
@@ -34,6 +35,7 @@ struct Scope
     // Register a local variable
     void addLocal(const std::string &name)
     {
+        declared.insert(name);
         allocInfo[name] = type == ScopeType::GLOBAL ? AllocType::GLOBAL : AllocType::LOCAL;
     }
 
@@ -62,7 +64,7 @@ struct Scope
         }
 
         // Already promoted!
-        if (initAllocType == AllocType::CELL)
+        if (initAllocType == AllocType::CELL || initAllocType == AllocType::OUTER)
             return;
 
         auto [ownerScope, allocType] = resolve(name, initAllocType);
@@ -70,10 +72,14 @@ struct Scope
         // Update the alloc type based on resolution
         allocInfo[name] = allocType;
 
-        // If we resolve it as a cell, promote to the heap:
+        // If we resolve it as a cell, promote to the heap, unless
+        // the function using it doesn't escape the owner's frame:
         if (allocType == AllocType::CELL)
         {
-            promote(name, ownerScope);
+            if (ownerScope->allocInfo[name] != AllocType::CELL && canUseInPlace(ownerScope))
+                useInPlace(name, ownerScope);
+            else
+                promote(name, ownerScope);
         }
     }
 
@@ -84,8 +90,8 @@ struct Scope
         // resolution we pass the own-function boundary, it has to be free, and
         // hence should be promoted to a cell (unless its actually global).
 
-        // Found in current scope:
-        if (allocInfo.count(name) != 0)
+        // Declared in current scope:
+        if (declared.count(name) != 0)
         {
             return std::make_pair(this, allocType);
         }
@@ -124,6 +130,8 @@ struct Scope
             return OP_GET_LOCAL;
         case AllocType::CELL:
             return OP_GET_CELL;
+        case AllocType::OUTER:
+            return OP_GET_OUTER;
         default:
             DIE << "[Scope] Invalid allocType for var " << name << ". Cannot proceed." << std::endl;
             return OP_GET_GLOBAL;
@@ -141,6 +149,8 @@ struct Scope
             return OP_SET_LOCAL;
         case AllocType::CELL:
             return OP_SET_CELL;
+        case AllocType::OUTER:
+            return OP_SET_OUTER;
         default:
             DIE << "[Scope] Invalid allocType for var " << name << ". Cannot proceed with emitting a set opcode." << std::endl;
             return OP_SET_GLOBAL;
@@ -152,8 +162,25 @@ struct Scope
     {
         ownerScope->addCell(name);
 
-        // Thread the variable as free in all parent scopes so it's propagated
-        // down to the scope where it's needed.
+        // Functions that used it in place capture the cell instead
+        auto users = ownerScope->inPlaceUsers.find(name);
+        if (users != ownerScope->inPlaceUsers.end())
+        {
+            for (auto user : users->second)
+            {
+                user->functionScope()->outer.erase(name);
+                user->threadFree(name, ownerScope);
+            }
+            ownerScope->inPlaceUsers.erase(users);
+        }
+
+        threadFree(name, ownerScope);
+    }
+
+    // Thread the variable as free in all parent scopes so it's propagated
+    // down to the scope where it's needed.
+    void threadFree(const std::string &name, Scope *ownerScope)
+    {
         auto scope = this;
         while (scope != ownerScope)
         {
@@ -162,11 +189,67 @@ struct Scope
         }
     }
 
+    // Whether this scope can use a variable of `ownerScope` in place:
+    // it's in a function that doesn't escape (it's only ever called
+    // while the frame making it runs) made directly in the owner's
+    // function, so the variable stays in that frame's stack slot.
+    bool canUseInPlace(Scope *ownerScope)
+    {
+        auto fnScope = functionScope();
+        if (fnScope == nullptr || fnScope->escapes || ownerScope->type == ScopeType::CLASS)
+            return false;
+
+        for (auto scope = fnScope->parent.get(); scope != ownerScope; scope = scope->parent.get())
+        {
+            if (scope->type == ScopeType::FUNCTION || scope->type == ScopeType::CLASS)
+                return false;
+        }
+        return true;
+    }
+
+    // Uses a variable of `ownerScope` in place. It's promoted to a cell
+    // if some function that may escape captures it later.
+    void useInPlace(const std::string &name, Scope *ownerScope)
+    {
+        allocInfo[name] = AllocType::OUTER;
+        functionScope()->outer.insert(name);
+        ownerScope->inPlaceUsers[name].push_back(this);
+    }
+
+    // Innermost function scope this scope is in
+    Scope *functionScope()
+    {
+        auto scope = this;
+        while (scope != nullptr && scope->type != ScopeType::FUNCTION)
+            scope = scope->parent.get();
+        return scope;
+    }
+
+    // Scope declaring the variable `name` refers to here,
+    // nullptr if the program doesn't declare it (natives)
+    Scope *findDeclaration(const std::string &name)
+    {
+        auto scope = this;
+        while (scope != nullptr && scope->declared.count(name) == 0)
+            scope = scope->parent.get();
+        return scope;
+    }
+
     ScopeType type;
     std::shared_ptr<Scope> parent;
     std::map<std::string, AllocType> allocInfo;
+    std::set<std::string> declared;
     std::set<std::string> free;
     std::set<std::string> cell;
+
+    // Function scopes: whether the function may outlive the frame
+    // making it (it's stored, returned or passed around), and the
+    // variables of that frame it uses in place when it can't
+    bool escapes = true;
+    std::set<std::string> outer;
+
+    // Scopes using a variable declared here in place, by name
+    std::map<std::string, std::vector<Scope *>> inPlaceUsers;
 };
 
 #endif // Scope_h
@@ -8,6 +8,7 @@
 #include <iomanip>
 
 #include "src/bytecode/OpCode.h"
+#include "src/bytecode/RegisterOpCode.h"
 #include "src/vm/EvaValue.h"
 #include "src/vm/Global.h"
 #include "src/vm/Logger.h"
@@ -35,6 +36,24 @@ public:
         std::cout << "--------- Disassembly complete ---------" << std::endl;
     }
 
+    // Disassembles the register tier code of a code unit
+    void disassembleRegisterCode(CodeObject *co)
+    {
+        std::cout << std::endl
+                  << "------ Register disassembly: " << co->name
+                  << " (" << co->regFrameSize << " registers) ------" << std::endl
+                  << std::endl;
+
+        size_t offset = 0;
+        while (offset < co->regCode.size())
+        {
+            offset = disassembleRegisterInstruction(co, offset);
+            std::cout << std::endl;
+        }
+
+        std::cout << "--------- Disassembly complete ---------" << std::endl;
+    }
+
 private:
     // Global var object
     std::shared_ptr<Global> global;
@@ -63,6 +82,7 @@ private:
             return disassembleSimple(co, opcode, offset);
         case OP_SCOPE_EXIT:
         case OP_CALL:
+        case OP_TAIL_CALL:
             return disassembleWord(co, opcode, offset);
         case OP_CONST:
             return disassembleConst(co, opcode, offset);
@@ -70,7 +90,15 @@ private:
             return disassembleCompare(co, opcode, offset);
         case OP_JMP_IF_FALSE:
         case OP_JMP:
+        case OP_JMP_IF_NOT_LT:
+        case OP_JMP_IF_NOT_GT:
+        case OP_JMP_IF_NOT_EQ:
+        case OP_JMP_IF_NOT_LE:
+        case OP_JMP_IF_NOT_GE:
+        case OP_JMP_IF_NOT_NE:
             return disassembleJump(co, opcode, offset);
+        case OP_JMP_IF_NOT_CMP_LC:
+            return disassembleCompareLocalConst(co, opcode, offset);
         case OP_GET_GLOBAL:
         case OP_SET_GLOBAL:
             return disassembleGlobal(co, opcode, offset);
@@ -83,9 +111,25 @@ private:
             return disassembleCell(co, opcode, offset);
         case OP_MAKE_FUNCTION:
             return disassembleMakeFunction(co, opcode, offset);
+        case OP_GET_OUTER:
+        case OP_SET_OUTER:
+            return disassembleOuter(co, opcode, offset);
         case OP_GET_PROP:
         case OP_SET_PROP:
             return disassembleProperty(co, opcode, offset);
+        case OP_ADD_NUM:
+        case OP_LT_NUM:
+        case OP_GT_NUM:
+        case OP_EQ_NUM:
+        case OP_LE_NUM:
+        case OP_GE_NUM:
+        case OP_NE_NUM:
+            return disassembleQuickened(co, opcode, offset);
+        case OP_INVOKE:
+        case OP_INVOKE_SUPER:
+            return disassembleInvoke(co, opcode, offset);
+        case OP_WIDE:
+            return disassembleWide(co, offset);
         default:
             DIE << "disassembleInstruction: no disassembly for "
                 << opcodeToString(opcode)
@@ -97,6 +141,197 @@ private:
         return 0;
     }
 
+    // Disassembles an instruction prefixed with OP_WIDE
+    size_t disassembleWide(CodeObject *co, size_t offset)
+    {
+        std::ios_base::fmtflags f(std::cout.flags());
+
+        auto opcode = co->code[offset + 1];
+        auto size = wideInstructionSize(opcode);
+        dumpBytes(co, offset, size);
+        printOpCode(opcode);
+        std::cout << "(wide) ";
+
+        auto word = [&](size_t i)
+        { return (size_t)readWordAtOffset(co, offset + i); };
+        auto address = [&](size_t i)
+        { return (word(i) << 16) | word(i + 2); };
+
+        switch (opcode)
+        {
+        case OP_CONST:
+            std::cout << word(2) << " (" << evaValueToConstantString(co->constants[word(2)]) << ")";
+            break;
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+            std::cout << word(2) << " (" << global->get(word(2)).name << ")";
+            break;
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+            std::cout << word(2) << " (" << co->locals[word(2)].name << ")";
+            break;
+        case OP_GET_CELL:
+        case OP_SET_CELL:
+        case OP_LOAD_CELL:
+            std::cout << word(2) << " (" << co->cellNames[word(2)] << ")";
+            break;
+        case OP_GET_OUTER:
+        case OP_SET_OUTER:
+            std::cout << word(2) << " (" << co->outerNames[word(2)] << ")";
+            break;
+        case OP_GET_PROP:
+        case OP_SET_PROP:
+            std::cout << word(2) << " (" << AS_CPPSTRING(co->constants[word(2)]) << ")"
+                      << " ic " << word(4);
+            break;
+        case OP_INVOKE:
+            std::cout << word(2) << " (" << AS_CPPSTRING(co->constants[word(2)]) << ")"
+                      << " ic " << word(4) << " args " << word(6);
+            break;
+        case OP_INVOKE_SUPER:
+            std::cout << word(2) << " (" << evaValueToConstantString(co->constants[word(2)]) << ")"
+                      << " args " << word(4);
+            break;
+        case OP_JMP_IF_NOT_CMP_LC:
+            std::cout << "(" << co->locals[word(3)].name << " "
+                      << inverseCompareOps_[co->code[offset + 2]] << " "
+                      << evaValueToConstantString(co->constants[word(5)]) << ") "
+                      << std::uppercase << std::hex << std::setfill('0') << std::setw(8)
+                      << address(7);
+            break;
+        default:
+            if (isJump(opcode))
+                std::cout << std::uppercase << std::hex << std::setfill('0') << std::setw(8)
+                          << address(2);
+            else
+                std::cout << word(2);
+        }
+
+        std::cout.flags(f);
+
+        return offset + size;
+    }
+
+    // Disassembles a single register instruction: operands are printed
+    // as registers (r0), constants (k0) or plain numbers.
+    size_t disassembleRegisterInstruction(CodeObject *co, size_t offset)
+    {
+        std::ios_base::fmtflags f(std::cout.flags());
+
+        std::cout << std::uppercase << std::hex << std::setfill('0') << std::setw(4)
+                  << offset << "    ";
+        std::cout.flags(f);
+
+        auto &code = co->regCode;
+        auto opcode = code[offset];
+        auto size = registerInstructionSize(opcode);
+
+        dumpBytes(code, offset, size);
+        std::cout << std::left << std::setfill(' ') << std::setw(20)
+                  << registerOpcodeToString(opcode) << " ";
+        std::cout.flags(f);
+
+        auto reg = [&](size_t i)
+        { return "r" + std::to_string(code[offset + i]); };
+        auto num = [&](size_t i)
+        { return std::to_string(code[offset + i]); };
+        auto constant = [&](size_t index)
+        { return "k" + std::to_string(index) + "(" + evaValueToConstantString(co->constants[index]) + ")"; };
+        auto rk = [&](size_t i)
+        { return code[offset + i] & RK_CONST ? constant(code[offset + i] & ~RK_CONST) : reg(i); };
+        auto address = [&](size_t i)
+        {
+            std::stringstream ss;
+            ss << std::uppercase << std::hex << std::setfill('0') << std::setw(4)
+               << ((code[offset + i] << 8) | code[offset + i + 1]);
+            return ss.str();
+        };
+
+        switch (opcode)
+        {
+        case ROP_HALT:
+        case ROP_RETURN:
+            std::cout << rk(1);
+            break;
+        case ROP_LOADK:
+            std::cout << reg(1) << " " << constant(code[offset + 2]);
+            break;
+        case ROP_MOVE:
+            std::cout << reg(1) << " " << reg(2);
+            break;
+        case ROP_ADD:
+        case ROP_SUB:
+        case ROP_MUL:
+        case ROP_DIV:
+            std::cout << reg(1) << " " << rk(2) << " " << rk(3);
+            break;
+        case ROP_COMPARE:
+            std::cout << reg(1) << " (" << rk(3) << " " << inverseCompareOps_[code[offset + 2]]
+                      << " " << rk(4) << ")";
+            break;
+        case ROP_JMP:
+            std::cout << address(1);
+            break;
+        case ROP_JMP_IF_FALSE:
+            std::cout << rk(1) << " " << address(2);
+            break;
+        case ROP_JMP_IF_NOT:
+            std::cout << "(" << rk(2) << " " << inverseCompareOps_[code[offset + 1]]
+                      << " " << rk(3) << ") " << address(4);
+            break;
+        case ROP_GET_GLOBAL:
+            std::cout << reg(1) << " " << global->get(code[offset + 2]).name;
+            break;
+        case ROP_SET_GLOBAL:
+            std::cout << global->get(code[offset + 1]).name << " " << rk(2);
+            break;
+        case ROP_GET_CELL:
+        case ROP_LOAD_CELL:
+            std::cout << reg(1) << " " << co->cellNames[code[offset + 2]];
+            break;
+        case ROP_SET_CELL:
+            std::cout << co->cellNames[code[offset + 1]] << " " << rk(2);
+            break;
+        case ROP_GET_OUTER:
+            std::cout << reg(1) << " " << co->outerNames[code[offset + 2]];
+            break;
+        case ROP_SET_OUTER:
+            std::cout << co->outerNames[code[offset + 1]] << " " << rk(2);
+            break;
+        case ROP_MAKE_FUNCTION:
+            std::cout << reg(1) << " " << constant(code[offset + 2]) << " " << num(3);
+            break;
+        case ROP_NEW:
+            std::cout << reg(1);
+            break;
+        case ROP_GET_PROP:
+            std::cout << reg(1) << " " << rk(2) << "." << AS_CPPSTRING(co->constants[code[offset + 3]])
+                      << " ic " << num(4);
+            break;
+        case ROP_SET_PROP:
+            std::cout << rk(1) << "." << AS_CPPSTRING(co->constants[code[offset + 3]])
+                      << " " << rk(2) << " ic " << num(4);
+            break;
+        case ROP_CALL:
+        case ROP_TAIL_CALL:
+            std::cout << reg(1) << " " << num(2);
+            break;
+        case ROP_INVOKE:
+            std::cout << reg(1) << " ." << AS_CPPSTRING(co->constants[code[offset + 2]])
+                      << " ic " << num(3) << " args " << num(4);
+            break;
+        case ROP_INVOKE_SUPER:
+            std::cout << reg(1) << " " << constant(code[offset + 2]) << " args " << num(3);
+            break;
+        default:
+            DIE << "disassembleRegisterInstruction: no disassembly for "
+                << registerOpcodeToString(opcode)
+                << std::endl;
+        }
+
+        return offset + size;
+    }
+
     // Disassembles a simple instruction
     size_t disassembleSimple(CodeObject *co, uint8_t opcode, size_t offset)
     {
@@ -149,11 +384,34 @@ private:
     // Disassemble instructions to handle class properties
     size_t disassembleProperty(CodeObject *co, uint8_t opcode, size_t offset)
     {
-        dumpBytes(co, offset, 2);
+        dumpBytes(co, offset, 3);
         printOpCode(opcode);
         auto constIndex = co->code[offset + 1];
-        std::cout << (int)constIndex << " (" << AS_CPPSTRING(co->constants[constIndex]) << ")";
-        return offset + 2;
+        auto cacheIndex = co->code[offset + 2];
+        std::cout << (int)constIndex << " (" << AS_CPPSTRING(co->constants[constIndex]) << ")"
+                  << " ic " << (int)cacheIndex;
+        return offset + 3;
+    }
+
+    // Disassembles method calls: name and cache or
+    // the bound super method, then the args count
+    size_t disassembleInvoke(CodeObject *co, uint8_t opcode, size_t offset)
+    {
+        auto size = instructionSize(opcode);
+        dumpBytes(co, offset, size);
+        printOpCode(opcode);
+        auto constIndex = co->code[offset + 1];
+        if (opcode == OP_INVOKE)
+        {
+            std::cout << (int)constIndex << " (" << AS_CPPSTRING(co->constants[constIndex]) << ")"
+                      << " ic " << (int)co->code[offset + 2];
+        }
+        else
+        {
+            std::cout << (int)constIndex << " (" << evaValueToConstantString(co->constants[constIndex]) << ")";
+        }
+        std::cout << " args " << (int)co->code[offset + size - 1];
+        return offset + size;
     }
 
     // Disassemble instructions to handle cells
@@ -166,6 +424,16 @@ private:
         return offset + 2;
     }
 
+    // Disassemble a variable of the frame that made the function
+    size_t disassembleOuter(CodeObject *co, uint8_t opcode, size_t offset)
+    {
+        dumpBytes(co, offset, 2);
+        printOpCode(opcode);
+        auto slot = co->code[offset + 1];
+        std::cout << (int)slot << " (" << co->outerNames[slot] << ")";
+        return offset + 2;
+    }
+
     // Disassemble the make function instruction
     size_t disassembleMakeFunction(CodeObject *co, uint8_t opcode, size_t offset)
     {
@@ -176,13 +444,47 @@ private:
     size_t disassembleCompare(CodeObject *co, uint8_t opcode, size_t offset)
     {
         dumpBytes(co, offset, 2);
-        printOpCode(OP_COMPARE);
+        printOpCode(opcode);
         auto compareOp = co->code[offset + 1];
         std::cout << (int)compareOp << " (";
         std::cout << inverseCompareOps_[compareOp] << ")";
         return offset + 2;
     }
 
+    // Disassembles an instruction the VM rewrote into its
+    // type-specialized form, same layout as the generic one.
+    size_t disassembleQuickened(CodeObject *co, uint8_t opcode, size_t offset)
+    {
+        auto nextOffset = genericOpcode(opcode) == OP_COMPARE
+                              ? disassembleCompare(co, opcode, offset)
+                              : disassembleSimple(co, opcode, offset);
+        std::cout << " [quickened " << opcodeToString(genericOpcode(opcode)) << "]";
+        return nextOffset;
+    }
+
+    // Disassembles the fused local vs constant compare-and-jump
+    size_t disassembleCompareLocalConst(CodeObject *co, uint8_t opcode, size_t offset)
+    {
+        std::ios_base::fmtflags f(std::cout.flags());
+
+        dumpBytes(co, offset, 6);
+        printOpCode(opcode);
+        auto compareOp = co->code[offset + 1];
+        auto localIndex = co->code[offset + 2];
+        auto constIndex = co->code[offset + 3];
+        uint16_t address = readWordAtOffset(co, offset + 4);
+
+        std::cout << "(" << co->locals[localIndex].name << " "
+                  << inverseCompareOps_[compareOp] << " "
+                  << evaValueToConstantString(co->constants[constIndex]) << ") ";
+        std::cout << std::uppercase << std::hex << std::setfill('0') << std::setw(4)
+                  << (int)address << " ";
+
+        std::cout.flags(f);
+
+        return offset + 6;
+    }
+
     // Disassembles jumps
     size_t disassembleJump(CodeObject *co, uint8_t opcode, size_t offset)
     {
@@ -202,13 +504,18 @@ private:
 
     // Dumps raw memory from the bytecode
     void dumpBytes(CodeObject *co, size_t offset, size_t count)
+    {
+        dumpBytes(co->code, offset, count);
+    }
+
+    void dumpBytes(const std::vector<uint8_t> &code, size_t offset, size_t count)
     {
         std::ios_base::fmtflags f(std::cout.flags());
         std::stringstream ss;
         for (auto i = 0; i < count; i++)
         {
             ss << std::uppercase << std::hex << std::setfill('0') << std::setw(2)
-               << (((int)co->code[offset + i]) & 0xFF) << " ";
+               << (((int)code[offset + i]) & 0xFF) << " ";
         }
 
         std::cout << std::left << std::setfill(' ') << std::setw(12) << ss.str();
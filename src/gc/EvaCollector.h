@@ -40,24 +40,48 @@ struct EvaCollector
         if (IS_FUNCTION(evaValue))
         {
             auto fn = AS_FUNCTION(evaValue);
-            for (auto &cell : fn->cells)
-                pointers.insert((Traceable *)cell);
+            for (auto cell = fn->cells(); cell != fn->cells() + fn->cellCount; cell++)
+            {
+                if (*cell != nullptr)
+                    pointers.insert((Traceable *)*cell);
+            }
         }
 
-        // Class instances.
-        if (IS_INSTANCE(evaValue))
+        // Ropes: their parts, or flat copy
+        if (IS_STRING(evaValue) && AS_STRING(evaValue)->rope)
+        {
+            for (auto part : {AS_STRING(evaValue)->parts()[0], AS_STRING(evaValue)->parts()[1]})
+            {
+                if (part != nullptr)
+                    pointers.insert((Traceable *)part);
+            }
+        }
+
+        // Class instances (and classes): property slots.
+        if (IS_SHAPED(evaValue))
         {
-            auto instance = AS_INSTANCE(evaValue);
-            for (auto &prop : instance->properties)
+            auto object = AS_SHAPED(evaValue);
+            for (auto &slot : object->slots)
             {
-                if (IS_OBJECT(prop.second))
-                    pointers.insert((Traceable *)AS_OBJECT(prop.second));
+                if (IS_OBJECT(slot))
+                    pointers.insert((Traceable *)AS_OBJECT(slot));
             }
         }
 
+        // The class owning an object's shapes: an instance's
+        // class, a class's superclass
+        if (IS_INSTANCE(evaValue))
+            pointers.insert((Traceable *)AS_INSTANCE(evaValue)->cls);
+        if (IS_CLASS(evaValue) && AS_CLASS(evaValue)->superClass != nullptr)
+            pointers.insert((Traceable *)AS_CLASS(evaValue)->superClass);
+
         return pointers;
     }
 
+    // Number of class objects freed so far. Their shapes are freed
+    // with them, and new ones can be allocated at the same addresses.
+    size_t classesSwept = 0;
+
     void sweep()
     {
         auto it = Traceable::objects.begin();
@@ -71,8 +95,11 @@ struct EvaCollector
             }
             else
             {
+                if (((Object *)object)->type == ObjectType::CLASS)
+                    classesSwept++;
+
                 it = Traceable::objects.erase(it);
-                delete object;
+                Traceable::destroy(object);
             }
         }
     }
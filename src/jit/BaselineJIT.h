@@ -0,0 +1,369 @@
+// Eva Baseline JIT.
+// Translates the stack bytecode of hot functions into x86-64 machine
+// code, one template per instruction.
+
+#ifndef BaselineJIT_h
+#define BaselineJIT_h
+
+#include <vector>
+
+#include "src/bytecode/OpCode.h"
+#include "src/jit/JitCompiler.h"
+
+// Calls a function runs interpreted before it's compiled
+// (see src/vm/Tiering.h)
+#define JIT_THRESHOLD 100
+
+class EvaVM;
+
+// What the machine code needs from the VM: where the interpreter
+// state lives in EvaVM, and the runtime functions for instructions
+// that aren't expanded inline. Both run on the state in memory.
+struct JitRuntime
+{
+    int32_t ipOffset;
+    int32_t spOffset;
+    int32_t bpOffset;
+
+    // Preemption fuel (see Preemption.h)
+    int32_t fuelOffset;
+
+    // Runs the instruction at `at`
+    void (*step)(EvaVM *vm, const uint8_t *at);
+
+    // Pops the operands of the compare-and-jump at `at`,
+    // returns its condition
+    bool (*condition)(EvaVM *vm, const uint8_t *at);
+};
+
+// The machine code works on the VM's own stack and frames: sp and bp
+// are kept in registers (r12, r13, the VM in rbx) and written back
+// before calling into the runtime. Calls, returns and halts leave
+// the machine code with the VM's ip at the instruction, for the
+// interpreter to run it; it re-enters the machine code of the
+// function it lands in. So interpreted and compiled frames mix
+// freely, and the GC sees the same stack.
+// Code objects with instructions that have no template (e.g.
+// OP_WIDE) stay interpreted.
+class BaselineJIT : public JitCompiler
+{
+public:
+    BaselineJIT(const JitRuntime &runtime) : runtime_(runtime) {}
+
+    // Runs the machine code of `co` from the instruction at `ip`
+    // until it reaches one the interpreter has to run
+    void run(EvaVM *vm, CodeObject *co, const uint8_t *ip)
+    {
+        auto code = co->jitCode;
+        auto enter = (void (*)(EvaVM *, const uint8_t *))code->memory;
+        enter(vm, code->memory + code->entries[ip - co->code.data()]);
+    }
+
+    // Compiles `co` (verified code only), false if it has
+    // instructions without a template
+    bool compile(CodeObject *co)
+    {
+        if (!co->verified)
+            return false;
+
+        this->co = co;
+        as_ = X64Assembler();
+        jumps_.clear();
+        exits_.clear();
+        std::vector<uint32_t> entries(co->code.size(), 0);
+
+        // Entry: fn(vm, target)
+        as_.push(RBX);
+        as_.push(R12);
+        as_.push(R13);
+        as_.mov(RBX, RDI);
+        as_.load(R12, RBX, runtime_.spOffset);
+        as_.load(R13, RBX, runtime_.bpOffset);
+        as_.jmp(RSI);
+
+        auto &code = co->code;
+        for (size_t offset = 0; offset < code.size(); offset += instructionLength(code, offset))
+        {
+            entries[offset] = as_.size();
+            at_ = &code[offset];
+            if (!genInstruction())
+                return false;
+        }
+
+        for (auto &jump : jumps_)
+            as_.patch(jump.first, entries[jump.second]);
+
+        // Exit: ip of the instruction is in rax
+        auto exit = as_.size();
+        as_.store(RBX, runtime_.ipOffset, RAX);
+        as_.store(RBX, runtime_.spOffset, R12);
+        as_.pop(R13);
+        as_.pop(R12);
+        as_.pop(RBX);
+        as_.ret();
+        for (auto at : exits_)
+            as_.patch(at, exit);
+
+        auto jitCode = install();
+        jitCode->entries = std::move(entries);
+        co->jitCode = jitCode;
+        compiledCount++;
+        return true;
+    }
+
+    // Code objects compiled so far
+    size_t compiledCount = 0;
+
+private:
+    // Operands of the current instruction
+    uint8_t operand(size_t index) { return at_[index]; }
+    size_t address(size_t index) { return (at_[index] << 8) | at_[index + 1]; }
+
+    bool genInstruction()
+    {
+        auto opcode = at_[0];
+        switch (opcode)
+        {
+        case OP_CONST:
+            as_.movImm(RCX, (uint64_t)&co->constants[operand(1)]);
+            copy(R12, 0, RCX, 0);
+            as_.add(R12, S);
+            break;
+        case OP_GET_LOCAL:
+            copy(R12, 0, R13, operand(1) * S);
+            as_.add(R12, S);
+            break;
+        case OP_SET_LOCAL:
+            copy(R13, operand(1) * S, R12, -S);
+            break;
+        case OP_POP:
+            as_.sub(R12, S);
+            break;
+        case OP_SCOPE_EXIT:
+        {
+            auto count = operand(1);
+            if (count > 0)
+            {
+                copy(R12, -(count + 1) * S, R12, -S);
+                as_.sub(R12, count * S);
+            }
+            break;
+        }
+        case OP_JMP:
+            if (address(1) < (size_t)(at_ - co->code.data()))
+            {
+                // Back-edge: the interpreter runs it when out of fuel
+                auto empty = spendFuel(runtime_.fuelOffset);
+                jumpTo(as_.jmp(), address(1));
+                as_.patch(empty, as_.size());
+                as_.movImm(RAX, (uint64_t)at_);
+                exits_.push_back(as_.jmp());
+                break;
+            }
+            jumpTo(as_.jmp(), address(1));
+            break;
+        case OP_JMP_IF_FALSE:
+            as_.sub(R12, S);
+            as_.test8(R12, BOOLEAN_AT, 1);
+            jumpTo(as_.jcc(CC_E), address(1));
+            break;
+        case OP_ADD:
+        case OP_ADD_NUM:
+            genArithmetic('+', SSE_ADD);
+            break;
+        case OP_SUB:
+            genArithmetic('-', SSE_SUB);
+            break;
+        case OP_MUL:
+            genArithmetic('*', SSE_MUL);
+            break;
+        case OP_DIV:
+            genArithmetic('/', SSE_DIV);
+            break;
+        case OP_COMPARE:
+        case OP_LT_NUM:
+        case OP_GT_NUM:
+        case OP_EQ_NUM:
+        case OP_LE_NUM:
+        case OP_GE_NUM:
+        case OP_NE_NUM:
+        {
+            // Numbers inline, anything else in the runtime
+            auto slow = compareNumbers(operand(1), R12, -2 * S, R12, -S);
+            as_.sub(R12, S);
+            storeBoolean(R12, -S);
+            auto done = as_.jmp();
+            bindAll(slow);
+            callRuntime((void *)runtime_.step);
+            as_.patch(done, as_.size());
+            break;
+        }
+        case OP_JMP_IF_NOT_LT:
+        case OP_JMP_IF_NOT_GT:
+        case OP_JMP_IF_NOT_EQ:
+        case OP_JMP_IF_NOT_LE:
+        case OP_JMP_IF_NOT_GE:
+        case OP_JMP_IF_NOT_NE:
+        {
+            auto slow = compareNumbers(opcode - OP_JMP_IF_NOT_LT, R12, -2 * S, R12, -S);
+            as_.sub(R12, 2 * S);
+            genConditionJump(slow, address(1));
+            break;
+        }
+        case OP_JMP_IF_NOT_CMP_LC:
+        {
+            // The local has to be a number of the constant's kind
+            auto local = operand(2) * S;
+            auto &constant = co->constants[operand(3)];
+            size_t slow;
+            if (IS_INTEGER(constant))
+            {
+                slow = checkInteger(R13, local);
+                loadInteger(RAX, R13, local);
+                as_.movImm(RCX, AS_INTEGER(constant));
+                compareIntegers(operand(1));
+            }
+            else
+            {
+                slow = checkDouble(R13, local);
+                as_.movImm(RDX, (uint64_t)&constant);
+                as_.loadsd(XMM0, R13, local + NUMBER_AT);
+                as_.loadsd(XMM1, RDX, NUMBER_AT);
+                compareDoubles(operand(1));
+            }
+            genConditionJump({slow}, address(4));
+            break;
+        }
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_CELL:
+        case OP_SET_CELL:
+        case OP_LOAD_CELL:
+        case OP_MAKE_FUNCTION:
+        case OP_GET_OUTER:
+        case OP_SET_OUTER:
+        case OP_NEW:
+        case OP_GET_PROP:
+        case OP_SET_PROP:
+            callRuntime((void *)runtime_.step);
+            break;
+        case OP_HALT:
+        case OP_RETURN:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_INVOKE:
+        case OP_INVOKE_SUPER:
+            // Frame changes are left to the interpreter
+            as_.movImm(RAX, (uint64_t)at_);
+            exits_.push_back(as_.jmp());
+            break;
+        default:
+            return false;
+        }
+        return true;
+    }
+
+    // Binary math on the two values on top of the stack: integers
+    // (but for division) and doubles inline, anything else (strings,
+    // mixed numbers, integer overflow) in the runtime
+    void genArithmetic(char op, SseOp sseOp)
+    {
+        std::vector<size_t> slow;
+        std::vector<size_t> done;
+        if (op != '/')
+        {
+            auto notIntegers = checkIntegers();
+            loadInteger(RDX, R12, -2 * S);
+            loadInteger(RSI, R12, -S);
+            slow = integerOp(op, RDX, RSI);
+            as_.sub(R12, S);
+            storeInteger(R12, -S, RDX);
+            done.push_back(as_.jmp());
+            bindAll(notIntegers);
+        }
+
+        auto notDoubles = checkDoubles();
+        slow.insert(slow.end(), notDoubles.begin(), notDoubles.end());
+        as_.loadsd(XMM0, R12, -2 * S + NUMBER_AT);
+        as_.loadsd(XMM1, R12, -S + NUMBER_AT);
+        as_.sse(sseOp, XMM0, XMM1);
+        as_.sub(R12, S);
+        storeNumber(R12, -S);
+        done.push_back(as_.jmp());
+
+        bindAll(slow);
+        callRuntime((void *)runtime_.step);
+        bindAll(done);
+    }
+
+    // Jumps to `target` if the condition in al is false. The
+    // runtime computes it when one of `slow` is taken.
+    void genConditionJump(const std::vector<size_t> &slow, size_t target)
+    {
+        auto join = as_.jmp();
+        bindAll(slow);
+        callRuntime((void *)runtime_.condition);
+        as_.patch(join, as_.size());
+        as_.test8(RAX);
+        jumpTo(as_.jcc(CC_E), target);
+    }
+
+    // Compares the values at [base1 + disp1] and [base2 + disp2] if
+    // they're two integers or two doubles, the result goes to al.
+    // Returns the jumps taken for anything else.
+    std::vector<size_t> compareNumbers(uint8_t op, Reg base1, int32_t disp1, Reg base2, int32_t disp2)
+    {
+        std::vector<size_t> notIntegers = {checkInteger(base1, disp1), checkInteger(base2, disp2)};
+        loadInteger(RAX, base1, disp1);
+        loadInteger(RCX, base2, disp2);
+        compareIntegers(op);
+        auto done = as_.jmp();
+
+        bindAll(notIntegers);
+        std::vector<size_t> slow = {checkDouble(base1, disp1), checkDouble(base2, disp2)};
+        as_.loadsd(XMM0, base1, disp1 + NUMBER_AT);
+        as_.loadsd(XMM1, base2, disp2 + NUMBER_AT);
+        compareDoubles(op);
+        as_.patch(done, as_.size());
+        return slow;
+    }
+
+    // Calls a runtime function on the current instruction,
+    // with the VM state in memory
+    void callRuntime(void *function)
+    {
+        as_.store(RBX, runtime_.spOffset, R12);
+        as_.mov(RDI, RBX);
+        as_.movImm(RSI, (uint64_t)at_);
+        as_.movImm(RAX, (uint64_t)function);
+        as_.call(RAX);
+        as_.load(R12, RBX, runtime_.spOffset);
+    }
+
+    // Jumps taken when the two values on top aren't both
+    // integers/doubles
+    std::vector<size_t> checkIntegers()
+    {
+        return {checkInteger(R12, -2 * S), checkInteger(R12, -S)};
+    }
+
+    std::vector<size_t> checkDoubles()
+    {
+        return {checkDouble(R12, -2 * S), checkDouble(R12, -S)};
+    }
+
+    void jumpTo(size_t at, size_t target) { jumps_.push_back({at, target}); }
+
+    JitRuntime runtime_;
+
+    // Code object being compiled, and its current instruction
+    CodeObject *co;
+    const uint8_t *at_;
+
+    // Jump displacements to patch, with their bytecode
+    // targets, and the jumps to the exit
+    std::vector<std::pair<size_t, size_t>> jumps_;
+    std::vector<size_t> exits_;
+};
+
+#endif // BaselineJIT_h
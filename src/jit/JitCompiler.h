@@ -0,0 +1,262 @@
+// Eva JIT compilers: what the baseline and trace JITs share.
+// Value layout, the machine code helpers for numbers and booleans,
+// and the executable memory the code is installed in.
+
+#ifndef JitCompiler_h
+#define JitCompiler_h
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "src/jit/X64Assembler.h"
+#include "src/vm/EvaValue.h"
+#include "src/vm/Logger.h"
+
+// The JIT is only available on x86-64
+#ifndef EVA_JIT
+#if defined(__x86_64__)
+#define EVA_JIT 1
+#else
+#define EVA_JIT 0
+#endif
+#endif
+
+// Machine code of a code object, or of a loop trace
+struct JitCode
+{
+    JitCode(uint8_t *memory, size_t size) : memory(memory), size(size) {}
+    ~JitCode() { munmap(memory, size); }
+
+    uint8_t *memory;
+    size_t size;
+
+    // Offset in the machine code of every bytecode instruction
+    std::vector<uint32_t> entries;
+};
+
+class JitCompiler
+{
+protected:
+    // Value size, and where numbers and booleans live in one
+    static constexpr int32_t S = sizeof(EvaValue);
+    static constexpr int32_t NUMBER_AT = offsetof(EvaValue, number);
+    static constexpr int32_t BOOLEAN_AT = offsetof(EvaValue, boolean);
+#if !EVA_NAN_BOXING
+    static constexpr int32_t INTEGER_AT = offsetof(EvaValue, integer);
+    static constexpr int32_t TYPE_AT = offsetof(EvaValue, type);
+#endif
+
+    // Compares xmm0 to xmm1, the result goes to al. Unordered (NaN)
+    // operands compare false except for !=, as in C++.
+    void compareDoubles(uint8_t op)
+    {
+        switch (op)
+        {
+        case 0: // <
+            as_.ucomisd(XMM1, XMM0);
+            as_.setcc(CC_A, RAX);
+            break;
+        case 1: // >
+            as_.ucomisd(XMM0, XMM1);
+            as_.setcc(CC_A, RAX);
+            break;
+        case 2: // ==
+            as_.ucomisd(XMM0, XMM1);
+            as_.setcc(CC_E, RAX);
+            as_.setcc(CC_NP, RCX);
+            as_.and8(RAX, RCX);
+            break;
+        case 3: // <=
+            as_.ucomisd(XMM1, XMM0);
+            as_.setcc(CC_AE, RAX);
+            break;
+        case 4: // >=
+            as_.ucomisd(XMM0, XMM1);
+            as_.setcc(CC_AE, RAX);
+            break;
+        default: // !=
+            as_.ucomisd(XMM0, XMM1);
+            as_.setcc(CC_NE, RAX);
+            as_.setcc(CC_P, RCX);
+            as_.or8(RAX, RCX);
+            break;
+        }
+    }
+
+    // Compares rax to rcx, the result goes to al
+    void compareIntegers(uint8_t op)
+    {
+        static const Cond conditions[] = {CC_L, CC_G, CC_E, CC_LE, CC_GE, CC_NE};
+        as_.cmpR(RAX, RCX);
+        as_.setcc(conditions[op], RAX);
+    }
+
+    // Integer math: dst = dst op src (op as in numberOp, not /).
+    // Jumps taken when the result doesn't fit an integer value.
+    std::vector<size_t> integerOp(char op, Reg dst, Reg src)
+    {
+        if (op == '+')
+            as_.addR(dst, src);
+        else if (op == '-')
+            as_.subR(dst, src);
+        else
+            as_.imulR(dst, src);
+
+        std::vector<size_t> overflow = {as_.jcc(CC_O)};
+#if EVA_NAN_BOXING
+        // 48 bits: sign extending them must give the same number
+        as_.mov(RCX, dst);
+        as_.shl(RCX, 16);
+        as_.sar(RCX, 16);
+        as_.cmpR(RCX, dst);
+        overflow.push_back(as_.jcc(CC_NE));
+#endif
+        return overflow;
+    }
+
+    // Copies a value (clobbers rax/xmm0)
+    void copy(Reg dst, int32_t dstDisp, Reg src, int32_t srcDisp)
+    {
+        if (S == 16)
+        {
+            as_.loaddqu(XMM0, src, srcDisp);
+            as_.storedqu(dst, dstDisp, XMM0);
+        }
+        else
+        {
+            as_.load(RAX, src, srcDisp);
+            as_.store(dst, dstDisp, RAX);
+        }
+    }
+
+    // Jump taken when the value at [base + disp] isn't a double
+    size_t checkDouble(Reg base, int32_t disp)
+    {
+#if EVA_NAN_BOXING
+        as_.load(RAX, base, disp);
+        as_.movImm(RCX, QNAN);
+        as_.andR(RAX, RCX);
+        as_.cmpR(RAX, RCX);
+        return as_.jcc(CC_E);
+#else
+        as_.cmp32(base, disp + TYPE_AT, (int8_t)EvaValueType::NUMBER);
+        return as_.jcc(CC_NE);
+#endif
+    }
+
+    // Jump taken when the value at [base + disp] isn't an integer
+    // (clobbers rax)
+    size_t checkInteger(Reg base, int32_t disp)
+    {
+#if EVA_NAN_BOXING
+        // Sign bit clear, quiet NaN and integer tag set
+        as_.load(RAX, base, disp);
+        as_.shr(RAX, 49);
+        as_.cmp(RAX, (int32_t)((QNAN | INTEGER_TAG) >> 49));
+        return as_.jcc(CC_NE);
+#else
+        as_.cmp32(base, disp + TYPE_AT, (int8_t)EvaValueType::INTEGER);
+        return as_.jcc(CC_NE);
+#endif
+    }
+
+    // Reads the integer value at [base + disp]
+    void loadInteger(Reg dst, Reg base, int32_t disp)
+    {
+#if EVA_NAN_BOXING
+        as_.load(dst, base, disp);
+        as_.shl(dst, 16);
+        as_.sar(dst, 16);
+#else
+        as_.load(dst, base, disp + INTEGER_AT);
+#endif
+    }
+
+    // Writes `src` as an integer value (clobbers rax/rcx
+    // when NaN-boxing)
+    void storeInteger(Reg base, int32_t disp, Reg src)
+    {
+#if EVA_NAN_BOXING
+        as_.mov(RAX, src);
+        as_.shl(RAX, 16);
+        as_.shr(RAX, 16);
+        as_.movImm(RCX, QNAN | INTEGER_TAG);
+        as_.orR(RAX, RCX);
+        as_.store(base, disp, RAX);
+#else
+        as_.store32(base, disp + TYPE_AT, (int32_t)EvaValueType::INTEGER);
+        as_.store(base, disp + INTEGER_AT, src);
+#endif
+    }
+
+    // Writes `xmm` as a double value
+    void storeNumber(Reg base, int32_t disp, Xmm xmm = XMM0)
+    {
+#if !EVA_NAN_BOXING
+        as_.store32(base, disp + TYPE_AT, (int32_t)EvaValueType::NUMBER);
+#endif
+        as_.storesd(base, disp + NUMBER_AT, xmm);
+    }
+
+    // Writes al as a boolean value
+    void storeBoolean(Reg base, int32_t disp)
+    {
+        as_.movzx8(RAX, RAX);
+#if EVA_NAN_BOXING
+        as_.movImm(RCX, QNAN | BOOLEAN_TAG);
+        as_.orR(RAX, RCX);
+        as_.store(base, disp, RAX);
+#else
+        as_.store32(base, disp + TYPE_AT, (int32_t)EvaValueType::BOOLEAN);
+        as_.store(base, disp + BOOLEAN_AT, RAX);
+#endif
+    }
+
+    // Spends a unit of the VM's fuel (the VM in rbx) at a loop
+    // back-edge. Returns the jump taken instead when it's the last
+    // unit: the interpreter spends that one, to preempt the program.
+    size_t spendFuel(int32_t fuelOffset)
+    {
+        as_.load(RAX, RBX, fuelOffset);
+        as_.cmp(RAX, 1);
+        auto empty = as_.jcc(CC_LE);
+        as_.sub(RAX, 1);
+        as_.store(RBX, fuelOffset, RAX);
+        return empty;
+    }
+
+    void bindAll(const std::vector<size_t> &jumps)
+    {
+        for (auto at : jumps)
+            as_.patch(at, as_.size());
+    }
+
+    // Copies the machine code to executable memory
+    JitCode *install()
+    {
+        static auto pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        auto size = (as_.size() + pageSize - 1) / pageSize * pageSize;
+
+        auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            DIE << "JIT: can't allocate " << size << " bytes";
+        memcpy(memory, as_.code.data(), as_.size());
+        if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+            DIE << "JIT: can't make code executable";
+
+        code_.push_back(std::make_unique<JitCode>((uint8_t *)memory, size));
+        return code_.back().get();
+    }
+
+    X64Assembler as_;
+
+    // All the machine code, freed with the JIT
+    std::vector<std::unique_ptr<JitCode>> code_;
+};
+
+#endif // JitCompiler_h
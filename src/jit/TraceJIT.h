@@ -0,0 +1,667 @@
+// Eva Trace JIT.
+// Finds hot loops by counting their back-edges, records the path one
+// iteration takes through the bytecode, and compiles it into linear,
+// type-specialized x86-64 machine code.
+
+#ifndef TraceJIT_h
+#define TraceJIT_h
+
+#include <algorithm>
+#include <vector>
+
+#include "src/bytecode/OpCode.h"
+#include "src/jit/BaselineJIT.h"
+#include "src/jit/JitCompiler.h"
+#include "src/vm/Global.h"
+
+// Instructions a trace can have
+#define TRACE_LIMIT 500
+
+// A loop is traced once its back-edge was taken `threshold` times: the
+// next iteration runs in a recording interpreter, which keeps the
+// instructions it runs and, for branches, whether they jumped.
+// Recording succeeds when it gets back to the loop header, and fails
+// (for good, the loop is blacklisted) on anything but arithmetic and
+// comparisons of numbers in locals, globals and constants: calls,
+// objects, strings, nested loops.
+//
+// The trace runs on the VM's own frame, bp in r13, the globals in r14.
+// Locals and globals are read from memory where used and written back
+// where set, the temporaries between them live in registers: integers
+// in general purpose ones, doubles in xmm ones. On entry the locals
+// and globals the trace uses are checked to have the number kind they
+// had while recording, so the kind of every value is known; every
+// branch is checked to go the recorded way, and integer math not to
+// overflow. A failing check is a side exit: the temporaries the
+// interpreter expects are written to the stack, and the trace returns
+// with ip at the instruction the bytecode continues with.
+class TraceJIT : public JitCompiler
+{
+public:
+    TraceJIT(size_t threshold, const JitRuntime &runtime) : threshold(threshold), runtime_(runtime) {}
+
+    // Back-edge of `co` to the loop at `ip` (verified code only). Runs
+    // the loop's trace, recording and compiling it first once the loop
+    // is hot; both move the VM's ip and sp.
+    void backEdge(EvaVM *vm, CodeObject *co, uint8_t *&ip, EvaValue *bp, EvaValue *&sp,
+                  std::vector<GlobalVar> &globals)
+    {
+        if (co->loops.empty())
+            co->loops.resize(co->code.size());
+
+        auto &loop = co->loops[ip - co->code.data()];
+        if (loop.trace == nullptr)
+        {
+            if (loop.blacklisted || ++loop.backEdges <= threshold)
+                return;
+            if (!record(co, ip, bp, sp, globals) || (loop.trace = compile()) == nullptr)
+            {
+                loop.blacklisted = true;
+                return;
+            }
+        }
+
+        auto enter = (void (*)(EvaVM *, GlobalVar *))loop.trace->memory;
+        enter(vm, globals.data());
+    }
+
+    // Back-edges before a loop is traced
+    size_t threshold;
+
+    // Loops compiled so far
+    size_t compiledCount = 0;
+
+private:
+    // An instruction of the trace, by offset
+    struct TraceStep
+    {
+        size_t offset;
+        bool jumped;
+    };
+
+    // Where a value of the trace is: a constant, a local or global
+    // not changed since it was read, or a register. And whether it's
+    // an integer (INTEGER, in a general purpose register) or a double
+    // (NUMBER, in an xmm register).
+    struct TraceValue
+    {
+        enum Kind
+        {
+            CONSTANT,
+            LOCAL,
+            GLOBAL,
+            REGISTER,
+        } kind;
+        size_t index;
+        EvaValueType type;
+    };
+
+    // A local (below the header's stack) or global the trace uses,
+    // with its number kind on entry
+    struct Variable
+    {
+        TraceValue::Kind kind;
+        size_t index;
+        EvaValueType type;
+    };
+
+    // A failing check: the values on the stack there,
+    // and where the bytecode continues
+    struct SideExit
+    {
+        std::vector<size_t> jumps;
+        std::vector<TraceValue> stack;
+        size_t resume;
+    };
+
+    static EvaValueType typeOf(const EvaValue &value)
+    {
+        return IS_INTEGER(value) ? EvaValueType::INTEGER : EvaValueType::NUMBER;
+    }
+
+    // Runs one iteration of the loop at `ip` (the stack holding
+    // `sp - bp` values), keeping the path in steps_. On failure ip
+    // and sp are at the first instruction it didn't run.
+    bool record(CodeObject *co, uint8_t *&ip, EvaValue *bp, EvaValue *&sp, std::vector<GlobalVar> &globals)
+    {
+        this->co = co;
+        header_ = ip - co->code.data();
+        depth_ = sp - bp;
+        steps_.clear();
+        variables_.clear();
+
+        // Values of the iteration, below them the frame
+        auto base = sp;
+        auto has = [&](size_t count)
+        { return (size_t)(sp - base) >= count; };
+
+        // Numbers in variables, remembering their kind on first use
+        auto use = [&](TraceValue::Kind kind, size_t index, const EvaValue &value)
+        {
+            if (!IS_NUMBER(value))
+                return false;
+            if (kind == TraceValue::LOCAL && index >= depth_)
+                return true;
+            if (find(kind, index) == nullptr)
+                variables_.push_back({kind, index, typeOf(value)});
+            return true;
+        };
+
+        auto code = co->code.data();
+        while (steps_.size() < TRACE_LIMIT)
+        {
+            auto at = ip;
+            auto next = at + instructionLength(co->code, at - code);
+            auto address = [&](size_t index)
+            { return code + ((at[index] << 8) | at[index + 1]); };
+            auto jumped = false;
+
+            switch (at[0])
+            {
+            case OP_CONST:
+            {
+                auto &constant = co->constants[at[1]];
+                if (!IS_NUMBER(constant))
+                    return false;
+                *sp++ = constant;
+                break;
+            }
+            case OP_GET_LOCAL:
+                if (!use(TraceValue::LOCAL, at[1], bp[at[1]]))
+                    return false;
+                *sp++ = bp[at[1]];
+                break;
+            case OP_SET_LOCAL:
+                if (!has(1) || !use(TraceValue::LOCAL, at[1], bp[at[1]]))
+                    return false;
+                bp[at[1]] = sp[-1];
+                break;
+            case OP_GET_GLOBAL:
+                if (!use(TraceValue::GLOBAL, at[1], globals[at[1]].value))
+                    return false;
+                *sp++ = globals[at[1]].value;
+                break;
+            case OP_SET_GLOBAL:
+                if (!has(1) || !use(TraceValue::GLOBAL, at[1], globals[at[1]].value))
+                    return false;
+                globals[at[1]].value = sp[-1];
+                break;
+            case OP_POP:
+                if (!has(1))
+                    return false;
+                sp--;
+                break;
+            case OP_SCOPE_EXIT:
+                if (!has(at[1] + 1))
+                    return false;
+                sp -= at[1];
+                sp[-1] = sp[at[1] - 1];
+                break;
+            case OP_ADD:
+            case OP_ADD_NUM:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            {
+                if (!has(2))
+                    return false;
+                auto result = at[0] == OP_SUB   ? numberOp<'-'>(sp[-2], sp[-1])
+                              : at[0] == OP_MUL ? numberOp<'*'>(sp[-2], sp[-1])
+                              : at[0] == OP_DIV ? numberOp<'/'>(sp[-2], sp[-1])
+                                                : numberOp<'+'>(sp[-2], sp[-1]);
+                sp--;
+                sp[-1] = result;
+                break;
+            }
+            case OP_JMP_IF_NOT_LT:
+            case OP_JMP_IF_NOT_GT:
+            case OP_JMP_IF_NOT_EQ:
+            case OP_JMP_IF_NOT_LE:
+            case OP_JMP_IF_NOT_GE:
+            case OP_JMP_IF_NOT_NE:
+                if (!has(2))
+                    return false;
+                jumped = !compareNumbers(at[0] - OP_JMP_IF_NOT_LT, sp[-2], sp[-1]);
+                sp -= 2;
+                if (jumped)
+                    next = address(1);
+                break;
+            case OP_JMP_IF_NOT_CMP_LC:
+            {
+                auto &constant = co->constants[at[3]];
+                if (!use(TraceValue::LOCAL, at[2], bp[at[2]]) || !IS_NUMBER(constant))
+                    return false;
+                jumped = !compareNumbers(at[1], bp[at[2]], constant);
+                if (jumped)
+                    next = address(4);
+                break;
+            }
+            case OP_JMP:
+                next = address(1);
+                if (next == code + header_)
+                {
+                    steps_.push_back({(size_t)(at - code), false});
+                    ip = next;
+                    return true;
+                }
+                // Another loop
+                if (next < at)
+                    return false;
+                break;
+            default:
+                return false;
+            }
+
+            steps_.push_back({(size_t)(at - code), jumped});
+            ip = next;
+        }
+        return false;
+    }
+
+    // Compiles the recorded trace, null if it needs more registers
+    // than there are or a variable changes its number kind
+    JitCode *compile()
+    {
+        as_ = X64Assembler();
+        stack_.clear();
+        exits_.clear();
+
+        // Entry: fn(vm, globals)
+        as_.push(RBX);
+        as_.push(R12);
+        as_.push(R13);
+        as_.push(R14);
+        as_.mov(RBX, RDI);
+        as_.mov(R14, RSI);
+        as_.load(R13, RBX, runtime_.bpOffset);
+
+        auto entry = variables_;
+        for (auto &variable : variables_)
+        {
+            auto at = where({variable.kind, variable.index, variable.type});
+            sideExit({variable.type == EvaValueType::INTEGER ? checkInteger(at.first, at.second)
+                                                             : checkDouble(at.first, at.second)},
+                     header_);
+        }
+
+        auto loop = as_.size();
+        for (auto &step : steps_)
+        {
+            if (!genStep(step))
+                return nullptr;
+        }
+
+        // The next iteration expects the kinds it was checked for
+        for (size_t i = 0; i < variables_.size(); i++)
+        {
+            if (variables_[i].type != entry[i].type)
+                return nullptr;
+        }
+
+        // Out of fuel, the interpreter runs the back-edge
+        sideExit({spendFuel(runtime_.fuelOffset)}, steps_.back().offset);
+        as_.patch(as_.jmp(), loop);
+
+        // Side exits write the stack and leave with ip in rax
+        std::vector<size_t> leave;
+        for (auto &exit : exits_)
+        {
+            bindAll(exit.jumps);
+            auto depth = depth_;
+            for (auto &value : exit.stack)
+            {
+                if (value.kind != TraceValue::REGISTER)
+                {
+                    auto from = where(value);
+                    copy(R13, depth * S, from.first, from.second);
+                }
+                else if (value.type == EvaValueType::INTEGER)
+                {
+                    storeInteger(R13, depth * S, (Reg)value.index);
+                }
+                else
+                {
+                    storeNumber(R13, depth * S, (Xmm)value.index);
+                }
+                depth++;
+            }
+            as_.mov(R12, R13);
+            as_.add(R12, depth * S);
+            as_.movImm(RAX, (uint64_t)&co->code[exit.resume]);
+            leave.push_back(as_.jmp());
+        }
+
+        bindAll(leave);
+        as_.store(RBX, runtime_.ipOffset, RAX);
+        as_.store(RBX, runtime_.spOffset, R12);
+        as_.pop(R14);
+        as_.pop(R13);
+        as_.pop(R12);
+        as_.pop(RBX);
+        as_.ret();
+
+        compiledCount++;
+        return install();
+    }
+
+    bool genStep(const TraceStep &step)
+    {
+        auto at = &co->code[step.offset];
+        auto next = step.offset + instructionLength(co->code, step.offset);
+        auto address = [&](size_t index)
+        { return (size_t)((at[index] << 8) | at[index + 1]); };
+
+        switch (at[0])
+        {
+        case OP_CONST:
+            stack_.push_back({TraceValue::CONSTANT, at[1], typeOf(co->constants[at[1]])});
+            break;
+        case OP_GET_LOCAL:
+            stack_.push_back(local(at[1]));
+            break;
+        case OP_SET_LOCAL:
+            if (at[1] >= depth_)
+            {
+                stack_[at[1] - depth_] = stack_.back();
+                break;
+            }
+            return genStore(TraceValue::LOCAL, at[1]);
+        case OP_GET_GLOBAL:
+            stack_.push_back({TraceValue::GLOBAL, at[1], find(TraceValue::GLOBAL, at[1])->type});
+            break;
+        case OP_SET_GLOBAL:
+            return genStore(TraceValue::GLOBAL, at[1]);
+        case OP_POP:
+            stack_.pop_back();
+            break;
+        case OP_SCOPE_EXIT:
+        {
+            auto result = stack_.back();
+            stack_.resize(stack_.size() - at[1]);
+            stack_.back() = result;
+            break;
+        }
+        case OP_ADD:
+        case OP_ADD_NUM:
+            return genArithmetic('+', SSE_ADD, step.offset);
+        case OP_SUB:
+            return genArithmetic('-', SSE_SUB, step.offset);
+        case OP_MUL:
+            return genArithmetic('*', SSE_MUL, step.offset);
+        case OP_DIV:
+            return genArithmetic('/', SSE_DIV, step.offset);
+        case OP_JMP_IF_NOT_LT:
+        case OP_JMP_IF_NOT_GT:
+        case OP_JMP_IF_NOT_EQ:
+        case OP_JMP_IF_NOT_LE:
+        case OP_JMP_IF_NOT_GE:
+        case OP_JMP_IF_NOT_NE:
+        {
+            auto b = pop();
+            auto a = pop();
+            genGuard(at[0] - OP_JMP_IF_NOT_LT, a, b, step.jumped, step.jumped ? next : address(1));
+            break;
+        }
+        case OP_JMP_IF_NOT_CMP_LC:
+        {
+            TraceValue constant = {TraceValue::CONSTANT, at[3], typeOf(co->constants[at[3]])};
+            genGuard(at[1], local(at[2]), constant, step.jumped, step.jumped ? next : address(4));
+            break;
+        }
+        case OP_JMP:
+            // Forward jumps are followed, the back-edge is the loop
+            break;
+        }
+        return true;
+    }
+
+    // Writes the value on top to a local or global
+    bool genStore(TraceValue::Kind kind, size_t index)
+    {
+        if (!materialize(kind, index))
+            return false;
+
+        auto &value = stack_.back();
+        auto to = where({kind, index, value.type});
+        if (value.kind != TraceValue::REGISTER)
+        {
+            auto from = where(value);
+            copy(to.first, to.second, from.first, from.second);
+        }
+        else if (value.type == EvaValueType::INTEGER)
+        {
+            storeInteger(to.first, to.second, (Reg)value.index);
+        }
+        else
+        {
+            storeNumber(to.first, to.second, (Xmm)value.index);
+        }
+        find(kind, index)->type = value.type;
+        return true;
+    }
+
+    // Binary math on the two values on top, into a free register.
+    // Two integers stay integers, exiting to the instruction (which
+    // then promotes them) if the result overflows.
+    bool genArithmetic(char op, SseOp sseOp, size_t offset)
+    {
+        auto &a = stack_[stack_.size() - 2];
+        auto &b = stack_.back();
+        if (op != '/' && a.type == EvaValueType::INTEGER && b.type == EvaValueType::INTEGER)
+        {
+            auto result = allocateInteger();
+            if (result == RAX)
+                return false;
+            toInteger(result, a);
+            auto operand = b.kind == TraceValue::REGISTER ? (Reg)b.index : RDX;
+            toInteger(operand, b);
+            sideExit(integerOp(op, result, operand), offset);
+            stack_.resize(stack_.size() - 2);
+            stack_.push_back({TraceValue::REGISTER, result, EvaValueType::INTEGER});
+            return true;
+        }
+
+        toDouble(XMM1, b);
+        auto first = a;
+        stack_.resize(stack_.size() - 2);
+        auto result = allocateDouble();
+        if (result == XMM0)
+            return false;
+        toDouble(result, first);
+        as_.sse(sseOp, result, XMM1);
+        stack_.push_back({TraceValue::REGISTER, result, EvaValueType::NUMBER});
+        return true;
+    }
+
+    // Exits to `resume` unless `a op b` is what the recording saw
+    void genGuard(uint8_t op, const TraceValue &a, const TraceValue &b, bool jumped, size_t resume)
+    {
+        if (a.type == EvaValueType::INTEGER && b.type == EvaValueType::INTEGER)
+        {
+            toInteger(RAX, a);
+            toInteger(RCX, b);
+            compareIntegers(op);
+        }
+        else
+        {
+            toDouble(XMM0, a);
+            toDouble(XMM1, b);
+            compareDoubles(op);
+        }
+        as_.test8(RAX);
+        sideExit({as_.jcc(jumped ? CC_NE : CC_E)}, resume);
+    }
+
+    void sideExit(const std::vector<size_t> &jumps, size_t resume) { exits_.push_back({jumps, stack_, resume}); }
+
+    // Local `index`, from the frame or the trace's own values
+    TraceValue local(size_t index)
+    {
+        if (index < depth_)
+            return {TraceValue::LOCAL, index, find(TraceValue::LOCAL, index)->type};
+        return stack_[index - depth_];
+    }
+
+    Variable *find(TraceValue::Kind kind, size_t index)
+    {
+        for (auto &variable : variables_)
+        {
+            if (variable.kind == kind && variable.index == index)
+                return &variable;
+        }
+        return nullptr;
+    }
+
+    TraceValue pop()
+    {
+        auto value = stack_.back();
+        stack_.pop_back();
+        return value;
+    }
+
+    // Loads the values still reading a local or global about to be
+    // set, false if out of registers
+    bool materialize(TraceValue::Kind kind, size_t index)
+    {
+        TraceValue loaded;
+        auto done = false;
+        for (auto &value : stack_)
+        {
+            if (value.kind != kind || value.index != index)
+                continue;
+            if (!done)
+            {
+                loaded = {TraceValue::REGISTER, 0, value.type};
+                if (value.type == EvaValueType::INTEGER)
+                {
+                    auto reg = allocateInteger();
+                    if (reg == RAX)
+                        return false;
+                    toInteger(reg, value);
+                    loaded.index = reg;
+                }
+                else
+                {
+                    auto xmm = allocateDouble();
+                    if (xmm == XMM0)
+                        return false;
+                    toDouble(xmm, value);
+                    loaded.index = xmm;
+                }
+                done = true;
+            }
+            value = loaded;
+        }
+        return true;
+    }
+
+    bool inUse(EvaValueType type, size_t index)
+    {
+        return std::any_of(stack_.begin(), stack_.end(), [&](const TraceValue &value)
+                           { return value.kind == TraceValue::REGISTER && value.type == type && value.index == index; });
+    }
+
+    // A register no value is in (RAX/XMM0, which are
+    // scratch, if there's none)
+    Reg allocateInteger()
+    {
+        for (auto reg : {RSI, RDI, R8, R9, R10, R11})
+        {
+            if (!inUse(EvaValueType::INTEGER, reg))
+                return reg;
+        }
+        return RAX;
+    }
+
+    Xmm allocateDouble()
+    {
+        for (auto xmm = XMM2; xmm <= XMM7; xmm = (Xmm)(xmm + 1))
+        {
+            if (!inUse(EvaValueType::NUMBER, xmm))
+                return xmm;
+        }
+        return XMM0;
+    }
+
+    // Loads an integer value
+    void toInteger(Reg reg, const TraceValue &value)
+    {
+        if (value.kind == TraceValue::REGISTER)
+        {
+            if (value.index != reg)
+                as_.mov(reg, (Reg)value.index);
+        }
+        else if (value.kind == TraceValue::CONSTANT)
+        {
+            as_.movImm(reg, AS_INTEGER(co->constants[value.index]));
+        }
+        else
+        {
+            auto from = where(value);
+            loadInteger(reg, from.first, from.second);
+        }
+    }
+
+    // Loads a number value as a double (integers through rax)
+    void toDouble(Xmm xmm, const TraceValue &value)
+    {
+        if (value.type == EvaValueType::INTEGER)
+        {
+            auto reg = value.kind == TraceValue::REGISTER ? (Reg)value.index : RAX;
+            toInteger(reg, value);
+            as_.cvtsi2sd(xmm, reg);
+        }
+        else if (value.kind == TraceValue::REGISTER)
+        {
+            if (value.index != xmm)
+                as_.movapd(xmm, (Xmm)value.index);
+        }
+        else
+        {
+            auto from = where(value);
+            as_.loadsd(xmm, from.first, from.second + NUMBER_AT);
+        }
+    }
+
+    // Address of a value in memory (constants through rdx)
+    std::pair<Reg, int32_t> where(const TraceValue &value)
+    {
+        switch (value.kind)
+        {
+        case TraceValue::CONSTANT:
+            as_.movImm(RDX, (uint64_t)&co->constants[value.index]);
+            return {RDX, 0};
+        case TraceValue::LOCAL:
+            return {R13, (int32_t)value.index * S};
+        default:
+            return {R14, globalAt(value.index)};
+        }
+    }
+
+    // Offset of a global's value from the first global
+    static int32_t globalAt(size_t index)
+    {
+        static GlobalVar global;
+        static auto valueAt = (int32_t)((uint8_t *)&global.value - (uint8_t *)&global);
+        return (int32_t)(index * sizeof(GlobalVar)) + valueAt;
+    }
+
+    JitRuntime runtime_;
+
+    // Code object of the loop, offset and stack depth of its header
+    CodeObject *co;
+    size_t header_;
+    size_t depth_;
+
+    // The recorded path, and the variables it uses (while compiling,
+    // with the number kind they have at that point)
+    std::vector<TraceStep> steps_;
+    std::vector<Variable> variables_;
+
+    // Values above the header's stack while compiling,
+    // and the side exits so far
+    std::vector<TraceValue> stack_;
+    std::vector<SideExit> exits_;
+};
+
+#endif // TraceJIT_h
@@ -0,0 +1,340 @@
+// Minimal x86-64 machine code emitter for the JITs.
+// Only the instruction forms the JIT compilers use are encoded.
+
+#ifndef X64Assembler_h
+#define X64Assembler_h
+
+#include <cstdint>
+#include <vector>
+
+// General purpose registers, in encoding order
+enum Reg : uint8_t
+{
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+};
+
+// SSE registers
+enum Xmm : uint8_t
+{
+    XMM0,
+    XMM1,
+    XMM2,
+    XMM3,
+    XMM4,
+    XMM5,
+    XMM6,
+    XMM7,
+};
+
+// Condition codes (low nibble of Jcc/SETcc)
+enum Cond : uint8_t
+{
+    CC_O = 0x0,
+    CC_B = 0x2,
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6,
+    CC_A = 0x7,
+    CC_P = 0xA,
+    CC_NP = 0xB,
+    CC_L = 0xC,
+    CC_GE = 0xD,
+    CC_LE = 0xE,
+    CC_G = 0xF,
+};
+
+// Scalar double operations (F2 0F xx)
+enum SseOp : uint8_t
+{
+    SSE_ADD = 0x58,
+    SSE_MUL = 0x59,
+    SSE_SUB = 0x5C,
+    SSE_DIV = 0x5E,
+};
+
+class X64Assembler
+{
+public:
+    std::vector<uint8_t> code;
+
+    size_t size() const { return code.size(); }
+
+    void push(Reg r)
+    {
+        if (r >= R8)
+            emit(0x41);
+        emit(0x50 + (r & 7));
+    }
+
+    void pop(Reg r)
+    {
+        if (r >= R8)
+            emit(0x41);
+        emit(0x58 + (r & 7));
+    }
+
+    void ret() { emit(0xC3); }
+
+    // mov dst, src
+    void mov(Reg dst, Reg src)
+    {
+        rex(true, src, dst);
+        emit(0x89);
+        emit(0xC0 | ((src & 7) << 3) | (dst & 7));
+    }
+
+    // mov dst, [base + disp]
+    void load(Reg dst, Reg base, int32_t disp)
+    {
+        rex(true, dst, base);
+        emit(0x8B);
+        memory(dst, base, disp);
+    }
+
+    // mov [base + disp], src
+    void store(Reg base, int32_t disp, Reg src)
+    {
+        rex(true, src, base);
+        emit(0x89);
+        memory(src, base, disp);
+    }
+
+    // mov dword [base + disp], imm
+    void store32(Reg base, int32_t disp, int32_t imm)
+    {
+        rex(false, RAX, base);
+        emit(0xC7);
+        memory(RAX, base, disp);
+        emit32(imm);
+    }
+
+    // mov dst, imm64
+    void movImm(Reg dst, uint64_t imm)
+    {
+        rex(true, RAX, dst);
+        emit(0xB8 + (dst & 7));
+        for (auto i = 0; i < 8; i++)
+            emit((imm >> (i * 8)) & 0xFF);
+    }
+
+    // add/sub/cmp dst, imm
+    void add(Reg dst, int32_t imm) { arithImm(0, dst, imm); }
+    void sub(Reg dst, int32_t imm) { arithImm(5, dst, imm); }
+    void cmp(Reg dst, int32_t imm) { arithImm(7, dst, imm); }
+
+    // add/sub/and/or/cmp dst, src (64 bit)
+    void addR(Reg dst, Reg src) { arithR(0x01, dst, src); }
+    void subR(Reg dst, Reg src) { arithR(0x29, dst, src); }
+    void andR(Reg dst, Reg src) { arithR(0x21, dst, src); }
+    void orR(Reg dst, Reg src) { arithR(0x09, dst, src); }
+    void cmpR(Reg dst, Reg src) { arithR(0x39, dst, src); }
+
+    // imul dst, src (64 bit)
+    void imulR(Reg dst, Reg src)
+    {
+        rex(true, dst, src);
+        emit2(0x0F, 0xAF);
+        emit(0xC0 | ((dst & 7) << 3) | (src & 7));
+    }
+
+    // shl/shr/sar dst, imm8 (64 bit)
+    void shl(Reg dst, uint8_t imm) { shift(4, dst, imm); }
+    void shr(Reg dst, uint8_t imm) { shift(5, dst, imm); }
+    void sar(Reg dst, uint8_t imm) { shift(7, dst, imm); }
+
+    // cmp dword [base + disp], imm8
+    void cmp32(Reg base, int32_t disp, int8_t imm)
+    {
+        rex(false, RAX, base);
+        emit(0x83);
+        memory((Reg)7, base, disp);
+        emit(imm);
+    }
+
+    // test byte [base + disp], imm8
+    void test8(Reg base, int32_t disp, uint8_t imm)
+    {
+        rex(false, RAX, base);
+        emit(0xF6);
+        memory(RAX, base, disp);
+        emit(imm);
+    }
+
+    // Byte register ops on al/cl: setcc, and, or, test, movzx eax, al
+    void setcc(Cond cc, Reg r8)
+    {
+        emit(0x0F);
+        emit(0x90 | cc);
+        emit(0xC0 | r8);
+    }
+    void and8(Reg dst, Reg src) { emit2(0x20, 0xC0 | (src << 3) | dst); }
+    void or8(Reg dst, Reg src) { emit2(0x08, 0xC0 | (src << 3) | dst); }
+    void test8(Reg r8) { emit2(0x84, 0xC0 | (r8 << 3) | r8); }
+    void movzx8(Reg dst, Reg src)
+    {
+        emit2(0x0F, 0xB6);
+        emit(0xC0 | (dst << 3) | src);
+    }
+
+    // movsd xmm, [base + disp] / movsd [base + disp], xmm
+    void loadsd(Xmm dst, Reg base, int32_t disp) { sseMemory(0xF2, 0x10, dst, base, disp); }
+    void storesd(Reg base, int32_t disp, Xmm src) { sseMemory(0xF2, 0x11, src, base, disp); }
+
+    // movdqu xmm, [base + disp] / movdqu [base + disp], xmm
+    void loaddqu(Xmm dst, Reg base, int32_t disp) { sseMemory(0xF3, 0x6F, dst, base, disp); }
+    void storedqu(Reg base, int32_t disp, Xmm src) { sseMemory(0xF3, 0x7F, src, base, disp); }
+
+    // addsd/subsd/mulsd/divsd dst, src
+    void sse(SseOp op, Xmm dst, Xmm src)
+    {
+        emit(0xF2);
+        emit2(0x0F, op);
+        emit(0xC0 | (dst << 3) | src);
+    }
+
+    // cvtsi2sd dst, src (64 bit integer)
+    void cvtsi2sd(Xmm dst, Reg src)
+    {
+        emit(0xF2);
+        rex(true, (Reg)dst, src);
+        emit2(0x0F, 0x2A);
+        emit(0xC0 | (dst << 3) | (src & 7));
+    }
+
+    // movapd dst, src
+    void movapd(Xmm dst, Xmm src)
+    {
+        emit(0x66);
+        emit2(0x0F, 0x28);
+        emit(0xC0 | (dst << 3) | src);
+    }
+
+    // ucomisd a, b
+    void ucomisd(Xmm a, Xmm b)
+    {
+        emit(0x66);
+        emit2(0x0F, 0x2E);
+        emit(0xC0 | (a << 3) | b);
+    }
+
+    // call r / jmp r
+    void call(Reg r) { indirect(2, r); }
+    void jmp(Reg r) { indirect(4, r); }
+
+    // Jumps with a 32-bit displacement, returning where it is
+    // (see patch)
+    size_t jmp()
+    {
+        emit(0xE9);
+        return placeholder();
+    }
+
+    size_t jcc(Cond cc)
+    {
+        emit2(0x0F, 0x80 | cc);
+        return placeholder();
+    }
+
+    // Points the displacement at `at` to `target`
+    void patch(size_t at, size_t target)
+    {
+        auto rel = (int32_t)(target - (at + 4));
+        for (auto i = 0; i < 4; i++)
+            code[at + i] = (rel >> (i * 8)) & 0xFF;
+    }
+
+private:
+    void emit(uint8_t byte) { code.push_back(byte); }
+
+    void emit2(uint8_t b1, uint8_t b2)
+    {
+        emit(b1);
+        emit(b2);
+    }
+
+    void emit32(int32_t value)
+    {
+        for (auto i = 0; i < 4; i++)
+            emit((value >> (i * 8)) & 0xFF);
+    }
+
+    size_t placeholder()
+    {
+        auto at = size();
+        emit32(0);
+        return at;
+    }
+
+    // REX prefix, omitted when not needed
+    void rex(bool wide, Reg reg, Reg rm)
+    {
+        uint8_t prefix = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+        if (prefix != 0x40)
+            emit(prefix);
+    }
+
+    // ModRM (+ SIB) for [base + disp32]
+    void memory(Reg reg, Reg base, int32_t disp)
+    {
+        emit(0x80 | ((reg & 7) << 3) | (base & 7));
+        if ((base & 7) == RSP)
+            emit(0x24);
+        emit32(disp);
+    }
+
+    void sseMemory(uint8_t prefix, uint8_t op, Xmm xmm, Reg base, int32_t disp)
+    {
+        emit(prefix);
+        rex(false, (Reg)xmm, base);
+        emit2(0x0F, op);
+        memory((Reg)xmm, base, disp);
+    }
+
+    void arithImm(uint8_t ext, Reg dst, int32_t imm)
+    {
+        rex(true, RAX, dst);
+        emit(0x81);
+        emit(0xC0 | (ext << 3) | (dst & 7));
+        emit32(imm);
+    }
+
+    void arithR(uint8_t op, Reg dst, Reg src)
+    {
+        rex(true, src, dst);
+        emit(op);
+        emit(0xC0 | ((src & 7) << 3) | (dst & 7));
+    }
+
+    void shift(uint8_t ext, Reg dst, uint8_t imm)
+    {
+        rex(true, RAX, dst);
+        emit(0xC1);
+        emit(0xC0 | (ext << 3) | (dst & 7));
+        emit(imm);
+    }
+
+    void indirect(uint8_t ext, Reg r)
+    {
+        rex(false, RAX, r);
+        emit(0xFF);
+        emit(0xC0 | (ext << 3) | (r & 7));
+    }
+};
+
+#endif // X64Assembler_h
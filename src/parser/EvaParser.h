@@ -65,12 +65,12 @@ enum class ExpType {
 struct Exp {
     ExpType type;
 
-    int number;
+    int64_t number;
     std::string string;
     std::vector<Exp> list;
 
     //Numbers:
-    Exp(int number) : type(ExpType::NUMBER), number(number) {}
+    Exp(int64_t number) : type(ExpType::NUMBER), number(number) {}
 
     // Strings, Symbols:
     Exp(std::string& strVal) {
@@ -89,7 +89,7 @@ struct Exp {
     void print() {
         switch(type) {
             case ExpType::NUMBER: {
-                printf("[%d] ", number);
+                printf("[%lld] ", (long long)number);
                 break;
             }
             case ExpType::STRING: 
@@ -230,15 +230,18 @@ class Tokenizer {
       return toToken(TokenType::__EOF);
     }
 
-    auto strSlice = str_.substr(cursor_);
+    // Match in place at the cursor: copying the rest of the source and
+    // searching it for every token is quadratic in the program size.
+    auto sliceBegin = str_.cbegin() + cursor_;
 
-    auto lexRulesForState = lexRulesByStartConditions_.at(getCurrentState());
+    const auto& lexRulesForState = lexRulesByStartConditions_.at(getCurrentState());
 
     for (const auto& ruleIndex : lexRulesForState) {
-      auto rule = lexRules_[ruleIndex];
+      const auto& rule = lexRules_[ruleIndex];
       std::smatch sm;
 
-      if (std::regex_search(strSlice, sm, rule.regex)) {
+      if (std::regex_search(sliceBegin, str_.cend(), sm, rule.regex,
+                            std::regex_constants::match_continuous)) {
         yytext = sm[0];
 
         captureLocations_(yytext);
@@ -266,7 +269,7 @@ class Tokenizer {
       return toToken(TokenType::__EOF);
     }
 
-    throwUnexpectedToken(std::string(1, strSlice[0]), currentLine_,
+    throwUnexpectedToken(std::string(1, str_[cursor_]), currentLine_,
                          currentColumn_);
   }
 
@@ -441,15 +444,15 @@ std::map<TokenizerState, std::vector<size_t>> Tokenizer::lexRulesByStartConditio
 #endif
 // clang-format on
 
-#define POP_V()              \
-  parser.valuesStack.back(); \
+#define POP_V()                         \
+  std::move(parser.valuesStack.back()); \
   parser.valuesStack.pop_back()
 
 #define POP_T()              \
   parser.tokensStack.back(); \
   parser.tokensStack.pop_back()
 
-#define PUSH_VR() parser.valuesStack.push_back(__)
+#define PUSH_VR() parser.valuesStack.push_back(std::move(__))
 #define PUSH_TR() parser.tokensStack.push_back(__)
 
 // Parsing table type.
@@ -666,7 +669,7 @@ void _handler4(yyparse& parser) {
 // Semantic action prologue.
 auto _1 = POP_T();
 
-auto __ = Exp(std::stoi(_1)) ;
+auto __ = Exp(std::stoll(_1)) ;
 
  // Semantic action epilogue.
 PUSH_VR();
@@ -724,7 +727,7 @@ void _handler9(yyparse& parser) {
 auto _2 = POP_V();
 auto _1 = POP_V();
 
-_1.list.push_back(_2); auto __ = _1 ;
+_1.list.push_back(std::move(_2)); auto __ = std::move(_1) ;
 
  // Semantic action epilogue.
 PUSH_VR();
@@ -9,16 +9,29 @@
 #include <memory>
 
 #include "src/bytecode/OpCode.h"
+#include "src/bytecode/RegisterOpCode.h"
 #include "src/compiler/EvaCompiler.h"
 #include "src/gc/EvaCollector.h"
+#include "src/jit/BaselineJIT.h"
+#include "src/jit/TraceJIT.h"
 #include "src/parser/EvaParser.h"
 #include "src/vm/EvaValue.h"
+#include "src/vm/ExecutionStack.h"
 #include "src/vm/Global.h"
 #include "src/vm/Logger.h"
+#include "src/vm/Preemption.h"
+#include "src/vm/SymbolTable.h"
+#include "src/vm/Tiering.h"
 
-#define STACK_LIMIT 512
+// Operand stack slots and call frames the execution stack can grow to
+#define STACK_LIMIT (1 << 20)
+#define FRAMES_LIMIT (1 << 17)
 #define GC_THRESHOLD 1024
 
+// After a collection, the next one runs once the heap
+// grew to this many times what survived
+#define GC_GROWTH 2
+
 // Reads the current byte in the bytecode
 // and advances the instruction pointer
 #define READ_BYTE() *ip++
@@ -26,79 +39,194 @@
 // Reads a short word (2 bytes) from bytecode
 #define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
 
+// Reads a long word (4 bytes) from bytecode
+#define READ_LONG() (ip += 4, ((uint32_t)ip[-4] << 24) | ((uint32_t)ip[-3] << 16) | ((uint32_t)ip[-2] << 8) | ip[-1])
+
 // Converts bytecode index to a pointer
 #define TO_ADDRESS(index) &fn->co->code[index]
 
+// Converts register code index to a pointer
+#define TO_REG_ADDRESS(index) &fn->co->regCode[index]
+
+// Register or constant named by an RK operand (register tier)
+#define RK(operand) ((operand) & RK_CONST ? fn->co->constants[(operand) & ~RK_CONST] : bp[(operand)])
+
 // Gets a constant at the index in pool
 // defined by the next bytecode
 #define GET_CONST() fn->co->constants[READ_BYTE()]
 
-// Binary operation
-#define BINARY_OP(op)                \
-    do                               \
-    {                                \
-        auto op2 = AS_NUMBER(pop()); \
-        auto op1 = AS_NUMBER(pop()); \
-        auto result = op1 op op2;    \
-        push(NUMBER(result));        \
+// Reads a pointer operand of linked code
+#define READ_POINTER(type) (ip += sizeof(void *), loadPointer<type>(ip - sizeof(void *)))
+
+// Constant, global and jump operands of the stack tier: pointers in
+// the linked code verified bytecode runs as (see BytecodeLinker.h),
+// otherwise indices or addresses read with `read`
+#define CONST_OPERAND(read) (Checked ? &fn->co->constants[read()] : READ_POINTER(EvaValue))
+#define GLOBAL_OPERAND(read) (Checked ? &global->get(read()).value : READ_POINTER(EvaValue))
+#define JUMP_OPERAND(read) (Checked ? TO_ADDRESS(read()) : READ_POINTER(uint8_t))
+
+// Sets a global to the value on top of the stack (unverified
+// code checks the index)
+#define SET_GLOBAL(read)                              \
+    {                                                 \
+        if constexpr (Checked)                        \
+            global->set(read(), peek<Checked>(0));    \
+        else                                          \
+            *READ_POINTER(EvaValue) = peek<false>(0); \
+    }
+
+// Binary operation on numbers (see numberOp)
+#define BINARY_OP(op)                             \
+    do                                            \
+    {                                             \
+        auto op2 = pop<Checked>();                \
+        auto op1 = pop<Checked>();                \
+        push<Checked>(numberOp<op>(op1, op2));    \
     } while (false)
 
-// Generic comparison operation
-// Rather than testing the numbers here, we could use a map
-// that is the inverse of compareOps_ in EvaCompiler.h
-#define COMPARE_VALUES(op, v1, v2)                                     \
-    do                                                                 \
-    {                                                                  \
-        bool res;                                                      \
-        switch (op)                                                    \
-        {                                                              \
-        case 0:                                                        \
-            res = v1 < v2;                                             \
-            break;                                                     \
-        case 1:                                                        \
-            res = v1 > v2;                                             \
-            break;                                                     \
-        case 2:                                                        \
-            res = v1 == v2;                                            \
-            break;                                                     \
-        case 3:                                                        \
-            res = v1 <= v2;                                            \
-            break;                                                     \
-        case 4:                                                        \
-            res = v1 >= v2;                                            \
-            break;                                                     \
-        case 5:                                                        \
-            res = v1 != v2;                                            \
-            break;                                                     \
-        default:                                                       \
-            res = false;                                               \
-            DIE << "Unknown comparison operator: " << op << std::endl; \
-        }                                                              \
-        push(BOOLEAN(res));                                            \
+// Register tier binary operation: <dst> <RK> <RK>
+#define REG_BINARY_OP(op)                     \
+    {                                         \
+        auto dst = READ_BYTE();               \
+        auto b = READ_BYTE();                 \
+        auto c = READ_BYTE();                 \
+        bp[dst] = numberOp<op>(RK(b), RK(c)); \
+    }
+
+// Fused compare-and-jump on the two values on top of the stack
+#define COMPARE_JUMP(op)                                                    \
+    {                                                                       \
+        auto address = JUMP_OPERAND(READ_SHORT);                            \
+        auto op2 = pop<Checked>();                                          \
+        auto op1 = pop<Checked>();                                          \
+        auto cond = IS_NUMBER(op1) && IS_NUMBER(op2)                        \
+                        ? compareNumbers(op, op1, op2)                      \
+                        : compareValues(op, op1, op2);                      \
+        if (!cond)                                                          \
+            ip = address;                                                   \
+    }
+
+// Once a code object deoptimized this many times, its
+// instructions are no longer quickened (polymorphic code).
+#define DEOPT_LIMIT 16
+
+// Rewrites the current instruction (opcode is `length` bytes back)
+// into its type-specialized variant, once the code is hot enough
+// (see Tiering.h).
+#define QUICKEN(opcode, length)                                                  \
+    do                                                                           \
+    {                                                                            \
+        if (fn->co->tier != CodeTier::GENERIC && fn->co->deopts < DEOPT_LIMIT) \
+            ip[-(length)] = opcode;                                              \
     } while (false)
 
+// Guard failed in a quickened instruction: restore the generic
+// opcode and re-dispatch to it (the operands are still unread).
+// NOTE: plain blocks rather than do/while, since DISPATCH() may
+// be a `break` out of the switch.
+#define DEOPTIMIZE(opcode)  \
+    {                       \
+        fn->co->deopts++;   \
+        *--ip = opcode;     \
+        DISPATCH();         \
+    }
+
+// Spends a unit of fuel on a back-edge or call, leaving the eval
+// loop when the program has to stop (see Preemption.h). Runs after
+// the jump or call, so the program resumes at its target.
+#define SPEND_FUEL()                                      \
+    {                                                     \
+        if (--preemption.fuel <= 0 && mustStop())         \
+            return NUMBER(0);                             \
+    }
+
+// Quickened numeric comparison (op as in compareOps_)
+#define COMPARE_NUM(op)                                 \
+    {                                                   \
+        if (!IS_NUMBER(peek<Checked>(0)) || !IS_NUMBER(peek<Checked>(1))) \
+            DEOPTIMIZE(OP_COMPARE);                     \
+        ip++;                                           \
+        auto v2 = pop<Checked>();                                \
+        auto v1 = pop<Checked>();                                \
+        push<Checked>(BOOLEAN(compareNumbers(op, v1, v2)));      \
+    }
+
+// Instruction dispatch. With EVA_COMPUTED_GOTO every handler ends
+// with its own indirect jump through the dispatch table (threaded
+// code), otherwise we fall back to the portable switch loop.
+#ifndef EVA_COMPUTED_GOTO
+#define EVA_COMPUTED_GOTO 0
+#endif
+
+#if EVA_COMPUTED_GOTO && !defined(__GNUC__)
+#error "EVA_COMPUTED_GOTO requires the labels-as-values extension (GCC/Clang)"
+#endif
+
+// With EVA_DISPATCH_STATS the VM counts executed instructions
+// (EvaVM::dispatches), to compare tiers and instruction sets.
+#ifndef EVA_DISPATCH_STATS
+#define EVA_DISPATCH_STATS 0
+#endif
+
+#if EVA_DISPATCH_STATS
+#define COUNT_DISPATCH() (dispatches++)
+#else
+#define COUNT_DISPATCH() ((void)0)
+#endif
+
+#if EVA_COMPUTED_GOTO
+#define OP_CASE(op) L_##op:
+#define OP_DEFAULT L_UNKNOWN:
+#define DISPATCH() goto *dispatchTable[(COUNT_DISPATCH(), opcode = READ_BYTE())]
+#else
+#define OP_CASE(op) case op:
+#define OP_DEFAULT default:
+#define DISPATCH() break
+#endif
+
 // Runtime allocation of memory, can call GC
 #define MEM(allocator, ...) (maybeGC(), allocator(__VA_ARGS__))
 
-// Stack frame for function calls.
-struct Frame
+// Instruction set the VM executes.
+enum class ExecutionTier
+{
+    STACK,
+    REGISTER,
+};
+
+// Property inline cache stats.
+struct PropCacheStats
 {
-    uint8_t *ra;        // Return address
-    EvaValue *bp;       // Base pointer (stack frame)
-    FunctionObject *fn; // Currently running function/code object/block
+    size_t hits = 0;
+    size_t misses = 0;
+
+    double hitRatio() const
+    {
+        auto total = hits + misses;
+        return total == 0 ? 0 : (double)hits / total;
+    }
 };
 
 // Eva Virtual Machine.
 class EvaVM
 {
 public:
-    EvaVM()
-        : global(std::make_shared<Global>()),
+    EvaVM(ExecutionTier tier = ExecutionTier::STACK, size_t maxFrames = FRAMES_LIMIT)
+        : tier(tier),
+          global(std::make_shared<Global>()),
+          symbols(std::make_shared<SymbolTable>()),
           parser(std::make_unique<syntax::EvaParser>()),
-          compiler(std::make_unique<EvaCompiler>(global)),
-          collector(std::make_unique<EvaCollector>())
+          compiler(std::make_unique<EvaCompiler>(global, symbols)),
+          collector(std::make_unique<EvaCollector>()),
+          stack(STACK_LIMIT, maxFrames)
     {
+        constructorSymbol = symbols->intern("constructor");
         setGlobalVariables();
+
+        // EVA_JIT_THRESHOLD turns the JIT on for every VM
+        auto threshold = getenv("EVA_JIT_THRESHOLD");
+        if (threshold != nullptr && *threshold != '\0')
+            enableJit(strtoul(threshold, nullptr, 10));
     }
 
     ~EvaVM()
@@ -106,27 +234,37 @@ public:
         Traceable::cleanup();
     }
 
-    // Pushes a value onto the stack
+    // Pushes a value onto the stack. Code that passed the bytecode
+    // verifier runs with Checked = false: its stack use is bounded
+    // once per frame (see OP_CALL) instead of on every access.
+    template <bool Checked = true>
     void push(const EvaValue &value)
     {
-        if ((size_t)(sp - stack.begin()) == STACK_LIMIT)
+        if constexpr (Checked)
         {
-            DIE << "push(): Stack overflow.\n";
+            if (sp == stack.slots.end() && !stack.slots.commit(sp + 1))
+            {
+                DIE << "push(): Stack overflow.\n";
+            }
         }
         *sp = value;
         sp++;
     }
 
     // Pops a value from the stack
+    template <bool Checked = true>
     EvaValue pop()
     {
-        if (sp == stack.begin() || stack.size() == 0)
-        {
-            DIE << "pop(): empty stack.\n";
-        }
-        if ((size_t)(sp - stack.begin()) > STACK_LIMIT)
+        if constexpr (Checked)
         {
-            DIE << "pop(): Stack pointer corrupted.\n";
+            if (sp == stack.slots.begin())
+            {
+                DIE << "pop(): empty stack.\n";
+            }
+            if (sp > stack.slots.end())
+            {
+                DIE << "pop(): Stack pointer corrupted.\n";
+            }
         }
         --sp;
         auto result = *sp;
@@ -134,25 +272,33 @@ public:
     }
 
     // Pops N values from the stack
+    template <bool Checked = true>
     void popN(size_t count)
     {
-        if (stack.size() == 0)
+        if constexpr (Checked)
         {
-            DIE << "popN(): empty stack." << std::endl;
-        }
-        if (count > stack.size())
-        {
-            DIE << "popN(): count greater than stack size." << std::endl;
+            if (sp == stack.slots.begin())
+            {
+                DIE << "popN(): empty stack." << std::endl;
+            }
+            if (count > (size_t)(sp - stack.slots.begin()))
+            {
+                DIE << "popN(): count greater than stack size." << std::endl;
+            }
         }
         sp -= count;
     }
 
     // Get value from stack without popping
+    template <bool Checked = true>
     EvaValue peek(const size_t offset = 0)
     {
-        if (stack.size() == 0 || sp == stack.begin())
+        if constexpr (Checked)
         {
-            DIE << "peek(): empty stack." << std::endl;
+            if (sp == stack.slots.begin())
+            {
+                DIE << "peek(): empty stack." << std::endl;
+            }
         }
         return *(sp - 1 - offset);
     }
@@ -160,7 +306,7 @@ public:
     // GC Operations
     void maybeGC()
     {
-        if (Traceable::bytesAllocated < GC_THRESHOLD)
+        if (Traceable::bytesAllocated < gcThreshold)
             return;
 
         auto roots = getGCRoots();
@@ -169,7 +315,11 @@ public:
 
         std::cout << "Before GC Stats" << std::endl;
         Traceable::printStats();
+        auto classesSwept = collector->classesSwept;
         collector->gc(roots);
+        gcThreshold = std::max<size_t>(GC_THRESHOLD, Traceable::bytesAllocated * GC_GROWTH);
+        if (collector->classesSwept != classesSwept)
+            propEpoch++;
         std::cout << "After GC Stats" << std::endl;
         Traceable::printStats();
     }
@@ -188,6 +338,10 @@ public:
         auto globalRoots = getGlobalGCRoots();
         roots.insert(globalRoots.begin(), globalRoots.end());
 
+        // Symbols
+        auto symbolRoots = symbols->getObjects();
+        roots.insert(symbolRoots.begin(), symbolRoots.end());
+
         return roots;
     }
 
@@ -196,11 +350,11 @@ public:
     {
         std::set<Traceable *> roots;
         auto stackEntry = sp;
-        while (stackEntry-- != stack.begin())
+        while (stackEntry-- != stack.slots.begin())
         {
             if (IS_OBJECT(*stackEntry))
             {
-                roots.insert((Traceable *)stackEntry->object);
+                roots.insert((Traceable *)AS_OBJECT(*stackEntry));
             }
         }
         return roots;
@@ -220,7 +374,7 @@ public:
         {
             if (IS_OBJECT(global.value))
             {
-                roots.insert((Traceable *)global.value.object);
+                roots.insert((Traceable *)AS_OBJECT(global.value));
             }
         }
 
@@ -237,329 +391,1590 @@ public:
         compiler->compile(ast);
         fn = compiler->getMainFunction();
 
-        // Set instruction pointer to the beginning, sp to top of stack
-        ip = &fn->co->code[0];
-        sp = &stack[0];
+        // 3. Lower it to the register tier if requested. Programs with
+        // code it can't express run on the stack tier.
+        activeTier = ExecutionTier::STACK;
+        if (tier == ExecutionTier::REGISTER)
+        {
+            if (compiler->lowerToRegisters())
+                activeTier = ExecutionTier::REGISTER;
+            else
+                std::cout << "Register tier unavailable, running stack bytecode" << std::endl;
+        }
+
+        // Set sp to top of stack
+        sp = stack.slots.begin();
         bp = sp;
+        frameTop = stack.frames.begin();
 
         // Emit the disassembly
         compiler->disassembleBytecode();
 
-        return eval();
+        if (activeTier == ExecutionTier::REGISTER)
+        {
+            ip = &fn->co->regCode[0];
+            enterRegisterFrame(0);
+            return run();
+        }
+
+        // 4. Verified bytecode runs linked and without per-instruction
+        // stack checks, only the main frame's size is checked up front.
+        auto verified = compiler->verifyBytecode() && stack.slots.commit(sp + fn->co->maxStack);
+        if (verified)
+            compiler->linkBytecode();
+
+        // Set instruction pointer to the beginning
+        checked = !verified;
+        ip = verified ? entryOf<false>(fn->co) : entryOf<true>(fn->co);
+        return run();
     }
 
-    // Main eval loop
+    // Continues the program suspended out of fuel, with the
+    // fuel given since (see setFuel)
+    EvaValue resume()
+    {
+        if (status != ExecStatus::SUSPENDED)
+        {
+            DIE << "resume(): no suspended program, status " << execStatusToString(status);
+        }
+        return run();
+    }
+
+    // Back-edges and calls the program (and resumed runs)
+    // can take before it's suspended
+    void setFuel(int64_t units) { preemption.setFuel(units); }
+
+    // Time the program (and resumed runs) out past `deadline`
+    void setDeadline(Preemption::Clock::time_point deadline) { preemption.setDeadline(deadline); }
+
+    // Runs the program from ip until it halts or has to stop,
+    // status says which
+    EvaValue run()
+    {
+        status = ExecStatus::RUNNING;
+        auto result = activeTier == ExecutionTier::REGISTER ? evalRegister()
+                      : checked                             ? eval<true>()
+                                                            : eval<false>();
+        if (status == ExecStatus::RUNNING)
+            status = ExecStatus::DONE;
+        return result;
+    }
+
+    // Out of fuel: refills it, or stops the program
+    bool mustStop()
+    {
+        status = preemption.preempt();
+        return status != ExecStatus::RUNNING;
+    }
+
+    // Main eval loop. Checked is false for verified bytecode.
+    template <bool Checked>
     EvaValue eval()
     {
+#if EVA_COMPUTED_GOTO
+        static void *dispatchTable[256];
+        static bool dispatchTableReady = false;
+
+        if (!dispatchTableReady)
+        {
+            for (auto &target : dispatchTable)
+                target = &&L_UNKNOWN;
+#define OP_LABEL(op) dispatchTable[OP_##op] = &&L_OP_##op;
+            FOR_EACH_OPCODE(OP_LABEL)
+#undef OP_LABEL
+            dispatchTableReady = true;
+        }
+
+        uint8_t opcode;
+        DISPATCH();
+#else
         for (;;)
         {
+            COUNT_DISPATCH();
             auto opcode = READ_BYTE();
             // opcode_pretty(opcode);
             // dumpStack();
             switch (opcode)
             {
-            case OP_HALT:
+#endif
+            OP_CASE(OP_HALT)
             {
-                auto result = pop();
+                auto result = pop<Checked>();
                 return result;
             }
-            case OP_CONST:
+            OP_CASE(OP_CONST)
             {
-                EvaValue constant = GET_CONST();
-                push(constant);
-                break;
+                push<Checked>(*CONST_OPERAND(READ_BYTE));
+                DISPATCH();
             }
-            case OP_ADD:
+            OP_CASE(OP_ADD)
             {
-                auto op2 = pop();
-                auto op1 = pop();
+                auto op2 = peek<Checked>(0);
+                auto op1 = peek<Checked>(1);
 
                 // Numeric addition:
                 if (IS_NUMBER(op1) && IS_NUMBER(op2))
                 {
-                    auto v1 = AS_NUMBER(op1);
-                    auto v2 = AS_NUMBER(op2);
-                    push(NUMBER(v1 + v2));
+                    QUICKEN(OP_ADD_NUM, 1);
+                    popN<Checked>(2);
+                    push<Checked>(numberOp<'+'>(op1, op2));
                 }
+                // String concatenation, the operands stay
+                // on the stack until the result is allocated
                 else if (IS_STRING(op1) && IS_STRING(op2))
                 {
-                    auto s1 = AS_CPPSTRING(op1);
-                    auto s2 = AS_CPPSTRING(op2);
-                    push(MEM(ALLOC_STRING, s1 + s2));
+                    auto result = concat(op1, op2);
+                    popN<Checked>(2);
+                    push<Checked>(result);
+                }
+                else
+                {
+                    DIE << "[EvaVM]: invalid operands for +";
                 }
 
-                break;
+                DISPATCH();
             }
-            case OP_SUB:
+            OP_CASE(OP_SUB)
             {
-                BINARY_OP(-);
-                break;
+                BINARY_OP('-');
+                DISPATCH();
             }
-            case OP_MUL:
+            OP_CASE(OP_MUL)
             {
-                BINARY_OP(*);
-                break;
+                BINARY_OP('*');
+                DISPATCH();
             }
-            case OP_DIV:
+            OP_CASE(OP_DIV)
             {
-                BINARY_OP(/);
-                break;
+                BINARY_OP('/');
+                DISPATCH();
             }
-            case OP_COMPARE:
+            OP_CASE(OP_COMPARE)
             {
                 auto op = READ_BYTE();
 
-                auto op2 = pop();
-                auto op1 = pop();
+                auto op2 = pop<Checked>();
+                auto op1 = pop<Checked>();
 
                 if (IS_NUMBER(op1) && IS_NUMBER(op2))
                 {
-                    auto v1 = AS_NUMBER(op1);
-                    auto v2 = AS_NUMBER(op2);
-                    COMPARE_VALUES(op, v1, v2);
+                    // Quickened variants follow the order of compareOps_
+                    QUICKEN(OP_LT_NUM + op, 2);
+                    push<Checked>(BOOLEAN(compareNumbers(op, op1, op2)));
                 }
-                else if (IS_STRING(op1) && IS_STRING(op2))
+                else
                 {
-                    auto s1 = AS_CPPSTRING(op1);
-                    auto s2 = AS_CPPSTRING(op2);
-                    COMPARE_VALUES(op, s1, s2);
+                    push<Checked>(BOOLEAN(compareValues(op, op1, op2)));
                 }
 
-                break;
+                DISPATCH();
             }
-            case OP_JMP_IF_FALSE:
+            // Quickened instructions
+            OP_CASE(OP_ADD_NUM)
             {
-                auto cond = AS_BOOLEAN(pop());
-                auto address = READ_SHORT();
+                if (!IS_NUMBER(peek<Checked>(0)) || !IS_NUMBER(peek<Checked>(1)))
+                    DEOPTIMIZE(OP_ADD)
+                BINARY_OP('+');
+                DISPATCH();
+            }
+            OP_CASE(OP_LT_NUM)
+            {
+                COMPARE_NUM(0)
+                DISPATCH();
+            }
+            OP_CASE(OP_GT_NUM)
+            {
+                COMPARE_NUM(1)
+                DISPATCH();
+            }
+            OP_CASE(OP_EQ_NUM)
+            {
+                COMPARE_NUM(2)
+                DISPATCH();
+            }
+            OP_CASE(OP_LE_NUM)
+            {
+                COMPARE_NUM(3)
+                DISPATCH();
+            }
+            OP_CASE(OP_GE_NUM)
+            {
+                COMPARE_NUM(4)
+                DISPATCH();
+            }
+            OP_CASE(OP_NE_NUM)
+            {
+                COMPARE_NUM(5)
+                DISPATCH();
+            }
+            // Fused compare-and-branch
+            OP_CASE(OP_JMP_IF_NOT_LT)
+            {
+                COMPARE_JUMP(0)
+                DISPATCH();
+            }
+            OP_CASE(OP_JMP_IF_NOT_GT)
+            {
+                COMPARE_JUMP(1)
+                DISPATCH();
+            }
+            OP_CASE(OP_JMP_IF_NOT_EQ)
+            {
+                COMPARE_JUMP(2)
+                DISPATCH();
+            }
+            OP_CASE(OP_JMP_IF_NOT_LE)
+            {
+                COMPARE_JUMP(3)
+                DISPATCH();
+            }
+            OP_CASE(OP_JMP_IF_NOT_GE)
+            {
+                COMPARE_JUMP(4)
+                DISPATCH();
+            }
+            OP_CASE(OP_JMP_IF_NOT_NE)
+            {
+                COMPARE_JUMP(5)
+                DISPATCH();
+            }
+            OP_CASE(OP_JMP_IF_NOT_CMP_LC)
+            {
+                auto op = READ_BYTE();
+                auto &local = bp[READ_BYTE()];
+                auto &constant = *CONST_OPERAND(READ_BYTE);
+                auto address = JUMP_OPERAND(READ_SHORT);
+
+                auto cond = IS_NUMBER(local)
+                                ? compareNumbers(op, local, constant)
+                                : compareValues(op, local, constant);
+                if (!cond)
+                    ip = address;
+
+                DISPATCH();
+            }
+            OP_CASE(OP_JMP_IF_FALSE)
+            {
+                auto cond = AS_BOOLEAN(pop<Checked>());
+                auto address = JUMP_OPERAND(READ_SHORT);
 
                 if (!cond)
                 {
-                    ip = TO_ADDRESS(address);
+                    ip = address;
                 }
 
-                break;
+                DISPATCH();
             }
-            case OP_JMP:
+            OP_CASE(OP_JMP)
             {
-                ip = TO_ADDRESS(READ_SHORT());
-                break;
+                auto from = ip;
+                ip = JUMP_OPERAND(READ_SHORT);
+                if (ip < from)
+                {
+                    SPEND_FUEL();
+                    backEdge<Checked>();
+                }
+                DISPATCH();
             }
-            case OP_GET_GLOBAL:
+            OP_CASE(OP_GET_GLOBAL)
             {
-                auto globalIndex = READ_BYTE();
-                push(global->get(globalIndex).value);
-                break;
+                push<Checked>(*GLOBAL_OPERAND(READ_BYTE));
+                DISPATCH();
             }
-            case OP_SET_GLOBAL:
+            OP_CASE(OP_SET_GLOBAL)
             {
-                auto globalIndex = READ_BYTE();
-                auto value = peek(0);
-                global->set(globalIndex, value);
-                break;
+                SET_GLOBAL(READ_BYTE)
+                DISPATCH();
             }
-            case OP_POP:
+            OP_CASE(OP_POP)
             {
-                pop();
-                break;
+                pop<Checked>();
+                DISPATCH();
             }
-            case OP_GET_LOCAL:
+            OP_CASE(OP_GET_LOCAL)
             {
                 auto localIndex = READ_BYTE();
-                if (localIndex < 0 || localIndex >= stack.size())
+                if constexpr (Checked)
                 {
-                    DIE << "OP_GET_LOCAL: invalid variable index: " << (int)localIndex;
+                    if (bp + localIndex >= stack.slots.end())
+                    {
+                        DIE << "OP_GET_LOCAL: invalid variable index: " << (int)localIndex;
+                    }
                 }
-                push(bp[localIndex]);
-                break;
+                push<Checked>(bp[localIndex]);
+                DISPATCH();
             }
-            case OP_SET_LOCAL:
+            OP_CASE(OP_SET_LOCAL)
             {
                 auto localIndex = READ_BYTE();
-                auto value = peek(0);
-                if (localIndex < 0 || localIndex >= stack.size())
+                auto value = peek<Checked>(0);
+                if constexpr (Checked)
                 {
-                    DIE << "OP_SET_LOCAL: invalid variable index: " << (int)localIndex;
+                    if (bp + localIndex >= stack.slots.end())
+                    {
+                        DIE << "OP_SET_LOCAL: invalid variable index: " << (int)localIndex;
+                    }
                 }
                 bp[localIndex] = value;
-                break;
+                DISPATCH();
             }
-            case OP_SCOPE_EXIT:
+            OP_CASE(OP_SCOPE_EXIT)
             {
                 auto count = READ_BYTE();
 
                 // Simple operation: value on top of stack is the result of the
                 // block. We need to put it back after popping all local vars
-                auto result = pop();
-                popN(count);
-                push(result);
-                break;
+                auto result = pop<Checked>();
+                popN<Checked>(count);
+                push<Checked>(result);
+                DISPATCH();
+            }
+            OP_CASE(OP_CALL)
+            {
+                callFunction<Checked>(READ_BYTE());
+                SPEND_FUEL();
+                DISPATCH();
             }
-            case OP_CALL:
+            OP_CASE(OP_INVOKE)
             {
+                // Method looked up on the receiver, below the arguments
+                auto propIndex = READ_BYTE();
+                auto &cache = fn->co->propCaches[READ_BYTE()];
                 auto argsCount = READ_BYTE();
-                auto fnValue = peek(argsCount);
-
-                // Native function
-                if (IS_NATIVE(fnValue))
-                {
-                    AS_NATIVE(fnValue)->function();
-                    auto result = pop();
-
-                    // Pop args and function:
-                    popN(argsCount + 1);
-
-                    // Put result back on top of the stack
-                    push(result);
-
-                    break;
-                }
-
-                // User defined function
-                auto callee = AS_FUNCTION(fnValue);
-
-                // Need to save state of machine to restore after call
-                callStack.push(Frame{ip, bp, fn});
-
-                // Now set the machine state to the new function
-                fn = callee;                         // Access local values for the function
-                fn->cells.resize(fn->co->freeCount); // Shrink cells vector to the size of *only* free vars
-                bp = sp - argsCount - 1;             // Base (frame) pointer for the call
-                ip = &callee->co->code[0];           // Jumps to the function code
-
-                break;
+                auto method = getProp(peek<Checked>(argsCount - 1), propIndex, cache);
+                insertCallee<Checked>(method, argsCount);
+                callFunction<Checked>(argsCount);
+                SPEND_FUEL();
+                DISPATCH();
             }
-            case OP_RETURN:
+            OP_CASE(OP_INVOKE_SUPER)
+            {
+                // Super method bound at compile time
+                auto method = fn->co->constants[READ_BYTE()];
+                auto argsCount = READ_BYTE();
+                insertCallee<Checked>(method, argsCount);
+                callFunction<Checked>(argsCount);
+                SPEND_FUEL();
+                DISPATCH();
+            }
+            OP_CASE(OP_RETURN)
             {
                 // Get the machine state we're restoring
-                auto callerFrame = callStack.top();
+                auto &callerFrame = *--frameTop;
 
                 ip = callerFrame.ra; // Jump back to the caller's code
                 bp = callerFrame.bp; // Restore the operand stack
                 fn = callerFrame.fn; // And restore local variables
 
-                callStack.pop();
-                break;
+                enterJit<Checked>();
+                DISPATCH();
             }
-            case OP_GET_CELL:
+            OP_CASE(OP_TAIL_CALL)
+            {
+                auto argsCount = READ_BYTE();
+                auto fnValue = peek<Checked>(argsCount);
+
+                // Native function: its result is the one of the
+                // current function, return it right away
+                if (IS_NATIVE(fnValue))
+                {
+                    bp[0] = callNative(AS_NATIVE(fnValue), sp - argsCount, argsCount);
+                    sp = bp + 1;
+
+                    auto &callerFrame = *--frameTop;
+                    ip = callerFrame.ra;
+                    bp = callerFrame.bp;
+                    fn = callerFrame.fn;
+                    enterJit<Checked>();
+                    SPEND_FUEL();
+                    DISPATCH();
+                }
+
+                // User defined function: the callee and its arguments
+                // replace the current frame, no new frame is pushed
+                auto callee = AS_FUNCTION(fnValue);
+                std::copy(sp - argsCount - 1, sp, bp);
+                sp = bp + argsCount + 1;
+                if constexpr (!Checked)
+                    checkFrame(callee->co, argsCount);
+                countCall<Checked>(callee->co);
+
+                fn = callee;
+                fn->clearCells(fn->co->freeCount);
+                ip = entryOf<Checked>(callee->co);
+                enterJit<Checked>();
+                SPEND_FUEL();
+
+                DISPATCH();
+            }
+            OP_CASE(OP_GET_CELL)
             {
                 auto cellIndex = READ_BYTE();
-                push(fn->cells[cellIndex]->value);
-                break;
+                push<Checked>(fn->cells()[cellIndex]->value);
+                DISPATCH();
             }
-            case OP_SET_CELL:
+            OP_CASE(OP_SET_CELL)
             {
                 auto cellIndex = READ_BYTE();
-                auto value = peek(0);
+                auto value = peek<Checked>(0);
 
-                if (fn->cells.size() <= cellIndex)
+                auto &cell = fn->cells()[cellIndex];
+                if (cell == nullptr)
                 {
                     // Allocate the cell if it doesn't yet exist
-                    fn->cells.push_back(AS_CELL(MEM(ALLOC_CELL, value)));
+                    cell = AS_CELL(MEM(ALLOC_CELL, value));
                 }
                 else
                 {
                     // Update the cell
-                    fn->cells[cellIndex]->value = value;
+                    cell->value = value;
                 }
-                break;
+                DISPATCH();
             }
-            case OP_LOAD_CELL:
+            OP_CASE(OP_LOAD_CELL)
             {
                 auto cellIndex = READ_BYTE();
-                push(CELL(fn->cells[cellIndex]));
-                break;
+                push<Checked>(CELL(fn->cells()[cellIndex]));
+                DISPATCH();
             }
-            case OP_MAKE_FUNCTION:
+            OP_CASE(OP_MAKE_FUNCTION)
             {
-                auto co = AS_CODE(pop());
+                auto co = AS_CODE(pop<Checked>());
                 auto cellsCount = READ_BYTE();
 
-                auto fnValue = MEM(ALLOC_FUNCTION, co);
+                auto fnValue = makeFunction(co);
                 auto fn = AS_FUNCTION(fnValue);
 
                 for (auto i = 0; i < cellsCount; i++)
                 {
-                    fn->cells.push_back(AS_CELL(pop()));
+                    fn->cells()[i] = AS_CELL(pop<Checked>());
                 }
 
-                push(fnValue);
-                break;
+                push<Checked>(fnValue);
+                DISPATCH();
             }
-            case OP_NEW:
+            OP_CASE(OP_GET_OUTER)
             {
-                auto classObject = AS_CLASS(pop());
+                push<Checked>(fn->outer[READ_BYTE()]);
+                DISPATCH();
+            }
+            OP_CASE(OP_SET_OUTER)
+            {
+                auto slot = READ_BYTE();
+                fn->outer[slot] = peek<Checked>(0);
+                DISPATCH();
+            }
+            OP_CASE(OP_NEW)
+            {
+                auto classObject = AS_CLASS(pop<Checked>());
                 auto instance = MEM(ALLOC_INSTANCE, classObject);
 
                 // Push the constructor
-                auto ctorValue = classObject->getProp("constructor");
-                push(ctorValue);
+                auto ctorValue = classObject->getProp(constructorSymbol);
+                push<Checked>(ctorValue);
 
                 // And the instance we've created
-                push(instance);
+                push<Checked>(instance);
 
                 // NOTE: the code for constructor parameters is
                 // generated at compile time, followed by OP_CALL
 
-                break;
+                DISPATCH();
             }
-            case OP_GET_PROP:
+            OP_CASE(OP_GET_PROP)
             {
-                auto prop = AS_CPPSTRING(GET_CONST());
-                auto object = pop();
-                if (IS_INSTANCE(object))
-                    push(AS_INSTANCE(object)->getProp(prop));
-                else if (IS_CLASS(object))
-                    push(AS_CLASS(object)->getProp(prop));
-                else
-                    DIE << "[EvaVM]: Unknown object for OP_GET_PROP " << prop;
-
-                break;
+                auto propIndex = READ_BYTE();
+                auto &cache = fn->co->propCaches[READ_BYTE()];
+                auto object = pop<Checked>();
+                push<Checked>(getProp(object, propIndex, cache));
+                DISPATCH();
+            }
+            OP_CASE(OP_SET_PROP)
+            {
+                auto propIndex = READ_BYTE();
+                auto &cache = fn->co->propCaches[READ_BYTE()];
+                auto object = pop<Checked>();
+                auto value = pop<Checked>();
+                setProp(object, propIndex, cache, value);
+                push<Checked>(value);
+                DISPATCH();
             }
-            case OP_SET_PROP:
+            OP_CASE(OP_WIDE)
             {
-                auto prop = AS_CPPSTRING(GET_CONST());
-                auto instance = AS_INSTANCE(pop()); // TODO: add classes
-                auto value = pop();
-                push(instance->properties[prop] = value);
-                break;
+                // Wide back-edges and calls spend fuel here,
+                // back-edges are counted as narrow ones
+                auto frames = frameTop;
+                if (evalWide<Checked>())
+                {
+                    SPEND_FUEL();
+                    backEdge<Checked>();
+                }
+                else if (frameTop > frames)
+                {
+                    SPEND_FUEL();
+                }
+                DISPATCH();
             }
-            default:
+            OP_DEFAULT
                 opcode_pretty(opcode);
                 DIE << "Unknown opcode: " << std::hex << opcode << std::dec << opcode;
+#if !EVA_COMPUTED_GOTO
+            }
+        }
+#endif
+        return NUMBER(0);
+    }
+
+    // Calls the function below the `argsCount` arguments on top
+    // of the stack: natives run in place, user functions get a frame
+    template <bool Checked>
+    void callFunction(size_t argsCount)
+    {
+        auto fnValue = peek<Checked>(argsCount);
+
+        // Native function
+        if (IS_NATIVE(fnValue))
+        {
+            auto result = callNative(AS_NATIVE(fnValue), sp - argsCount, argsCount);
+
+            // The result replaces the function and args
+            sp -= argsCount;
+            sp[-1] = result;
+            enterJit<Checked>();
+            return;
+        }
+
+        // User defined function
+        auto callee = AS_FUNCTION(fnValue);
+        if constexpr (!Checked)
+        {
+            // Verified code: the callee's whole frame
+            // is checked to fit on the stack up front
+            checkFrame(callee->co, argsCount);
+        }
+        countCall<Checked>(callee->co);
+
+        // Need to save state of machine to restore after call
+        pushFrame();
+
+        // Now set the machine state to the new function
+        fn = callee;                         // Access local values for the function
+        fn->clearCells(fn->co->freeCount);  // Its own cells are made again
+        bp = sp - argsCount - 1;             // Base (frame) pointer for the call
+        ip = entryOf<Checked>(callee->co);   // Jumps to the function code
+        enterJit<Checked>();
+    }
+
+    // First instruction of `co`: in linked code for verified code
+    template <bool Checked>
+    static uint8_t *entryOf(CodeObject *co)
+    {
+        return Checked ? &co->code[0] : &co->linked[0];
+    }
+
+    // Compiles functions called more than `threshold` times, and
+    // loops iterating more than that, to machine code (x86-64 only,
+    // see BaselineJIT.h and TraceJIT.h). Functions looping more than
+    // tiering.thresholds.osrBackEdges times are compiled too.
+    void enableJit(size_t threshold = JIT_THRESHOLD)
+    {
+#if EVA_JIT
+        auto offset = [this](void *field)
+        { return (int32_t)((uint8_t *)field - (uint8_t *)this); };
+
+        auto runtime = JitRuntime{offset(&ip), offset(&sp), offset(&bp), offset(&preemption.fuel), jitStep, jitCondition};
+        jit = std::make_unique<BaselineJIT>(runtime);
+        traceJit = std::make_unique<TraceJIT>(threshold, runtime);
+        tiering.thresholds.jitCalls = threshold;
+#endif
+    }
+
+    // The JIT for code the tiering may compile: only verified
+    // code is, so only the unchecked loop gets one
+    template <bool Checked>
+    BaselineJIT *tierJit()
+    {
+        return Checked ? nullptr : jit.get();
+    }
+
+    // Counts a call towards the callee's next tier
+    template <bool Checked>
+    void countCall(CodeObject *co)
+    {
+        tiering.countCall(co, tierJit<Checked>());
+    }
+
+    // Loop back-edge to ip: runs the loop's trace, or counts it
+    // towards tracing the loop, and counts it towards the function's
+    // next tier. Only verified code is traced, on code rather than
+    // the linked code it runs as. A function compiled for (or while
+    // in) a loop is entered here: on-stack replacement.
+    template <bool Checked>
+    void backEdge()
+    {
+        if constexpr (!Checked)
+        {
+            if (traceJit != nullptr)
+            {
+                ip = fn->co->toCode(ip);
+                traceJit->backEdge(this, fn->co, ip, bp, sp, global->globals);
+                ip = fn->co->toLinked(ip);
+            }
+        }
+
+        tiering.countBackEdge(fn->co, tierJit<Checked>());
+
+        if constexpr (!Checked)
+        {
+            if (fn->co->jitCode != nullptr)
+            {
+                tiering.stats.osrEntries++;
+                enterJit<false>();
+            }
+        }
+    }
+
+    // Runs the current function's machine code from ip, if it has
+    // any. Returns at the next call, return or halt. The machine code
+    // leaves ip in code, the interpreter continues in linked code.
+    template <bool Checked>
+    void enterJit()
+    {
+        if constexpr (!Checked)
+        {
+            if (fn->co->jitCode != nullptr)
+            {
+                jit->run(this, fn->co, fn->co->toCode(ip));
+                ip = fn->co->toLinked(ip);
+            }
+        }
+    }
+
+    // JIT runtime: the instructions the machine code doesn't expand
+    // inline (see BaselineJIT::genInstruction), on verified code
+    static void jitStep(EvaVM *vm, const uint8_t *at)
+    {
+        vm->stepInstruction(at);
+    }
+
+    // JIT runtime: compare-and-jump on values that aren't numbers
+    static bool jitCondition(EvaVM *vm, const uint8_t *at)
+    {
+        if (at[0] == OP_JMP_IF_NOT_CMP_LC)
+            return vm->compareValues(at[1], vm->bp[at[2]], vm->fn->co->constants[at[3]]);
+
+        auto op2 = vm->pop<false>();
+        auto op1 = vm->pop<false>();
+        return vm->compareValues(at[0] - OP_JMP_IF_NOT_LT, op1, op2);
+    }
+
+    // Runs the (non-control flow) instruction at `at`
+    void stepInstruction(const uint8_t *at)
+    {
+        ip = (uint8_t *)at + 1;
+        switch (at[0])
+        {
+        case OP_ADD:
+        case OP_ADD_NUM:
+        {
+            auto op2 = peek<false>(0);
+            auto op1 = peek<false>(1);
+            if (IS_NUMBER(op1) && IS_NUMBER(op2))
+            {
+                popN<false>(2);
+                push<false>(numberOp<'+'>(op1, op2));
+            }
+            else if (IS_STRING(op1) && IS_STRING(op2))
+            {
+                auto result = concat(op1, op2);
+                popN<false>(2);
+                push<false>(result);
+            }
+            else
+            {
+                DIE << "[EvaVM]: invalid operands for +";
+            }
+            break;
+        }
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        {
+            auto op2 = pop<false>();
+            auto op1 = pop<false>();
+            push<false>(at[0] == OP_SUB   ? numberOp<'-'>(op1, op2)
+                        : at[0] == OP_MUL ? numberOp<'*'>(op1, op2)
+                                          : numberOp<'/'>(op1, op2));
+            break;
+        }
+        case OP_COMPARE:
+        case OP_LT_NUM:
+        case OP_GT_NUM:
+        case OP_EQ_NUM:
+        case OP_LE_NUM:
+        case OP_GE_NUM:
+        case OP_NE_NUM:
+        {
+            auto op = READ_BYTE();
+            auto op2 = pop<false>();
+            auto op1 = pop<false>();
+            push<false>(BOOLEAN(compareValues(op, op1, op2)));
+            break;
+        }
+        case OP_GET_GLOBAL:
+            push<false>(global->get(READ_BYTE()).value);
+            break;
+        case OP_SET_GLOBAL:
+        {
+            auto globalIndex = READ_BYTE();
+            global->set(globalIndex, peek<false>(0));
+            break;
+        }
+        case OP_GET_CELL:
+            push<false>(fn->cells()[READ_BYTE()]->value);
+            break;
+        case OP_SET_CELL:
+        {
+            auto cellIndex = READ_BYTE();
+            auto value = peek<false>(0);
+            auto &cell = fn->cells()[cellIndex];
+            if (cell == nullptr)
+                cell = AS_CELL(MEM(ALLOC_CELL, value));
+            else
+                cell->value = value;
+            break;
+        }
+        case OP_LOAD_CELL:
+            push<false>(CELL(fn->cells()[READ_BYTE()]));
+            break;
+        case OP_MAKE_FUNCTION:
+        {
+            auto co = AS_CODE(pop<false>());
+            auto cellsCount = READ_BYTE();
+            auto fnValue = makeFunction(co);
+            for (auto i = 0; i < cellsCount; i++)
+                AS_FUNCTION(fnValue)->cells()[i] = AS_CELL(pop<false>());
+            push<false>(fnValue);
+            break;
+        }
+        case OP_GET_OUTER:
+            push<false>(fn->outer[READ_BYTE()]);
+            break;
+        case OP_SET_OUTER:
+        {
+            auto slot = READ_BYTE();
+            fn->outer[slot] = peek<false>(0);
+            break;
+        }
+        case OP_NEW:
+        {
+            auto classObject = AS_CLASS(pop<false>());
+            auto instance = MEM(ALLOC_INSTANCE, classObject);
+            push<false>(classObject->getProp(constructorSymbol));
+            push<false>(instance);
+            break;
+        }
+        case OP_GET_PROP:
+        {
+            auto propIndex = READ_BYTE();
+            auto &cache = fn->co->propCaches[READ_BYTE()];
+            auto object = pop<false>();
+            push<false>(getProp(object, propIndex, cache));
+            break;
+        }
+        case OP_SET_PROP:
+        {
+            auto propIndex = READ_BYTE();
+            auto &cache = fn->co->propCaches[READ_BYTE()];
+            auto object = pop<false>();
+            auto value = pop<false>();
+            setProp(object, propIndex, cache, value);
+            push<false>(value);
+            break;
+        }
+        default:
+            DIE << "stepInstruction(): unexpected opcode " << opcodeToString(at[0]);
+        }
+    }
+
+    // Puts a method below its `argsCount` arguments (receiver
+    // first), where calls expect the callee
+    template <bool Checked>
+    void insertCallee(const EvaValue &callee, size_t argsCount)
+    {
+        push<Checked>(callee);
+        std::rotate(sp - argsCount - 1, sp - 1, sp);
+    }
+
+    // Function object for `co`, before it captures its cells. Functions
+    // using the frame making them in place (co->outerNames) don't escape
+    // it, so the one allocated at compile time is reused, unless one of
+    // the frames below made it and may still call it.
+    EvaValue makeFunction(CodeObject *co)
+    {
+        if (co->outerNames.empty())
+            return MEM(ALLOC_FUNCTION, co);
+
+        auto function = co->frameFunction;
+        if (function->outer != nullptr && function->outer < bp && isRunning(function->outer))
+            function = AS_FUNCTION(MEM(ALLOC_FUNCTION, co));
+
+        function->clearCells();
+        function->outer = bp;
+        return OBJECT((Object *)function);
+    }
+
+    // Whether the frame at `base`, below the current
+    // one, still runs (waits for a call to return)
+    bool isRunning(const EvaValue *base)
+    {
+        for (auto frame = frameTop; frame != stack.frames.begin() && frame[-1].bp >= base; frame--)
+        {
+            if (frame[-1].bp == base)
+                return true;
+        }
+        return false;
+    }
+
+    // Saves the caller's state before entering a function
+    void pushFrame()
+    {
+        if (frameTop == stack.frames.end() && !stack.frames.commit(frameTop + 1))
+            DIE << "Call stack overflow: more than " << stack.frames.capacity() << " frames";
+        *frameTop++ = Frame{ip, bp, fn};
+    }
+
+    // Calls a native on `argsCount` arguments starting at `args`. Natives
+    // index their arguments directly, so they must get as many as they expect.
+    EvaValue callNative(NativeObject *native, const EvaValue *args, size_t argsCount)
+    {
+        if (argsCount != native->arity)
+            DIE << "OP_CALL: " << native->name << " expects " << native->arity << " arguments";
+        return native->function(*this, {args, argsCount});
+    }
+
+    // Checks that the frame of a call to verified code `co` fits on the
+    // stack, and that it gets the arguments its stack depths assume.
+    void checkFrame(CodeObject *co, size_t argsCount)
+    {
+        if (argsCount != co->arity)
+            DIE << "OP_CALL: " << co->name << " expects " << co->arity << " arguments";
+        if (!stack.slots.commit(sp - argsCount - 1 + co->maxStack))
+            DIE << "OP_CALL: Stack overflow.\n";
+    }
+
+    // Runs an instruction prefixed with OP_WIDE: 16-bit operands and
+    // 32-bit jump addresses. Out of the main loop, so the common narrow
+    // instructions keep their dispatch cost. Returns whether it
+    // jumped back (a loop back-edge).
+    template <bool Checked>
+    bool evalWide()
+    {
+        auto opcode = READ_BYTE();
+        switch (opcode)
+        {
+        case OP_CONST:
+            push<Checked>(*CONST_OPERAND(READ_SHORT));
+            break;
+        case OP_GET_GLOBAL:
+            push<Checked>(*GLOBAL_OPERAND(READ_SHORT));
+            break;
+        case OP_SET_GLOBAL:
+            SET_GLOBAL(READ_SHORT)
+            break;
+        case OP_GET_LOCAL:
+            push<Checked>(bp[READ_SHORT()]);
+            break;
+        case OP_SET_LOCAL:
+        {
+            auto localIndex = READ_SHORT();
+            bp[localIndex] = peek<Checked>(0);
+            break;
+        }
+        case OP_SCOPE_EXIT:
+        {
+            auto count = READ_SHORT();
+            auto result = pop<Checked>();
+            popN<Checked>(count);
+            push<Checked>(result);
+            break;
+        }
+        case OP_GET_CELL:
+            push<Checked>(fn->cells()[READ_SHORT()]->value);
+            break;
+        case OP_SET_CELL:
+        {
+            auto cellIndex = READ_SHORT();
+            auto value = peek<Checked>(0);
+            auto &cell = fn->cells()[cellIndex];
+            if (cell == nullptr)
+                cell = AS_CELL(MEM(ALLOC_CELL, value));
+            else
+                cell->value = value;
+            break;
+        }
+        case OP_LOAD_CELL:
+            push<Checked>(CELL(fn->cells()[READ_SHORT()]));
+            break;
+        case OP_GET_OUTER:
+            push<Checked>(fn->outer[READ_SHORT()]);
+            break;
+        case OP_SET_OUTER:
+        {
+            auto slot = READ_SHORT();
+            fn->outer[slot] = peek<Checked>(0);
+            break;
+        }
+        case OP_GET_PROP:
+        {
+            auto propIndex = READ_SHORT();
+            auto &cache = fn->co->propCaches[READ_SHORT()];
+            auto object = pop<Checked>();
+            push<Checked>(getProp(object, propIndex, cache));
+            break;
+        }
+        case OP_SET_PROP:
+        {
+            auto propIndex = READ_SHORT();
+            auto &cache = fn->co->propCaches[READ_SHORT()];
+            auto object = pop<Checked>();
+            auto value = pop<Checked>();
+            setProp(object, propIndex, cache, value);
+            push<Checked>(value);
+            break;
+        }
+        case OP_INVOKE:
+        {
+            auto propIndex = READ_SHORT();
+            auto &cache = fn->co->propCaches[READ_SHORT()];
+            auto argsCount = READ_SHORT();
+            auto method = getProp(peek<Checked>(argsCount - 1), propIndex, cache);
+            insertCallee<Checked>(method, argsCount);
+            callFunction<Checked>(argsCount);
+            break;
+        }
+        case OP_INVOKE_SUPER:
+        {
+            auto method = fn->co->constants[READ_SHORT()];
+            auto argsCount = READ_SHORT();
+            insertCallee<Checked>(method, argsCount);
+            callFunction<Checked>(argsCount);
+            break;
+        }
+        case OP_JMP:
+        {
+            auto from = ip;
+            ip = JUMP_OPERAND(READ_LONG);
+            return ip < from;
+        }
+        case OP_JMP_IF_FALSE:
+        {
+            auto cond = AS_BOOLEAN(pop<Checked>());
+            auto address = JUMP_OPERAND(READ_LONG);
+            if (!cond)
+                ip = address;
+            break;
+        }
+        case OP_JMP_IF_NOT_LT:
+        case OP_JMP_IF_NOT_GT:
+        case OP_JMP_IF_NOT_EQ:
+        case OP_JMP_IF_NOT_LE:
+        case OP_JMP_IF_NOT_GE:
+        case OP_JMP_IF_NOT_NE:
+        {
+            auto address = JUMP_OPERAND(READ_LONG);
+            auto op2 = pop<Checked>();
+            auto op1 = pop<Checked>();
+            if (!compareValues(opcode - OP_JMP_IF_NOT_LT, op1, op2))
+                ip = address;
+            break;
+        }
+        case OP_JMP_IF_NOT_CMP_LC:
+        {
+            auto op = READ_BYTE();
+            auto &local = bp[READ_SHORT()];
+            auto &constant = *CONST_OPERAND(READ_SHORT);
+            auto address = JUMP_OPERAND(READ_LONG);
+            if (!compareValues(op, local, constant))
+                ip = address;
+            break;
+        }
+        default:
+            DIE << "Unknown wide opcode: " << opcodeToString(opcode);
+        }
+        return false;
+    }
+
+    // Register tier eval loop, runs the register code of the functions
+    // (see RegisterOpCode.h). Frames and calling convention are the ones
+    // of the stack tier: a frame's registers are its stack slots, and
+    // sp stays at the end of the current frame's registers.
+    EvaValue evalRegister()
+    {
+#if EVA_COMPUTED_GOTO
+        static void *dispatchTable[256];
+        static bool dispatchTableReady = false;
+
+        if (!dispatchTableReady)
+        {
+            for (auto &target : dispatchTable)
+                target = &&L_UNKNOWN;
+#define ROP_LABEL(op) dispatchTable[ROP_##op] = &&L_ROP_##op;
+            FOR_EACH_REGISTER_OPCODE(ROP_LABEL)
+#undef ROP_LABEL
+            dispatchTableReady = true;
+        }
+
+        uint8_t opcode;
+        DISPATCH();
+#else
+        for (;;)
+        {
+            COUNT_DISPATCH();
+            auto opcode = READ_BYTE();
+            switch (opcode)
+            {
+#endif
+            OP_CASE(ROP_HALT)
+            {
+                auto result = READ_BYTE();
+                return RK(result);
+            }
+            OP_CASE(ROP_LOADK)
+            {
+                auto dst = READ_BYTE();
+                bp[dst] = GET_CONST();
+                DISPATCH();
+            }
+            OP_CASE(ROP_MOVE)
+            {
+                auto dst = READ_BYTE();
+                bp[dst] = bp[READ_BYTE()];
+                DISPATCH();
+            }
+            OP_CASE(ROP_ADD)
+            {
+                auto dst = READ_BYTE();
+                auto b = READ_BYTE();
+                auto c = READ_BYTE();
+                auto &op1 = RK(b);
+                auto &op2 = RK(c);
+
+                if (IS_NUMBER(op1) && IS_NUMBER(op2))
+                {
+                    bp[dst] = numberOp<'+'>(op1, op2);
+                }
+                else if (IS_STRING(op1) && IS_STRING(op2))
+                {
+                    bp[dst] = concat(op1, op2);
+                }
+                else
+                {
+                    DIE << "[EvaVM]: invalid operands for +";
+                }
+
+                DISPATCH();
+            }
+            OP_CASE(ROP_SUB)
+            {
+                REG_BINARY_OP('-');
+                DISPATCH();
+            }
+            OP_CASE(ROP_MUL)
+            {
+                REG_BINARY_OP('*');
+                DISPATCH();
+            }
+            OP_CASE(ROP_DIV)
+            {
+                REG_BINARY_OP('/');
+                DISPATCH();
+            }
+            OP_CASE(ROP_COMPARE)
+            {
+                auto dst = READ_BYTE();
+                auto op = READ_BYTE();
+                auto b = READ_BYTE();
+                auto c = READ_BYTE();
+                auto &op1 = RK(b);
+                auto &op2 = RK(c);
+
+                bp[dst] = BOOLEAN(IS_NUMBER(op1) && IS_NUMBER(op2)
+                                      ? compareNumbers(op, op1, op2)
+                                      : compareValues(op, op1, op2));
+                DISPATCH();
+            }
+            OP_CASE(ROP_JMP)
+            {
+                auto from = ip;
+                ip = TO_REG_ADDRESS(READ_SHORT());
+                if (ip < from)
+                    SPEND_FUEL();
+                DISPATCH();
+            }
+            OP_CASE(ROP_JMP_IF_FALSE)
+            {
+                auto b = READ_BYTE();
+                auto address = READ_SHORT();
+
+                if (!AS_BOOLEAN(RK(b)))
+                    ip = TO_REG_ADDRESS(address);
+
+                DISPATCH();
+            }
+            OP_CASE(ROP_JMP_IF_NOT)
+            {
+                auto op = READ_BYTE();
+                auto b = READ_BYTE();
+                auto c = READ_BYTE();
+                auto address = READ_SHORT();
+                auto &op1 = RK(b);
+                auto &op2 = RK(c);
+
+                auto cond = IS_NUMBER(op1) && IS_NUMBER(op2)
+                                ? compareNumbers(op, op1, op2)
+                                : compareValues(op, op1, op2);
+                if (!cond)
+                    ip = TO_REG_ADDRESS(address);
+
+                DISPATCH();
+            }
+            OP_CASE(ROP_GET_GLOBAL)
+            {
+                auto dst = READ_BYTE();
+                bp[dst] = global->get(READ_BYTE()).value;
+                DISPATCH();
+            }
+            OP_CASE(ROP_SET_GLOBAL)
+            {
+                auto globalIndex = READ_BYTE();
+                auto b = READ_BYTE();
+                global->set(globalIndex, RK(b));
+                DISPATCH();
+            }
+            OP_CASE(ROP_GET_CELL)
+            {
+                auto dst = READ_BYTE();
+                bp[dst] = fn->cells()[READ_BYTE()]->value;
+                DISPATCH();
+            }
+            OP_CASE(ROP_SET_CELL)
+            {
+                auto cellIndex = READ_BYTE();
+                auto b = READ_BYTE();
+                auto value = RK(b);
+
+                auto &cell = fn->cells()[cellIndex];
+                if (cell == nullptr)
+                {
+                    // Allocate the cell if it doesn't yet exist
+                    cell = AS_CELL(MEM(ALLOC_CELL, value));
+                }
+                else
+                {
+                    // Update the cell
+                    cell->value = value;
+                }
+                DISPATCH();
+            }
+            OP_CASE(ROP_LOAD_CELL)
+            {
+                auto dst = READ_BYTE();
+                bp[dst] = CELL(fn->cells()[READ_BYTE()]);
+                DISPATCH();
+            }
+            OP_CASE(ROP_MAKE_FUNCTION)
+            {
+                auto dst = READ_BYTE();
+                auto co = AS_CODE(GET_CONST());
+                auto cellsCount = READ_BYTE();
+
+                auto fnValue = makeFunction(co);
+                auto function = AS_FUNCTION(fnValue);
+
+                // Same order as the stack tier pops them
+                for (auto i = 0; i < cellsCount; i++)
+                {
+                    function->cells()[i] = AS_CELL(bp[dst + cellsCount - 1 - i]);
+                }
+
+                bp[dst] = fnValue;
+                DISPATCH();
+            }
+            OP_CASE(ROP_GET_OUTER)
+            {
+                auto dst = READ_BYTE();
+                bp[dst] = fn->outer[READ_BYTE()];
+                DISPATCH();
+            }
+            OP_CASE(ROP_SET_OUTER)
+            {
+                auto slot = READ_BYTE();
+                auto b = READ_BYTE();
+                fn->outer[slot] = RK(b);
+                DISPATCH();
+            }
+            OP_CASE(ROP_NEW)
+            {
+                auto dst = READ_BYTE();
+                auto classObject = AS_CLASS(bp[dst]);
+                auto instance = MEM(ALLOC_INSTANCE, classObject);
+
+                // Constructor and the instance we've created
+                bp[dst] = classObject->getProp(constructorSymbol);
+                bp[dst + 1] = instance;
+                DISPATCH();
+            }
+            OP_CASE(ROP_GET_PROP)
+            {
+                auto dst = READ_BYTE();
+                auto b = READ_BYTE();
+                auto propIndex = READ_BYTE();
+                auto &cache = fn->co->propCaches[READ_BYTE()];
+                bp[dst] = getProp(RK(b), propIndex, cache);
+                DISPATCH();
+            }
+            OP_CASE(ROP_SET_PROP)
+            {
+                auto b = READ_BYTE();
+                auto c = READ_BYTE();
+                auto propIndex = READ_BYTE();
+                auto &cache = fn->co->propCaches[READ_BYTE()];
+                setProp(RK(b), propIndex, cache, RK(c));
+                DISPATCH();
+            }
+            OP_CASE(ROP_CALL)
+            {
+                auto base = READ_BYTE();
+                auto argsCount = READ_BYTE();
+                callRegister(base, argsCount);
+                SPEND_FUEL();
+                DISPATCH();
+            }
+            OP_CASE(ROP_INVOKE)
+            {
+                auto base = READ_BYTE();
+                auto propIndex = READ_BYTE();
+                auto &cache = fn->co->propCaches[READ_BYTE()];
+                auto argsCount = READ_BYTE();
+
+                // Receiver and arguments move up a register
+                // to make room for the method
+                auto method = getProp(bp[base], propIndex, cache);
+                std::copy_backward(bp + base, bp + base + argsCount, bp + base + argsCount + 1);
+                bp[base] = method;
+                callRegister(base, argsCount);
+                SPEND_FUEL();
+                DISPATCH();
+            }
+            OP_CASE(ROP_INVOKE_SUPER)
+            {
+                auto base = READ_BYTE();
+                auto method = fn->co->constants[READ_BYTE()];
+                auto argsCount = READ_BYTE();
+                std::copy_backward(bp + base, bp + base + argsCount, bp + base + argsCount + 1);
+                bp[base] = method;
+                callRegister(base, argsCount);
+                SPEND_FUEL();
+                DISPATCH();
+            }
+            OP_CASE(ROP_RETURN)
+            {
+                auto b = READ_BYTE();
+
+                // Result goes to the callee slot of the caller
+                bp[0] = RK(b);
+
+                auto &callerFrame = *--frameTop;
+                ip = callerFrame.ra;
+                bp = callerFrame.bp;
+                fn = callerFrame.fn;
+
+                sp = bp + fn->co->regFrameSize;
+                DISPATCH();
+            }
+            OP_CASE(ROP_TAIL_CALL)
+            {
+                auto base = READ_BYTE();
+                auto argsCount = READ_BYTE();
+                auto fnValue = bp[base];
+
+                // Native function: return its result right away
+                if (IS_NATIVE(fnValue))
+                {
+                    bp[0] = callNative(AS_NATIVE(fnValue), bp + base + 1, argsCount);
+
+                    auto &callerFrame = *--frameTop;
+                    ip = callerFrame.ra;
+                    bp = callerFrame.bp;
+                    fn = callerFrame.fn;
+
+                    sp = bp + fn->co->regFrameSize;
+                    SPEND_FUEL();
+                    DISPATCH();
+                }
+
+                // User defined function: reuses the current frame
+                auto callee = AS_FUNCTION(fnValue);
+                std::copy(bp + base, bp + base + argsCount + 1, bp);
+
+                fn = callee;
+                fn->clearCells(fn->co->freeCount);
+                ip = &callee->co->regCode[0];
+                enterRegisterFrame(argsCount + 1);
+                SPEND_FUEL();
+
+                DISPATCH();
+            }
+            OP_DEFAULT
+                DIE << "Unknown register opcode: " << std::hex << (int)opcode;
+#if !EVA_COMPUTED_GOTO
             }
         }
+#endif
+        return NUMBER(0);
     }
 
+    // Calls the function in register `base` with the `argsCount`
+    // arguments after it, the result is written to `base`
+    void callRegister(size_t base, size_t argsCount)
+    {
+        auto fnValue = bp[base];
+
+        // Native function: reads the arguments in place
+        if (IS_NATIVE(fnValue))
+        {
+            bp[base] = callNative(AS_NATIVE(fnValue), bp + base + 1, argsCount);
+            return;
+        }
+
+        // User defined function
+        auto callee = AS_FUNCTION(fnValue);
+        pushFrame();
+
+        fn = callee;
+        fn->clearCells(fn->co->freeCount);
+        bp = bp + base;
+        ip = &callee->co->regCode[0];
+        enterRegisterFrame(argsCount + 1);
+    }
+
+    // Sets up the registers of a register tier frame starting at bp,
+    // the first `used` ones (callee and arguments) are already set.
+    // The rest is cleared, since the GC scans the whole frame.
+    void enterRegisterFrame(size_t used)
+    {
+        sp = bp + fn->co->regFrameSize;
+        if (!stack.slots.commit(sp))
+        {
+            DIE << "enterRegisterFrame(): Stack overflow.\n";
+        }
+        for (auto slot = bp + used; slot < sp; slot++)
+        {
+            *slot = NUMBER(0);
+        }
+    }
+
+    // Reads a property, using the inline cache of the access site
+    EvaValue getProp(const EvaValue &object, size_t propIndex, PropCache &cache)
+    {
+        if (!IS_SHAPED(object))
+            DIE << "[EvaVM]: Unknown object for OP_GET_PROP "
+                << AS_CPPSTRING(fn->co->constants[propIndex]);
+
+        auto receiver = AS_SHAPED(object);
+        auto entry = probePropCache(cache, receiver->shape);
+        if (entry != nullptr)
+        {
+            auto holder = entry->holder != nullptr ? entry->holder : receiver;
+            return holder->slots[entry->slot];
+        }
+
+        auto prop = AS_STRING(fn->co->constants[propIndex]);
+        auto location = IS_INSTANCE(object)
+                            ? AS_INSTANCE(object)->findProp(prop)
+                            : AS_CLASS(object)->findProp(prop);
+
+        fillPropCache(cache, {receiver->shape,
+                              location.holder == receiver ? nullptr : location.holder,
+                              location.slot,
+                              nullptr});
+        return location.value();
+    }
+
+    // Writes a property, using the inline cache of the access site
+    void setProp(const EvaValue &object, size_t propIndex, PropCache &cache, const EvaValue &value)
+    {
+        if (!IS_SHAPED(object))
+            DIE << "[EvaVM]: Unknown object for OP_SET_PROP "
+                << AS_CPPSTRING(fn->co->constants[propIndex]);
+
+        auto receiver = AS_SHAPED(object);
+        auto entry = probePropCache(cache, receiver->shape);
+        if (entry != nullptr)
+        {
+            if (entry->transition != nullptr)
+            {
+                receiver->shape = entry->transition;
+                receiver->slots.push_back(value);
+            }
+            else
+            {
+                receiver->slots[entry->slot] = value;
+            }
+            return;
+        }
+
+        auto prop = AS_STRING(fn->co->constants[propIndex]);
+        auto prevShape = receiver->shape;
+        auto added = receiver->setOwnProp(prop, value);
+
+        if (added && IS_CLASS(object))
+        {
+            // A new class member may shadow what caches
+            // resolved further up the class chain.
+            propEpoch++;
+        }
+        else
+        {
+            fillPropCache(cache, {prevShape,
+                                  nullptr,
+                                  (size_t)receiver->shape->getSlot(prop),
+                                  added ? receiver->shape : nullptr});
+        }
+    }
+
+    // Concatenates two strings: long results are ropes, copied
+    // once when read. The operands have to be reachable (e.g. on
+    // the stack), the allocation may collect.
+    EvaValue concat(const EvaValue &op1, const EvaValue &op2)
+    {
+        auto s1 = AS_STRING(op1);
+        auto s2 = AS_STRING(op2);
+        if (s1->length + s2->length < ROPE_MIN_LENGTH)
+            return MEM(ALLOC_STRING, s1->str(), s2->str());
+        return MEM(ALLOC_ROPE, s1, s2);
+    }
+
+    // Generic comparison: numbers, strings, booleans (equality
+    // only). Values of different types are never ordered nor equal.
+    bool compareValues(uint8_t op, const EvaValue &op1, const EvaValue &op2)
+    {
+        if (IS_NUMBER(op1) && IS_NUMBER(op2))
+        {
+            return compareNumbers(op, op1, op2);
+        }
+
+        if (IS_STRING(op1) && IS_STRING(op2))
+        {
+            auto str1 = AS_STRING(op1);
+            auto str2 = AS_STRING(op2);
+
+            // Symbols are unique: (in)equality is a pointer compare
+            if (str1->interned && str2->interned && (op == 2 || op == 5))
+            {
+                return (str1 == str2) == (op == 2);
+            }
+
+            // Different lengths or (known) hashes: not equal,
+            // without reading the characters
+            if ((op == 2 || op == 5) &&
+                (str1->length != str2->length || (str1->hashed && str2->hashed && str1->hash != str2->hash)))
+            {
+                return op == 5;
+            }
+            return compareAs(op, str1->str(), str2->str());
+        }
+
+        if (IS_BOOLEAN(op1) && IS_BOOLEAN(op2) && (op == 2 || op == 5))
+        {
+            return (AS_BOOLEAN(op1) == AS_BOOLEAN(op2)) == (op == 2);
+        }
+
+        return op == 5;
+    }
+
+    // Looks up the receiver shape in a property inline cache,
+    // returns the cached entry or nullptr on a miss.
+    PropCacheEntry *probePropCache(PropCache &cache, Shape *shape)
+    {
+        if (cache.epoch == propEpoch)
+        {
+            for (size_t i = 0; i < cache.count; i++)
+            {
+                if (cache.entries[i].shape == shape)
+                {
+                    propCacheStats.hits++;
+                    return &cache.entries[i];
+                }
+            }
+        }
+        propCacheStats.misses++;
+        return nullptr;
+    }
+
+    // Records a resolved property location in the inline cache
+    void fillPropCache(PropCache &cache, const PropCacheEntry &entry)
+    {
+        if (cache.epoch != propEpoch)
+        {
+            cache.epoch = propEpoch;
+            cache.count = 0;
+        }
+
+        if (cache.megamorphic)
+            return;
+
+        if (cache.count == PROP_CACHE_SIZE)
+        {
+            cache.megamorphic = true;
+            return;
+        }
+
+        cache.entries[cache.count++] = entry;
+    }
+
+    // Inline cache hit/miss counters
+    const PropCacheStats &getPropCacheStats() { return propCacheStats; }
+
     // Sets up global variables and functions
     void setGlobalVariables()
     {
         // Native square function
         global->addNativeFunction(
             "square",
-            [&]()
+            [](EvaVM &, NativeArgs args)
             {
-                auto x = AS_NUMBER(peek(0));
-                push(NUMBER(x * x));
+                return numberOp<'*'>(args[0], args[0]);
             },
             1);
 
         // Native sum function
         global->addNativeFunction(
             "sum",
-            [&]()
+            [](EvaVM &, NativeArgs args)
             {
-                auto v2 = AS_NUMBER(peek(0));
-                auto v1 = AS_NUMBER(peek(1));
-                push(NUMBER(v1 + v2));
+                return numberOp<'+'>(args[0], args[1]);
             },
             2);
         global->addConst("x", 10);
         global->addConst("y", 20);
     }
 
+    // Requested instruction set, and the one the
+    // last program actually ran on
+    ExecutionTier tier;
+    ExecutionTier activeTier = ExecutionTier::STACK;
+
     // Global vars object
     std::shared_ptr<Global> global;
 
+    // Interned strings (symbols), shared with the compiler
+    std::shared_ptr<SymbolTable> symbols;
+
+    // Frequently used symbols
+    StringObject *constructorSymbol;
+
     // Parser
     std::unique_ptr<syntax::EvaParser> parser;
 
@@ -569,6 +1984,9 @@ public:
     // Garbage collector
     std::unique_ptr<EvaCollector> collector;
 
+    // Heap size the next collection runs at
+    size_t gcThreshold = GC_THRESHOLD;
+
     // Instruction pointer (aka Program counter)
     uint8_t *ip;
 
@@ -578,15 +1996,46 @@ public:
     // Base (stack frame) pointer
     EvaValue *bp;
 
-    // Operands stack.
-    std::array<EvaValue, STACK_LIMIT> stack;
+    // Operand stack and call frames
+    ExecutionStack stack;
 
-    // Call stack
-    std::stack<Frame> callStack;
+    // Top of the call frames
+    Frame *frameTop = stack.frames.begin();
 
     // Code object
     FunctionObject *fn;
 
+    // Baseline JIT, null unless enabled
+    std::unique_ptr<BaselineJIT> jit;
+
+    // Trace JIT for hot loops, null unless enabled
+    std::unique_ptr<TraceJIT> traceJit;
+
+    // Hotness counting and tier transitions
+    TieringManager tiering;
+
+    // Fuel and deadline of the program
+    Preemption preemption;
+
+    // Whether the program halted, or why it stopped
+    ExecStatus status = ExecStatus::DONE;
+
+    // Whether the program's bytecode runs checked (unverified)
+    bool checked = true;
+
+    // Property inline caches are only valid for the epoch they were
+    // filled in. Bumped whenever cached entries may be stale: a class
+    // got a new member, or the GC freed classes. Their shapes went with
+    // them, and a cache keyed by a freed shape would hit on a new shape
+    // allocated at its address.
+    size_t propEpoch = 1;
+
+    // Property inline cache stats
+    PropCacheStats propCacheStats;
+
+    // Executed instructions (with EVA_DISPATCH_STATS)
+    size_t dispatches = 0;
+
     //--------------------------------------
     // Debug functions
 
@@ -594,12 +2043,12 @@ public:
     void dumpStack()
     {
         std::cout << "\n------- Stack --------\n";
-        if (sp == stack.begin())
+        if (sp == stack.slots.begin())
         {
             std::cout << "(empty)";
         }
         auto csp = sp - 1;
-        while (csp >= stack.begin())
+        while (csp >= stack.slots.begin())
         {
             std::cout << *csp-- << std::endl;
         }
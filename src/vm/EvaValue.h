@@ -2,14 +2,24 @@
 #ifndef EvaValue_h
 #define EvaValue_h
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 #include "src/vm/Logger.h"
 
 // Eva value type
 enum class EvaValueType
 {
     NUMBER,
+    INTEGER,
     BOOLEAN,
     OBJECT,
 };
@@ -29,7 +39,7 @@ enum class ObjectType
 // Base traceable object
 struct Traceable
 {
-    bool marked;
+    bool marked = false;
     size_t size;
     static size_t bytesAllocated;
     static std::list<Traceable *> objects;
@@ -57,11 +67,15 @@ struct Traceable
     {
         for (auto &object : objects)
         {
-            delete object;
+            destroy(object);
         }
         objects.clear();
     }
 
+    // Destructs and frees an object as its own type: there's no
+    // virtual destructor (defined after the object types)
+    static void destroy(Traceable *object);
+
     // Memory stats
     static void printStats()
     {
@@ -83,15 +97,205 @@ struct Object : public Traceable
     ObjectType type;
 };
 
-// String object
+// Concatenations shorter than this are copied right away,
+// longer ones are ropes
+#define ROPE_MIN_LENGTH 64
+
+// String object: a header and the characters (null terminated) in a
+// single allocation. A rope is the concatenation of two strings (either
+// can be a rope) and is flattened when first read, so building a
+// string by appending to it is linear instead of copying the whole
+// string every time. It has its two parts where a flat string has the
+// characters, and once flattened the flat copy and a null.
 struct StringObject : public Object
 {
-    StringObject(const std::string &str) : Object(ObjectType::STRING), string(str) {}
-    std::string string;
+    // A flat string of `a` and `b`
+    static StringObject *create(std::string_view a, std::string_view b = {})
+    {
+        auto string = allocate(a.size() + b.size(), a.size() + b.size() + 1, false);
+        memcpy(string->chars(), a.data(), a.size());
+        memcpy(string->chars() + a.size(), b.data(), b.size());
+        string->chars()[string->length] = '\0';
+        return string;
+    }
+
+    static StringObject *createRope(StringObject *left, StringObject *right)
+    {
+        auto rope = allocate(left->length + right->length, 2 * sizeof(StringObject *), true);
+        rope->parts()[0] = left;
+        rope->parts()[1] = right;
+        return rope;
+    }
+
+    // The characters, flattening a rope
+    std::string_view str()
+    {
+        if (!rope)
+            return {chars(), length};
+        if (parts()[1] != nullptr)
+            flatten();
+        return parts()[0]->str();
+    }
+
+    // Whether it's a rope that wasn't read yet
+    bool isRope() { return rope && parts()[1] != nullptr; }
+
+    // Rope parts (the flat copy, and null, once flattened)
+    StringObject **parts() { return (StringObject **)(this + 1); }
+
+    // Computed on first use, precomputed for symbols
+    size_t hashCode()
+    {
+        if (!hashed)
+        {
+            hash = std::hash<std::string_view>{}(str());
+            hashed = true;
+        }
+        return hash;
+    }
+
+    size_t length;
+    size_t hash = 0;
+    bool hashed = false;
+
+    // Symbols (interned strings) are unique per content
+    bool interned = false;
+
+    // Whether it has parts rather than characters
+    bool rope;
+
+private:
+    StringObject(size_t length, bool rope) : Object(ObjectType::STRING), length(length), rope(rope) {}
+
+    // A string with `extra` bytes after the header, through
+    // Traceable's allocator so it's one traced object
+    static StringObject *allocate(size_t length, size_t extra, bool rope)
+    {
+        auto memory = Traceable::operator new(sizeof(StringObject) + extra);
+        return ::new (memory) StringObject(length, rope);
+    }
+
+    char *chars() { return (char *)(this + 1); }
+
+    // Copies the leaves left to right, without recursing: appending
+    // builds ropes as deep as they are long
+    void flatten()
+    {
+        auto flat = allocate(length, length + 1, false);
+        auto out = flat->chars();
+        std::vector<StringObject *> pending = {parts()[1], parts()[0]};
+        while (!pending.empty())
+        {
+            auto part = pending.back();
+            pending.pop_back();
+            if (!part->isRope())
+            {
+                auto chars = part->str();
+                memcpy(out, chars.data(), chars.size());
+                out += chars.size();
+                continue;
+            }
+            pending.push_back(part->parts()[1]);
+            pending.push_back(part->parts()[0]);
+        }
+        *out = '\0';
+        parts()[0] = flat;
+        parts()[1] = nullptr;
+    }
+};
+
+// Value representation. By default an EvaValue is a 16 byte tagged
+// union. With EVA_NAN_BOXING it is packed into a single 64 bit word:
+// doubles are stored as is, and booleans, 48 bit integers and object
+// pointers live in the payload of a quiet NaN. The constructor/
+// accessor/predicate macros below hide the difference from the rest
+// of the VM.
+//
+// Numbers are doubles (NUMBER) or integers (INTEGER). IS_NUMBER and
+// AS_NUMBER take both, as a double; IS_DOUBLE/IS_INTEGER tell them
+// apart.
+#ifndef EVA_NAN_BOXING
+#define EVA_NAN_BOXING 0
+#endif
+
+#if EVA_NAN_BOXING
+
+// NaN-boxed Eva value
+struct EvaValue
+{
+    union
+    {
+        uint64_t bits;
+        double number;
+        bool boolean; // Aliases the low byte, i.e. the boolean payload
+    };
+};
+
+static_assert(sizeof(EvaValue) == 8, "NaN-boxed EvaValue must be 8 bytes");
+
+// Quiet NaN bits, never produced by arithmetic on its own
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+// Object pointers: sign bit + quiet NaN + 48 bit pointer
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+
+// Booleans: quiet NaN + boolean tag + 0/1 in the lowest bit
+#define BOOLEAN_TAG ((uint64_t)0x0001000000000000)
+
+// Integers: quiet NaN + integer tag + 48 bit two's complement
+#define INTEGER_TAG ((uint64_t)0x0002000000000000)
+#define INTEGER_PAYLOAD ((uint64_t)0x0000ffffffffffff)
+#define INTEGER_MIN (-((int64_t)1 << 47))
+#define INTEGER_MAX (((int64_t)1 << 47) - 1)
+
+inline EvaValue numberToValue(double number)
+{
+    EvaValue value;
+    value.number = number;
+    return value;
+}
+
+inline EvaValue bitsToValue(uint64_t bits)
+{
+    EvaValue value;
+    value.bits = bits;
+    return value;
+}
+
+#else
+
+// Eva value (tagged union)
+struct EvaValue
+{
+    EvaValueType type;
+    union
+    {
+        double number;
+        int64_t integer;
+        bool boolean;
+        Object *object;
+    };
+};
+
+#define INTEGER_MIN INT64_MIN
+#define INTEGER_MAX INT64_MAX
+
+#endif
+
+// Native functions: plain function pointers, called with the VM and
+// their arguments (as many as their arity, checked by the caller)
+// still on the stack, and returning the result.
+class EvaVM;
+
+struct NativeArgs
+{
+    const EvaValue *values;
+    size_t count;
+
+    const EvaValue &operator[](size_t index) const { return values[index]; }
 };
 
-// Native functions
-using NativeFn = std::function<void()>;
+using NativeFn = EvaValue (*)(EvaVM &vm, NativeArgs args);
 
 struct NativeObject : public Object
 {
@@ -105,18 +309,90 @@ struct NativeObject : public Object
     size_t arity;
 };
 
-// Eva value (tagged union)
-struct EvaValue
+// Hidden class (shape): property layout shared by all objects that
+// got the same properties in the same order. Adding a property moves
+// an object along a transition to the next shape.
+// Property names are symbols (interned strings), so they're keyed
+// by pointer.
+struct Shape
 {
-    EvaValueType type;
-    union
+    // Property name -> index in the object's slots
+    std::unordered_map<StringObject *, size_t> slots;
+
+    // Shapes reached by adding one more property
+    std::unordered_map<StringObject *, std::unique_ptr<Shape>> transitions;
+
+    // Slot index of a property, -1 if the shape doesn't have it
+    int getSlot(StringObject *name)
     {
-        double number;
-        bool boolean;
-        Object *object;
-    };
+        auto it = slots.find(name);
+        return it == slots.end() ? -1 : (int)it->second;
+    }
+
+    // Shape after adding a property (created on first use)
+    Shape *addProperty(StringObject *name)
+    {
+        auto &next = transitions[name];
+        if (next == nullptr)
+        {
+            next = std::make_unique<Shape>();
+            next->slots = slots;
+            next->slots[name] = slots.size();
+        }
+        return next.get();
+    }
+};
+
+struct ShapedObject;
+
+// Max shapes remembered by a property access site
+#define PROP_CACHE_SIZE 4
+
+// Inline cache entry: a receiver shape seen at the site and where the
+// property lives. `holder` is nullptr for the receiver's own slot, or
+// the class the property is inherited from. For property additions
+// (SET_PROP on a new property) `transition` is the receiver's new shape.
+struct PropCacheEntry
+{
+    Shape *shape;
+    ShapedObject *holder;
+    size_t slot;
+    Shape *transition;
+};
+
+// Per-site inline cache for OP_GET_PROP/OP_SET_PROP.
+// Monomorphic with one entry, polymorphic up to PROP_CACHE_SIZE,
+// megamorphic (no longer cached) after that. Only valid for the
+// VM's property epoch it was filled in.
+struct PropCache
+{
+    size_t epoch = 0;
+    size_t count = 0;
+    bool megamorphic = false;
+    PropCacheEntry entries[PROP_CACHE_SIZE];
+};
+
+// Machine code of a code object (see src/jit/JitCompiler.h)
+struct JitCode;
+
+// Tier a code object runs in (see src/vm/Tiering.h)
+enum class CodeTier
+{
+    GENERIC,
+    QUICKENED,
+    JIT,
 };
 
+// Trace JIT state of a loop (see src/jit/TraceJIT.h)
+struct LoopState
+{
+    uint32_t backEdges = 0;
+    bool blacklisted = false;
+    JitCode *trace = nullptr;
+};
+
+struct FunctionObject;
+
 struct LocalVar
 {
     std::string name;
@@ -137,6 +413,57 @@ struct CodeObject : public Object
     std::vector<std::string> cellNames;
     size_t freeCount = 0;
 
+    // Functions that don't escape the frame making them use its
+    // variables in place: their names by slot (empty for slots it
+    // doesn't use), and the function object reused while no other
+    // one is running (see EvaVM::makeFunction)
+    std::vector<std::string> outerNames;
+    FunctionObject *frameFunction = nullptr;
+
+    // Number of times a quickened instruction in this code
+    // fell back to its generic form.
+    size_t deopts = 0;
+
+    // Inline caches of the property access sites
+    std::vector<PropCache> propCaches;
+
+    // Register tier code (see RegisterOpCode.h), lowered from
+    // `code`, and the number of registers a frame needs.
+    std::vector<uint8_t> regCode;
+    size_t regFrameSize = 0;
+
+    // Set by the bytecode verifier (see BytecodeVerifier.h): the code
+    // is well formed and never needs more than maxStack stack slots
+    // from the frame's base pointer.
+    bool verified = false;
+    size_t maxStack = 0;
+
+    // Tiering: calls and loop back-edges counted towards the tier
+    // thresholds, and the tier reached
+    size_t callCount = 0;
+    size_t backEdges = 0;
+    CodeTier tier = CodeTier::GENERIC;
+
+    // Baseline JIT: the machine code once compiled (or
+    // jitFailed if the code can't be compiled)
+    JitCode *jitCode = nullptr;
+    bool jitFailed = false;
+
+    // Trace JIT: state of the loops by header offset,
+    // allocated on the first back-edge
+    std::vector<LoopState> loops;
+
+    // Linked code (see BytecodeLinker.h), what verified code runs as,
+    // and the offsets of the instructions in one form in the other
+    std::vector<uint8_t> linked;
+    std::vector<uint32_t> linkedAt;
+    std::vector<uint32_t> codeAt;
+
+    // Address of an instruction in linked code from
+    // its address in code, and back
+    uint8_t *toLinked(const uint8_t *at) { return &linked[linkedAt[at - code.data()]]; }
+    uint8_t *toCode(const uint8_t *at) { return &code[codeAt[at - linked.data()]]; }
+
     void insertAtOffset(int offset, uint8_t byte)
     {
         code.insert((offset < 0 ? code.end() : code.begin()) + offset, byte);
@@ -183,52 +510,113 @@ struct CodeObject : public Object
     }
 };
 
+// Object with properties stored in a slot array laid out by its shape
+struct ShapedObject : public Object
+{
+    ShapedObject(ObjectType type, Shape *shape) : Object(type), shape(shape) {}
+
+    Shape *shape;
+    std::vector<EvaValue> slots;
+
+    // Own property slot, nullptr if the object doesn't have it
+    EvaValue *getOwnSlot(StringObject *prop)
+    {
+        auto index = shape->getSlot(prop);
+        return index == -1 ? nullptr : &slots[index];
+    }
+
+    // Sets an own property. Returns true if it was added,
+    // i.e. the object transitioned to a new shape.
+    bool setOwnProp(StringObject *prop, const EvaValue &value)
+    {
+        auto index = shape->getSlot(prop);
+        if (index != -1)
+        {
+            slots[index] = value;
+            return false;
+        }
+        shape = shape->addProperty(prop);
+        slots.push_back(value);
+        return true;
+    }
+};
+
+// Where a property was found: the holder object and its slot
+struct PropLocation
+{
+    ShapedObject *holder;
+    size_t slot;
+
+    EvaValue &value() { return holder->slots[slot]; }
+};
+
 // Class object
-struct ClassObject : public Object
+struct ClassObject : public ShapedObject
 {
     ClassObject(const std::string &name, ClassObject *superClass)
-        : Object(ObjectType::CLASS),
+        : ShapedObject(ObjectType::CLASS, nullptr),
           name(name),
-          properties{},
-          superClass(superClass) {}
+          superClass(superClass),
+          classShape(std::make_unique<Shape>()),
+          instanceShape(std::make_unique<Shape>())
+    {
+        shape = classShape.get();
+    }
 
     std::string name;
-    std::map<std::string, EvaValue> properties;
     ClassObject *superClass;
 
-    EvaValue getProp(const std::string &prop)
+    // Root shapes of the class itself and of its instances. Each class
+    // has its own, so an instance shape also identifies the class.
+    std::unique_ptr<Shape> classShape;
+    std::unique_ptr<Shape> instanceShape;
+
+    EvaValue getProp(StringObject *prop)
     {
-        if (properties.count(prop) != 0)
-            return properties[prop];
+        return findProp(prop).value();
+    }
+
+    // Finds a property in the class chain
+    PropLocation findProp(StringObject *prop)
+    {
+        auto index = shape->getSlot(prop);
+        if (index != -1)
+            return {this, (size_t)index};
 
         if (superClass == nullptr)
-            DIE << "Unresolved property " << prop << " in class " << name;
+            DIE << "Unresolved property " << prop->str() << " in class " << name;
 
-        return superClass->getProp(prop);
+        return superClass->findProp(prop);
     }
 
-    void setProp(const std::string &prop, const EvaValue &value)
+    void setProp(StringObject *prop, const EvaValue &value)
     {
-        properties[prop] = value;
+        setOwnProp(prop, value);
     }
 };
 
 // Instances of classes
-struct InstanceObject : public Object
+struct InstanceObject : public ShapedObject
 {
     InstanceObject(ClassObject *cls)
-        : Object(ObjectType::INSTANCE), cls(cls), properties{} {}
+        : ShapedObject(ObjectType::INSTANCE, cls->instanceShape.get()), cls(cls) {}
 
     ClassObject *cls;
-    std::map<std::string, EvaValue> properties;
 
-    EvaValue getProp(const std::string &prop)
+    EvaValue getProp(StringObject *prop)
+    {
+        return findProp(prop).value();
+    }
+
+    // Finds a property, own or inherited
+    PropLocation findProp(StringObject *prop)
     {
-        if (properties.count(prop) != 0)
-            return properties[prop];
+        auto index = shape->getSlot(prop);
+        if (index != -1)
+            return {this, (size_t)index};
 
         // If not in own properties, check the class object
-        return cls->getProp(prop);
+        return cls->findProp(prop);
     }
 };
 
@@ -240,63 +628,124 @@ struct CellObject : public Object
     EvaValue value;
 };
 
-// Function object
+// Function object: a header and its cells in a single allocation. The
+// cells of the variables it captures (for closures) come first, then
+// its own, null until they're first set; the code object is compiled
+// when the function is made, so both counts are known.
 struct FunctionObject : public Object
 {
-    FunctionObject(CodeObject *co) : Object(ObjectType::FUNCTION), co(co) {}
+    static FunctionObject *create(CodeObject *co)
+    {
+        auto cellCount = co->cellNames.size();
+        auto memory = Traceable::operator new(sizeof(FunctionObject) + cellCount * sizeof(CellObject *));
+        auto function = ::new (memory) FunctionObject(co, cellCount);
+        function->clearCells();
+        return function;
+    }
+
+    CellObject **cells() { return (CellObject **)(this + 1); }
+
+    // Drops the cells from `from` on (made again when next set)
+    void clearCells(size_t from = 0)
+    {
+        std::fill(cells() + from, cells() + cellCount, nullptr);
+    }
 
     // Reference to the code object:
     // contains function code, locals, etc.
     CodeObject *co;
 
-    // Captured cells (for closures).
-    std::vector<CellObject *> cells;
+    size_t cellCount;
+
+    // Base pointer of the frame that made the function, when
+    // it uses that frame's variables in place (co->outerNames)
+    EvaValue *outer = nullptr;
+
+private:
+    FunctionObject(CodeObject *co, size_t cellCount)
+        : Object(ObjectType::FUNCTION), co(co), cellCount(cellCount) {}
 };
 
+inline void Traceable::destroy(Traceable *object)
+{
+    switch (((Object *)object)->type)
+    {
+    case ObjectType::CODE:
+        delete (CodeObject *)object;
+        break;
+    case ObjectType::NATIVE:
+        delete (NativeObject *)object;
+        break;
+    case ObjectType::CLASS:
+        delete (ClassObject *)object;
+        break;
+    case ObjectType::INSTANCE:
+        delete (InstanceObject *)object;
+        break;
+    default:
+        // Strings, functions and cells own nothing else
+        delete object;
+    }
+}
+
 // Constructors
+#if EVA_NAN_BOXING
+#define NUMBER(value) numberToValue(value)
+#define INTEGER(value) bitsToValue(QNAN | INTEGER_TAG | ((uint64_t)(value) & INTEGER_PAYLOAD))
+#define BOOLEAN(value) bitsToValue(QNAN | BOOLEAN_TAG | ((value) ? 1 : 0))
+#define OBJECT(value) bitsToValue(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(value))
+#else
 #define NUMBER(value) ((EvaValue){.type = EvaValueType::NUMBER, .number = value})
+#define INTEGER(value) ((EvaValue){.type = EvaValueType::INTEGER, .integer = value})
 #define BOOLEAN(value) ((EvaValue){.type = EvaValueType::BOOLEAN, .boolean = value})
 #define OBJECT(value) ((EvaValue){.type = EvaValueType::OBJECT, .object = value})
+#endif
 #define CELL(cellObject) OBJECT((Object *)cellObject)
 #define CLASS(classObject) OBJECT((Object *)classObject)
 
-#define ALLOC_STRING(value) \
-    ((EvaValue){.type = EvaValueType::OBJECT, .object = (Object *)new StringObject(value)})
-#define ALLOC_CODE(name, arity) \
-    ((EvaValue){.type = EvaValueType::OBJECT, .object = (Object *)new CodeObject(name, arity)})
-#define ALLOC_NATIVE(fn, name, arity)         \
-    ((EvaValue){.type = EvaValueType::OBJECT, \
-                .object = (Object *)new NativeObject(fn, name, arity)})
-#define ALLOC_FUNCTION(co)                    \
-    ((EvaValue){.type = EvaValueType::OBJECT, \
-                .object = (Object *)new FunctionObject(co)})
-#define ALLOC_CELL(evaValue)                  \
-    ((EvaValue){.type = EvaValueType::OBJECT, \
-                .object = (Object *)new CellObject(evaValue)})
-#define ALLOC_CLASS(name, superClass)         \
-    ((EvaValue){.type = EvaValueType::OBJECT, \
-                .object = (Object *)new ClassObject(name, superClass)})
-#define ALLOC_INSTANCE(cls)                   \
-    ((EvaValue){.type = EvaValueType::OBJECT, \
-                .object = (Object *)new InstanceObject(cls)})
+#define ALLOC_STRING(...) OBJECT((Object *)StringObject::create(__VA_ARGS__))
+#define ALLOC_ROPE(left, right) OBJECT((Object *)StringObject::createRope(left, right))
+#define ALLOC_CODE(name, arity) OBJECT((Object *)new CodeObject(name, arity))
+#define ALLOC_NATIVE(fn, name, arity) OBJECT((Object *)new NativeObject(fn, name, arity))
+#define ALLOC_FUNCTION(co) OBJECT((Object *)FunctionObject::create(co))
+#define ALLOC_CELL(evaValue) OBJECT((Object *)new CellObject(evaValue))
+#define ALLOC_CLASS(name, superClass) OBJECT((Object *)new ClassObject(name, superClass))
+#define ALLOC_INSTANCE(cls) OBJECT((Object *)new InstanceObject(cls))
 
 // Accessors
-#define AS_NUMBER(evaValue) ((double)(evaValue).number)
+#if EVA_NAN_BOXING
+#define AS_INTEGER(evaValue) ((int64_t)((evaValue).bits << 16) >> 16)
+#define AS_BOOLEAN(evaValue) ((bool)((evaValue).bits & 1))
+#define AS_OBJECT(evaValue) ((Object *)(uintptr_t)((evaValue).bits & ~(SIGN_BIT | QNAN)))
+#else
+#define AS_INTEGER(evaValue) ((int64_t)(evaValue).integer)
 #define AS_BOOLEAN(evaValue) ((bool)(evaValue).boolean)
 #define AS_OBJECT(evaValue) ((Object *)(evaValue).object)
-#define AS_STRING(evaValue) ((StringObject *)(evaValue).object)
-#define AS_CPPSTRING(evaValue) (AS_STRING(evaValue)->string)
-#define AS_CODE(evaValue) ((CodeObject *)(evaValue).object)
-#define AS_NATIVE(evaValue) ((NativeObject *)(evaValue).object)
-#define AS_FUNCTION(evaValue) ((FunctionObject *)(evaValue).object)
-#define AS_CELL(evaValue) ((CellObject *)(evaValue).object)
-#define AS_CLASS(evaValue) ((ClassObject *)(evaValue).object)
-#define AS_INSTANCE(evaValue) ((InstanceObject *)(evaValue).object)
+#endif
+#define AS_NUMBER(evaValue) (IS_INTEGER(evaValue) ? (double)AS_INTEGER(evaValue) : (evaValue).number)
+#define AS_STRING(evaValue) ((StringObject *)AS_OBJECT(evaValue))
+#define AS_CPPSTRING(evaValue) std::string(AS_STRING(evaValue)->str())
+#define AS_CODE(evaValue) ((CodeObject *)AS_OBJECT(evaValue))
+#define AS_NATIVE(evaValue) ((NativeObject *)AS_OBJECT(evaValue))
+#define AS_FUNCTION(evaValue) ((FunctionObject *)AS_OBJECT(evaValue))
+#define AS_CELL(evaValue) ((CellObject *)AS_OBJECT(evaValue))
+#define AS_CLASS(evaValue) ((ClassObject *)AS_OBJECT(evaValue))
+#define AS_INSTANCE(evaValue) ((InstanceObject *)AS_OBJECT(evaValue))
+#define AS_SHAPED(evaValue) ((ShapedObject *)AS_OBJECT(evaValue))
 
 // Predicates
-#define IS_NUMBER(evaValue) ((evaValue).type == EvaValueType::NUMBER)
+#if EVA_NAN_BOXING
+#define IS_DOUBLE(evaValue) (((evaValue).bits & QNAN) != QNAN)
+#define IS_INTEGER(evaValue) (((evaValue).bits & (SIGN_BIT | QNAN | INTEGER_TAG)) == (QNAN | INTEGER_TAG))
+#define IS_BOOLEAN(evaValue) (((evaValue).bits & ~(uint64_t)1) == (QNAN | BOOLEAN_TAG))
+#define IS_OBJECT(evaValue) (((evaValue).bits & (SIGN_BIT | QNAN)) == (SIGN_BIT | QNAN))
+#else
+#define IS_DOUBLE(evaValue) ((evaValue).type == EvaValueType::NUMBER)
+#define IS_INTEGER(evaValue) ((evaValue).type == EvaValueType::INTEGER)
 #define IS_BOOLEAN(evaValue) ((evaValue).type == EvaValueType::BOOLEAN)
 #define IS_OBJECT(evaValue) ((evaValue).type == EvaValueType::OBJECT)
+#endif
+#define IS_NUMBER(evaValue) (IS_DOUBLE(evaValue) || IS_INTEGER(evaValue))
 #define IS_OBJECT_TYPE(evaValue, objectType) \
     (IS_OBJECT(evaValue) && AS_OBJECT(evaValue)->type == objectType)
 #define IS_STRING(evaValue) IS_OBJECT_TYPE(evaValue, ObjectType::STRING)
@@ -306,14 +755,77 @@ struct FunctionObject : public Object
 #define IS_CELL(evaValue) IS_OBJECT_TYPE(evaValue, ObjectType::CELL)
 #define IS_CLASS(evaValue) IS_OBJECT_TYPE(evaValue, ObjectType::CLASS)
 #define IS_INSTANCE(evaValue) IS_OBJECT_TYPE(evaValue, ObjectType::INSTANCE)
+#define IS_SHAPED(evaValue) (IS_INSTANCE(evaValue) || IS_CLASS(evaValue))
+
+// Compares two values of the same type. The operator order
+// follows compareOps_ in EvaCompiler.h.
+template <typename T>
+bool compareAs(uint8_t op, const T &v1, const T &v2)
+{
+    switch (op)
+    {
+    case 0:
+        return v1 < v2;
+    case 1:
+        return v1 > v2;
+    case 2:
+        return v1 == v2;
+    case 3:
+        return v1 <= v2;
+    case 4:
+        return v1 >= v2;
+    case 5:
+        return v1 != v2;
+    default:
+        DIE << "Unknown comparison operator: " << (int)op << std::endl;
+        return false;
+    }
+}
+
+// Compares two numbers: as integers if both are,
+// otherwise as doubles
+inline bool compareNumbers(uint8_t op, const EvaValue &v1, const EvaValue &v2)
+{
+    if (IS_INTEGER(v1) && IS_INTEGER(v2))
+        return compareAs(op, AS_INTEGER(v1), AS_INTEGER(v2));
+    return compareAs(op, AS_NUMBER(v1), AS_NUMBER(v2));
+}
+
+// Arithmetic on two numbers (op is one of + - * /). Integers stay
+// integers unless the result overflows an integer value, then, as
+// when mixed with doubles, they are promoted to double. Division is
+// always on doubles.
+template <char op>
+EvaValue numberOp(const EvaValue &v1, const EvaValue &v2)
+{
+    if (op != '/' && IS_INTEGER(v1) && IS_INTEGER(v2))
+    {
+        auto a = AS_INTEGER(v1);
+        auto b = AS_INTEGER(v2);
+        int64_t result;
+        auto overflow = op == '+'   ? __builtin_add_overflow(a, b, &result)
+                        : op == '-' ? __builtin_sub_overflow(a, b, &result)
+                                    : __builtin_mul_overflow(a, b, &result);
+        if (!overflow && result >= INTEGER_MIN && result <= INTEGER_MAX)
+            return INTEGER(result);
+    }
+
+    auto a = AS_NUMBER(v1);
+    auto b = AS_NUMBER(v2);
+    return NUMBER(op == '+' ? a + b : op == '-' ? a - b : op == '*' ? a * b : a / b);
+}
 
 // Output stream
 std::string evaValueToTypeString(const EvaValue &evaValue)
 {
-    if (IS_NUMBER(evaValue))
+    if (IS_DOUBLE(evaValue))
     {
         return "NUMBER";
     }
+    else if (IS_INTEGER(evaValue))
+    {
+        return "INTEGER";
+    }
     else if (IS_BOOLEAN(evaValue))
     {
         return "BOOLEAN";
@@ -348,7 +860,7 @@ std::string evaValueToTypeString(const EvaValue &evaValue)
     }
     else
     {
-        DIE << "evaValueToTypeString: unknown type " << (int)evaValue.type;
+        DIE << "evaValueToTypeString: unknown value type";
         return "";
     }
 }
@@ -356,13 +868,17 @@ std::string evaValueToTypeString(const EvaValue &evaValue)
 std::string evaValueToConstantString(const EvaValue &evaValue)
 {
     std::stringstream ss;
-    if (IS_NUMBER(evaValue))
+    if (IS_INTEGER(evaValue))
+    {
+        ss << AS_INTEGER(evaValue);
+    }
+    else if (IS_DOUBLE(evaValue))
     {
-        ss << evaValue.number;
+        ss << AS_NUMBER(evaValue);
     }
     else if (IS_BOOLEAN(evaValue))
     {
-        ss << (evaValue.boolean ? "true" : "false");
+        ss << (AS_BOOLEAN(evaValue) ? "true" : "false");
     }
     else if (IS_STRING(evaValue))
     {
@@ -400,7 +916,7 @@ std::string evaValueToConstantString(const EvaValue &evaValue)
     }
     else
     {
-        DIE << "evaValueToConstantString: unknown type " << (int)evaValue.type;
+        DIE << "evaValueToConstantString: unknown value type";
     }
     return ss.str();
 }
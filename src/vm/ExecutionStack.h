@@ -0,0 +1,103 @@
+// Eva VM execution stack: operand stack slots and call frames.
+
+#ifndef ExecutionStack_h
+#define ExecutionStack_h
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <type_traits>
+
+#include "src/vm/EvaValue.h"
+#include "src/vm/Logger.h"
+
+// Memory is committed in chunks of this many bytes
+#define STACK_COMMIT_BYTES (64 * 1024)
+
+// Stack frame for function calls.
+struct Frame
+{
+    uint8_t *ra;        // Return address
+    EvaValue *bp;       // Base pointer (stack frame)
+    FunctionObject *fn; // Currently running function/code object/block
+};
+
+// Array of up to `capacity` elements, reserved as one contiguous range
+// of address space and committed as it grows, so growing never moves
+// the elements (the VM keeps raw pointers into it).
+template <typename T>
+class ReservedArray
+{
+    static_assert(std::is_trivially_copyable<T>::value, "ReservedArray elements are raw memory");
+
+public:
+    explicit ReservedArray(size_t capacity) : capacity_(capacity)
+    {
+        reservedBytes_ = roundToPages(capacity * sizeof(T));
+        auto memory = mmap(nullptr, reservedBytes_, PROT_NONE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (memory == MAP_FAILED)
+            DIE << "ReservedArray: can't reserve " << reservedBytes_ << " bytes";
+        data_ = (T *)memory;
+        committedEnd_ = data_;
+        commit(data_ + 1);
+    }
+
+    ~ReservedArray() { munmap(data_, reservedBytes_); }
+
+    ReservedArray(const ReservedArray &) = delete;
+    ReservedArray &operator=(const ReservedArray &) = delete;
+
+    T *begin() const { return data_; }
+
+    // End of the usable (committed) elements
+    T *end() const { return committedEnd_; }
+
+    size_t capacity() const { return capacity_; }
+
+    // Makes the elements before `last` usable. Returns false if
+    // that's past the capacity.
+    bool commit(T *last)
+    {
+        if (last <= committedEnd_)
+            return true;
+        if (last > data_ + capacity_)
+            return false;
+
+        auto neededBytes = (size_t)((uint8_t *)last - (uint8_t *)data_);
+        auto chunks = (neededBytes + STACK_COMMIT_BYTES - 1) / STACK_COMMIT_BYTES;
+        auto bytes = std::min(roundToPages(chunks * STACK_COMMIT_BYTES), reservedBytes_);
+
+        if (mprotect((uint8_t *)data_ + committedBytes_, bytes - committedBytes_, PROT_READ | PROT_WRITE) != 0)
+            DIE << "ReservedArray: can't commit " << bytes << " bytes";
+
+        committedBytes_ = bytes;
+        committedEnd_ = data_ + std::min(bytes / sizeof(T), capacity_);
+        return true;
+    }
+
+private:
+    static size_t roundToPages(size_t bytes)
+    {
+        static auto pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        return (bytes + pageSize - 1) / pageSize * pageSize;
+    }
+
+    T *data_;
+    T *committedEnd_;
+    size_t capacity_;
+    size_t reservedBytes_;
+    size_t committedBytes_ = 0;
+};
+
+// One VM-owned execution stack: the operand stack (locals and
+// temporaries of all frames) and the saved state of the callers.
+struct ExecutionStack
+{
+    ExecutionStack(size_t maxSlots, size_t maxFrames) : slots(maxSlots), frames(maxFrames) {}
+
+    ReservedArray<EvaValue> slots;
+    ReservedArray<Frame> frames;
+};
+
+#endif // ExecutionStack_h
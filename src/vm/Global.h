@@ -59,7 +59,7 @@ struct Global
     }
 
     // Adds a native function
-    void addNativeFunction(const std::string &name, std::function<void()> fn, size_t arity)
+    void addNativeFunction(const std::string &name, NativeFn fn, size_t arity)
     {
         if (exists(name))
         {
@@ -0,0 +1,104 @@
+// Eva preemption.
+// Fuel (an instruction budget, spent by loop back-edges and calls)
+// and deadlines, for hosts running many programs to time-slice them.
+
+#ifndef Preemption_h
+#define Preemption_h
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+// No limit on fuel
+#define FUEL_UNLIMITED INT64_MAX
+
+// Fuel between deadline checks
+#define DEADLINE_SLICE 10000
+
+// A program runs until it halts, runs out of fuel (suspended, it
+// can be resumed with more), or misses its deadline (timed out).
+enum class ExecStatus
+{
+    RUNNING,
+    DONE,
+    SUSPENDED,
+    TIMED_OUT,
+};
+
+inline const char *execStatusToString(ExecStatus status)
+{
+    switch (status)
+    {
+    case ExecStatus::RUNNING:
+        return "RUNNING";
+    case ExecStatus::DONE:
+        return "DONE";
+    case ExecStatus::SUSPENDED:
+        return "SUSPENDED";
+    default:
+        return "TIMED_OUT";
+    }
+}
+
+// Back-edges and calls spend a unit of `fuel`, which is all the
+// interpreter and the JITs check. When it's spent, preempt() refills
+// it from the budget left, checking the deadline in between: with
+// one, fuel is handed out DEADLINE_SLICE units at a time. Unlimited,
+// it's never spent, so the check costs a decrement and a branch.
+class Preemption
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Allows `units` more back-edges and calls
+    void setFuel(int64_t units)
+    {
+        reserve_ = units;
+        refill();
+    }
+
+    // Times out the program once past `deadline`
+    void setDeadline(Clock::time_point deadline)
+    {
+        deadline_ = deadline;
+        setFuel(fuelLeft());
+    }
+
+    void clearDeadline() { setDeadline(Clock::time_point::max()); }
+
+    int64_t fuelLeft() const
+    {
+        return reserve_ == FUEL_UNLIMITED ? FUEL_UNLIMITED : reserve_ + std::max<int64_t>(fuel, 0);
+    }
+
+    // Called once fuel is spent: refills it and keeps RUNNING,
+    // or says why the program has to stop
+    ExecStatus preempt()
+    {
+        if (deadline_ != Clock::time_point::max() && Clock::now() >= deadline_)
+            return ExecStatus::TIMED_OUT;
+        if (reserve_ == 0)
+            return ExecStatus::SUSPENDED;
+        refill();
+        return ExecStatus::RUNNING;
+    }
+
+    // Units until the next preempt()
+    int64_t fuel = FUEL_UNLIMITED;
+
+private:
+    void refill()
+    {
+        auto slice = deadline_ == Clock::time_point::max() ? FUEL_UNLIMITED : DEADLINE_SLICE;
+        fuel = std::min<int64_t>(reserve_, slice);
+        if (reserve_ != FUEL_UNLIMITED)
+            reserve_ -= fuel;
+    }
+
+    // Fuel not handed out yet
+    int64_t reserve_ = FUEL_UNLIMITED;
+
+    Clock::time_point deadline_ = Clock::time_point::max();
+};
+
+#endif // Preemption_h
@@ -0,0 +1,55 @@
+// Symbol table (string interning)
+
+#ifndef SymbolTable_h
+#define SymbolTable_h
+
+#include <set>
+#include <string_view>
+#include <unordered_map>
+
+#include "src/vm/EvaValue.h"
+
+// Interns strings: there's only one symbol (StringObject) per distinct
+// content, with its hash precomputed, so interned strings compare
+// by pointer. Symbols live as long as the VM.
+struct SymbolTable
+{
+    // Returns the canonical symbol for a string
+    StringObject *intern(const std::string &str)
+    {
+        auto it = symbols.find(str);
+        if (it != symbols.end())
+        {
+            return it->second;
+        }
+
+        auto symbol = StringObject::create(str);
+        symbol->interned = true;
+        symbol->hashCode();
+
+        // Keyed by a view of the symbol's own storage
+        symbols.emplace(symbol->str(), symbol);
+        return symbol;
+    }
+
+    // Same, as an Eva value
+    EvaValue internValue(const std::string &str)
+    {
+        return OBJECT((Object *)intern(str));
+    }
+
+    // All symbols (GC roots)
+    std::set<Traceable *> getObjects()
+    {
+        std::set<Traceable *> objects;
+        for (const auto &symbol : symbols)
+        {
+            objects.insert((Traceable *)symbol.second);
+        }
+        return objects;
+    }
+
+    std::unordered_map<std::string_view, StringObject *> symbols;
+};
+
+#endif // SymbolTable_h
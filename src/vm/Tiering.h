@@ -0,0 +1,155 @@
+// Eva tiering.
+// Counts how hot code objects are and moves them up the tiers once
+// they cross the thresholds, recording the transitions.
+
+#ifndef Tiering_h
+#define Tiering_h
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "src/jit/BaselineJIT.h"
+#include "src/vm/EvaValue.h"
+
+// Calls or loop back-edges before a code object's
+// instructions are quickened
+#define QUICKEN_THRESHOLD 1
+
+// Loop back-edges before a function is compiled and
+// entered from the loop (on-stack replacement)
+#define OSR_THRESHOLD 1000
+
+// Hotness thresholds: a code object moves up a tier once
+// it was called, or looped, more times than these
+struct TierThresholds
+{
+    size_t quicken = QUICKEN_THRESHOLD;
+    size_t jitCalls = JIT_THRESHOLD;
+    size_t osrBackEdges = OSR_THRESHOLD;
+};
+
+// What made a code object move up: calls, or a loop. A loop
+// moving it to the JIT tier enters the machine code from the
+// interpreted frame that's looping (on-stack replacement).
+enum class TierTrigger
+{
+    CALLS,
+    BACK_EDGES,
+};
+
+struct TierTransition
+{
+    std::string name;
+    CodeTier from;
+    CodeTier to;
+    TierTrigger trigger;
+    size_t calls;
+    size_t backEdges;
+};
+
+// Tier transitions so far, to tune the thresholds with
+struct TierStats
+{
+    std::vector<TierTransition> transitions;
+
+    // Interpreted frames that entered machine code at a back-edge
+    size_t osrEntries = 0;
+
+    // Called on every transition, e.g. to log it
+    std::function<void(const TierTransition &)> onTransition;
+
+    // Transitions to `tier`
+    size_t count(CodeTier tier) const
+    {
+        size_t count = 0;
+        for (auto &transition : transitions)
+            count += transition.to == tier;
+        return count;
+    }
+};
+
+inline const char *tierToString(CodeTier tier)
+{
+    switch (tier)
+    {
+    case CodeTier::GENERIC:
+        return "GENERIC";
+    case CodeTier::QUICKENED:
+        return "QUICKENED";
+    default:
+        return "JIT";
+    }
+}
+
+// e.g. "fib: QUICKENED -> JIT (101 calls, 0 back-edges)"
+inline std::ostream &operator<<(std::ostream &os, const TierTransition &transition)
+{
+    return os << std::dec << transition.name << ": " << tierToString(transition.from) << " -> "
+              << tierToString(transition.to) << " (" << transition.calls << " calls, "
+              << transition.backEdges << " back-edges)";
+}
+
+// Code starts GENERIC, running the bytecode as compiled. QUICKENED
+// code has its instructions rewritten to type-specialized variants as
+// they run (see QUICKEN in EvaVM.h). JIT code runs as baseline machine
+// code, for verified code with the JIT enabled; calls enter it from
+// the start, a hot loop from the interpreted frame running it. Code
+// goes straight to the highest tier its counts reach.
+// Only the stack tier counts: register code runs as it's lowered.
+class TieringManager
+{
+public:
+    // Counts a call to `co`. `jit` is null when
+    // it can't be compiled (unverified code).
+    void countCall(CodeObject *co, BaselineJIT *jit)
+    {
+        co->callCount++;
+        if (co->tier != CodeTier::JIT)
+            promote(co, jit, TierTrigger::CALLS);
+    }
+
+    // Counts a loop back-edge in `co`
+    void countBackEdge(CodeObject *co, BaselineJIT *jit)
+    {
+        co->backEdges++;
+        if (co->tier != CodeTier::JIT)
+            promote(co, jit, TierTrigger::BACK_EDGES);
+    }
+
+    TierThresholds thresholds;
+    TierStats stats;
+
+private:
+    // Moves `co` to the highest tier its counts reach
+    void promote(CodeObject *co, BaselineJIT *jit, TierTrigger trigger)
+    {
+        if (jit != nullptr && !co->jitFailed &&
+            (co->callCount > thresholds.jitCalls || co->backEdges > thresholds.osrBackEdges))
+        {
+            if (jit->compile(co))
+            {
+                transition(co, CodeTier::JIT, trigger);
+                return;
+            }
+            co->jitFailed = true;
+        }
+
+        if (co->tier == CodeTier::GENERIC &&
+            (co->callCount > thresholds.quicken || co->backEdges > thresholds.quicken))
+        {
+            transition(co, CodeTier::QUICKENED, trigger);
+        }
+    }
+
+    void transition(CodeObject *co, CodeTier to, TierTrigger trigger)
+    {
+        stats.transitions.push_back({co->name, co->tier, to, trigger, co->callCount, co->backEdges});
+        co->tier = to;
+        if (stats.onTransition)
+            stats.onTransition(stats.transitions.back());
+    }
+};
+
+#endif // Tiering_h
@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+// Runs a program interpreted and with every function compiled
+// on its first call, checks they agree. Objects the result
+// points to are freed with the VMs: read numbers and booleans
+EvaValue execWithJit(const std::string &program)
+{
+    EvaVM interpreted;
+    auto expected = interpreted.exec(program);
+
+    // Copied out before the other VM runs: its collections can free it
+    auto isNumber = IS_NUMBER(expected), isString = IS_STRING(expected);
+    auto isBoolean = IS_BOOLEAN(expected);
+    auto isInteger = isNumber && IS_INTEGER(expected);
+    auto expectedNumber = isNumber ? AS_NUMBER(expected) : 0;
+    auto expectedString = isString ? AS_CPPSTRING(expected) : "";
+    auto expectedBoolean = isBoolean && AS_BOOLEAN(expected);
+
+    EvaVM vm;
+    vm.enableJit(0);
+    auto result = vm.exec(program);
+    EXPECT_GT(vm.jit->compiledCount, 0);
+
+    if (isNumber)
+    {
+        EXPECT_EQ(AS_NUMBER(result), expectedNumber);
+        EXPECT_EQ(IS_INTEGER(result), isInteger);
+    }
+    else if (isString)
+        EXPECT_EQ(AS_CPPSTRING(result), expectedString);
+    else if (isBoolean)
+        EXPECT_EQ(AS_BOOLEAN(result), expectedBoolean);
+
+    return result;
+}
+
+TEST(BaselineJIT, HotFunctionIsCompiled)
+{
+    if (!EVA_JIT)
+        GTEST_SKIP() << "no JIT on this platform";
+
+    EvaVM vm;
+    vm.enableJit(10);
+
+    auto result = vm.exec(R"(
+        (def fib (n)
+            (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+        (fib 20)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 6765);
+
+    auto fib = AS_FUNCTION(vm.global->get(vm.global->getGlobalIndex("fib")).value);
+    EXPECT_NE(fib->co->jitCode, nullptr);
+    EXPECT_EQ(vm.jit->compiledCount, 1);
+
+    // Main runs once, it stays interpreted
+    EXPECT_EQ(vm.compiler->getMainFunction()->co->jitCode, nullptr);
+}
+
+TEST(BaselineJIT, MixedValues)
+{
+    if (!EVA_JIT)
+        GTEST_SKIP() << "no JIT on this platform";
+
+    auto result = execWithJit(R"(
+        (def pick (a b) (if (>= a b) (== a b) (!= a b)))
+        (def concat (a b) (+ a b))
+        (def counter ()
+            (begin
+                (var n 0)
+                (lambda () (set n (+ n 1)))))
+        (class Point null
+            (def constructor (self x y)
+                (begin
+                    (set (prop self x) x)
+                    (set (prop self y) y)))
+            (def sum (self) (+ (prop self x) (prop self y))))
+        (def loop (n)
+            (begin
+                (var i 0)
+                (var total 0)
+                (while (< i n)
+                    (begin
+                        (set total (+ total (* i (/ 10 5))))
+                        (set i (+ i 1))))
+                total))
+        (var next (counter))
+        (next)
+        (next)
+        (var p (new Point 3 4))
+        (if (pick 1 2)
+            (+ (+ (loop 10) ((prop p sum) p)) (next))
+            0)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 100);
+
+    result = execWithJit(R"(
+        (def concat (a b) (+ a b))
+        (def less (a b) (< a b))
+        (== (if (less "a" "b") (concat "x" (concat "y" "z")) "wrong") "xyz")
+    )");
+    EXPECT_TRUE(AS_BOOLEAN(result));
+}
+
+TEST(BaselineJIT, GarbageCollection)
+{
+    if (!EVA_JIT)
+        GTEST_SKIP() << "no JIT on this platform";
+
+    // Strings allocated from machine code collect
+    // while other ones are live on the stack
+    auto result = execWithJit(R"(
+        (def build (n)
+            (begin
+                (var s "")
+                (var i 0)
+                (while (< i n)
+                    (begin
+                        (set s (+ s "x"))
+                        (set i (+ i 1))))
+                s))
+        (== (build 200) ")" + std::string(200, 'x') + R"(")
+    )");
+    EXPECT_TRUE(AS_BOOLEAN(result));
+}
+
+TEST(BaselineJIT, UnsupportedCodeStaysInterpreted)
+{
+    if (!EVA_JIT)
+        GTEST_SKIP() << "no JIT on this platform";
+
+    // Over 256 constants: OP_WIDE, which has no template
+    std::string sum = "x";
+    for (auto i = 1; i <= 300; i++)
+        sum = "(+ " + sum + " " + std::to_string(i) + ")";
+
+    EvaVM vm;
+    vm.enableJit(0);
+    auto result = vm.exec("(def big (x) " + sum + ") (big 0)");
+    EXPECT_EQ(AS_NUMBER(result), 45150);
+
+    auto big = AS_FUNCTION(vm.global->get(vm.global->getGlobalIndex("big")).value);
+    EXPECT_EQ(big->co->jitCode, nullptr);
+    EXPECT_TRUE(big->co->jitFailed);
+}
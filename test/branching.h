@@ -9,7 +9,7 @@ TEST(Branching, BasicIf)
         (if (< 2 3) 1 2)
     )");
     log(result);
-    EXPECT_EQ(result.number, 1);
+    EXPECT_EQ(AS_NUMBER(result), 1);
 }
 
 TEST(Branching, BasicIf2)
@@ -20,7 +20,7 @@ TEST(Branching, BasicIf2)
         (if (> 2 3) 1 2)
     )");
     log(result);
-    EXPECT_EQ(result.number, 2);
+    EXPECT_EQ(AS_NUMBER(result), 2);
 }
 
 TEST(Branching, WhileLoop)
@@ -39,7 +39,7 @@ TEST(Branching, WhileLoop)
 
     )");
     log(result);
-    EXPECT_EQ(result.number, 10);
+    EXPECT_EQ(AS_NUMBER(result), 10);
 }
 
 TEST(Branching, ForLoop)
@@ -54,5 +54,38 @@ TEST(Branching, ForLoop)
         count
     )");
     log(result);
-    EXPECT_EQ(result.number, 10);
+    EXPECT_EQ(AS_NUMBER(result), 10);
+}
+
+TEST(Branching, LongWhileLoop)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (var i 0)
+        (var count 0)
+
+        (while (< i 10000)
+            (begin
+                (set i (+ i 1))
+                (set count (+ count 2))))
+        count
+    )");
+    log(result);
+    EXPECT_EQ(AS_NUMBER(result), 20000);
+}
+
+TEST(Branching, LongForLoop)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (var count 0)
+        (for (var i 0) (< i 10000) (set i (+ i 1))
+            (begin
+                (set count (+ count 1))))
+        count
+    )");
+    log(result);
+    EXPECT_EQ(AS_NUMBER(result), 10000);
 }
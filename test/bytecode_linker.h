@@ -0,0 +1,33 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+TEST(BytecodeLinker, OperandsArePointers)
+{
+    CodeObject co("main", 0);
+    co.constants = {NUMBER(1), NUMBER(2)};
+    co.code = {OP_CONST, 1,        // 0
+               OP_SET_GLOBAL, 0,   // 2
+               OP_JMP, 0, 8,       // 4
+               OP_POP,             // 7
+               OP_GET_GLOBAL, 0,   // 8
+               OP_HALT};           // 10
+    std::vector<GlobalVar> globals = {{"x", NUMBER(0)}};
+
+    BytecodeVerifier verifier;
+    ASSERT_TRUE(verifier.verify(&co, 0, globals.size()));
+    BytecodeLinker().link(&co, globals);
+
+    auto at = [&](size_t offset)
+    { return &co.linked[co.linkedAt[offset]]; };
+
+    EXPECT_EQ(*at(0), OP_CONST);
+    EXPECT_EQ(loadPointer<EvaValue>(at(0) + 1), &co.constants[1]);
+    EXPECT_EQ(loadPointer<EvaValue>(at(2) + 1), &globals[0].value);
+    EXPECT_EQ(loadPointer<EvaValue>(at(8) + 1), &globals[0].value);
+    EXPECT_EQ(loadPointer<uint8_t>(at(4) + 1), at(8));
+    EXPECT_EQ(*at(7), OP_POP);
+    EXPECT_EQ(*at(10), OP_HALT);
+
+    for (auto offset : {0, 2, 4, 7, 8, 10})
+        EXPECT_EQ(co.toCode(co.toLinked(&co.code[offset])), &co.code[offset]);
+}
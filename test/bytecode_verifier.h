@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+TEST(BytecodeVerifier, CompiledCodeIsVerified)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (def fib (n)
+            (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+        (class Point null
+            (def constructor (self x) (set (prop self x) x))
+            (def getX (self) (prop self x)))
+        (var p (new Point 4))
+        (+ (fib 10) ((prop p getX) p))
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 59);
+
+    auto main = vm.compiler->getMainFunction()->co;
+    EXPECT_TRUE(main->verified);
+
+    auto fib = AS_FUNCTION(vm.global->get(vm.global->getGlobalIndex("fib")).value);
+    EXPECT_TRUE(fib->co->verified);
+
+    // fib, n, then (fib (- n 1)) with fib, n and 2 on top
+    EXPECT_EQ(fib->co->maxStack, 6);
+}
+
+TEST(BytecodeVerifier, MaxStack)
+{
+    CodeObject co("main", 0);
+    co.constants = {NUMBER(1), NUMBER(2)};
+    co.code = {OP_CONST, 0, OP_CONST, 1, OP_CONST, 0, OP_ADD, OP_ADD, OP_HALT};
+
+    BytecodeVerifier verifier;
+    EXPECT_TRUE(verifier.verify(&co, 0, 0));
+    EXPECT_EQ(co.maxStack, 3);
+}
+
+TEST(BytecodeVerifier, RejectsMalformedCode)
+{
+    BytecodeVerifier verifier;
+
+    auto rejects = [&](std::vector<uint8_t> code, size_t depth = 0)
+    {
+        CodeObject co("main", 0);
+        co.constants = {NUMBER(1), BOOLEAN(true)};
+        co.code = code;
+        return !verifier.verify(&co, depth, 0) && !co.verified;
+    };
+
+    // Stack underflow
+    EXPECT_TRUE(rejects({OP_CONST, 0, OP_ADD, OP_HALT}));
+
+    // Constant and local indices out of range
+    EXPECT_TRUE(rejects({OP_CONST, 2, OP_HALT}));
+    EXPECT_TRUE(rejects({OP_GET_LOCAL, 1, OP_HALT}, 1));
+
+    // Jump into the middle of an instruction, and past the end
+    EXPECT_TRUE(rejects({OP_CONST, 1, OP_JMP_IF_FALSE, 0, 1, OP_CONST, 0, OP_HALT}));
+    EXPECT_TRUE(rejects({OP_JMP, 0, 9}));
+
+    // Branches leaving different stack depths at the merge point
+    EXPECT_TRUE(rejects({OP_CONST, 1, OP_JMP_IF_FALSE, 0, 9,
+                         OP_CONST, 0, OP_CONST, 0,
+                         OP_CONST, 0, OP_HALT}));
+
+    // Running off the end of the code
+    EXPECT_TRUE(rejects({OP_CONST, 0}));
+
+    // Unknown opcode
+    EXPECT_TRUE(rejects({0xFE, OP_HALT}));
+}
+
+TEST(BytecodeVerifier, UncheckedCallsCheckFrames)
+{
+    EvaVM vm;
+
+    // Recursion still runs out of stack, caught once per frame
+    EXPECT_DEATH(vm.exec(R"(
+        (def down (n) (+ 1 (down n)))
+        (down 1)
+    )"),
+                 "overflow");
+}
+
+TEST(BytecodeVerifier, UncheckedAddOfMixedTypes)
+{
+    // Verified code counts on + leaving a value: a number
+    // and a string stop the VM instead
+    auto program = R"(
+        (def add (a b) (+ a b))
+        (var x (add 1 "a"))
+        x
+    )";
+
+    for (auto tier : {ExecutionTier::STACK, ExecutionTier::REGISTER})
+    {
+        EvaVM vm(tier);
+        EXPECT_DEATH(vm.exec(program), "invalid operands for \\+");
+    }
+}
@@ -18,7 +18,7 @@ TEST(Classes, BasicClass)
         (var p (new Point 10 20))
         ((prop p calc) p)
     )");
-    EXPECT_EQ(result.number, 30);
+    EXPECT_EQ(AS_NUMBER(result), 30);
 }
 
 TEST(Classes, NoSelfInConstructor)
@@ -38,7 +38,7 @@ TEST(Classes, NoSelfInConstructor)
         (var p (new Point 10 20))
         ((prop p calc) p) // 3
     )");
-    EXPECT_EQ(result.number, 30);
+    EXPECT_EQ(AS_NUMBER(result), 30);
 }
 
 TEST(Classes, Inheritance)
@@ -67,5 +67,5 @@ TEST(Classes, Inheritance)
         (var p (new Point3D 10 20 30))
         ((prop p calc) p) // 60
     )");
-    EXPECT_EQ(result.number, 60);
+    EXPECT_EQ(AS_NUMBER(result), 60);
 }
\ No newline at end of file
@@ -22,7 +22,7 @@ TEST(Closures, CellVars)
                 (bar)))
     )");
     log(result);
-    EXPECT_EQ(result.number, 1200);
+    EXPECT_EQ(AS_NUMBER(result), 1200);
 }
 
 // This test segfaults.
@@ -41,5 +41,80 @@ TEST(Closures, MoreClosures)
         (fn1)
     )");
     log(result);
-    EXPECT_EQ(result.number, 2);
-}
\ No newline at end of file
+    EXPECT_EQ(AS_NUMBER(result), 2);
+}
+
+TEST(Closures, CapturedParameters)
+{
+    // Each cell gets its own value, whatever the order
+    auto program = R"(
+        (def f (b a) (lambda () (- a b)))
+        (def g (a b c) (lambda () (+ (* a 100) (+ (* b 10) c))))
+        (+ ((f 1 4)) ((g 1 2 3)))
+    )";
+
+    for (auto tier : {ExecutionTier::STACK, ExecutionTier::REGISTER})
+    {
+        EvaVM vm(tier);
+        EXPECT_EQ(AS_NUMBER(vm.exec(program)), 126);
+    }
+}
+
+TEST(Closures, CallsFromBlocks)
+{
+    // A parameter and the function itself, called from a block
+    // and an immediately invoked lambda
+    EvaVM vm;
+    auto result = vm.exec(R"(
+        (def apply (f n)
+            (begin
+                (var x n)
+                (if (== n 0)
+                    (f 0)
+                    ((lambda (y) (+ (f y) (apply f (- y 1)))) x))))
+        (apply (lambda (n) n) 4)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 10);
+}
+
+TEST(Closures, CellsAreInline)
+{
+    EvaVM vm;
+    auto result = vm.exec(R"(
+        (def make (a b)
+            (lambda () (+ a b)))
+        (var add (make 1 2))
+        add
+    )");
+
+    // One cell per captured variable, after the header
+    auto add = AS_FUNCTION(result);
+    ASSERT_EQ(add->cellCount, 2);
+    EXPECT_EQ(AS_NUMBER(add->cells()[0]->value), 1);
+    EXPECT_EQ(AS_NUMBER(add->cells()[1]->value), 2);
+}
+
+TEST(Closures, CellsSetOutOfOrder)
+{
+    // `a`'s cell isn't made when the branch is skipped
+    auto program = R"(
+        (def pick (x)
+            (begin
+                (if (> x 0)
+                    (begin
+                        (var a 1)
+                        (def fa () a)
+                        (set x (fa)))
+                    (set x 0))
+                (var b 2)
+                (def fb () b)
+                (+ x (fb))))
+        (+ (pick 0) (* 10 (pick 5)))
+    )";
+
+    for (auto tier : {ExecutionTier::STACK, ExecutionTier::REGISTER})
+    {
+        EvaVM vm(tier);
+        EXPECT_EQ(AS_NUMBER(vm.exec(program)), 32);
+    }
+}
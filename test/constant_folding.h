@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+// Type and value of a result, copied out of the VM
+std::string describe(const EvaValue &value)
+{
+    auto type = evaValueToTypeString(value);
+    if (IS_STRING(value))
+        return type + " " + AS_CPPSTRING(value);
+    if (IS_BOOLEAN(value))
+        return type + " " + std::to_string(AS_BOOLEAN(value));
+    if (IS_INTEGER(value))
+        return type + " " + std::to_string(AS_INTEGER(value));
+
+    // Doubles by their bits: -0 isn't 0
+    auto number = AS_NUMBER(value);
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(double));
+    return type + " " + std::to_string(bits);
+}
+
+TEST(ConstantFolding, ConstantsAreComputed)
+{
+    EvaVM vm;
+    auto result = vm.exec(R"(
+        (def f () (* (+ 2 3) (- 10 4)))
+        (f)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 30);
+
+    // A single constant
+    auto f = globalCode(vm, "f");
+    ASSERT_EQ(f->constants.size(), 1);
+    EXPECT_EQ(AS_INTEGER(f->constants[0]), 30);
+    EXPECT_FALSE(hasOpcode(f, OP_ADD));
+    EXPECT_FALSE(hasOpcode(f, OP_MUL));
+}
+
+TEST(ConstantFolding, SameValuesAsAtRuntime)
+{
+    // Overflow, division, strings, comparisons of any types
+    std::vector<std::pair<std::string, std::string>> operations = {
+        {"+", "1 2"},
+        {"-", "5 8"},
+        {"*", "3 7"},
+        {"*", "140737488355327 140737488355327"},
+        {"/", "7 2"},
+        {"/", "1 0"},
+        {"/", "0 (- 0 1)"},
+        {"+", "\"ab\" \"cd\""},
+        {"<", "1 2"},
+        {">=", "(/ 1 2) 1"},
+        {"==", "\"a\" \"a\""},
+        {"<", "\"b\" \"a\""},
+        {"==", "1 \"1\""},
+        {"!=", "1 \"1\""},
+        {"<", "1 \"1\""},
+        {"!=", "(< 1 2) (< 1 2)"},
+        {"==", "(< 1 2) (< 2 1)"},
+        {"!=", "(< 1 2) (< 2 1)"},
+        {">", "(< 1 2) (< 2 1)"},
+    };
+
+    for (auto &[op, operands] : operations)
+    {
+        std::string folded, computed;
+        {
+            EvaVM vm;
+            folded = describe(vm.exec("(" + op + " " + operands + ")"));
+        }
+        {
+            EvaVM vm;
+            computed = describe(vm.exec("(def f (a b) (" + op + " a b)) (f " + operands + ")"));
+        }
+        EXPECT_EQ(folded, computed) << "(" << op << " " << operands << ")";
+    }
+}
+
+TEST(ConstantFolding, DifferentTypesAreUnequal)
+{
+    EvaVM vm;
+    auto result = vm.exec(R"(
+        (def f () (!= 1 "a"))
+        (f)
+    )");
+    EXPECT_TRUE(AS_BOOLEAN(result));
+
+    auto f = globalCode(vm, "f");
+    EXPECT_FALSE(hasOpcode(f, OP_COMPARE));
+}
+
+TEST(ConstantFolding, IdentitiesOnNumbers)
+{
+    EvaVM vm;
+    auto result = vm.exec(R"(
+        (def dec (x) (* (- x 1) 1))
+        (def half (x) (/ (/ x 2) 1))
+        (def same (x) (* x 1))
+        (def plusZero (x) (+ (- x 1) 0))
+        (+ (dec 5) (+ (half 5) (+ (same 2) (plusZero 2))))
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 9.5);
+
+    auto dec = globalCode(vm, "dec");
+    EXPECT_TRUE(hasOpcode(dec, OP_SUB));
+    EXPECT_FALSE(hasOpcode(dec, OP_MUL));
+
+    // x may not be a number, -0 + 0 is 0
+    EXPECT_TRUE(hasOpcode(globalCode(vm, "same"), OP_MUL));
+    EXPECT_TRUE(hasOpcode(globalCode(vm, "plusZero"), OP_ADD));
+}
+
+TEST(ConstantFolding, ConstantTestsPickABranch)
+{
+    auto program = R"(
+        (def f (x)
+            (if (> 1 2)
+                (undefined x)
+                (if (== "on" "on") (+ x 1) 0)))
+        (f 41)
+    )";
+
+    for (auto tier : {ExecutionTier::STACK, ExecutionTier::REGISTER})
+    {
+        EvaVM vm(tier);
+        EXPECT_EQ(AS_NUMBER(vm.exec(program)), 42);
+
+        auto f = globalCode(vm, "f");
+        EXPECT_FALSE(hasOpcode(f, OP_JMP));
+        EXPECT_FALSE(hasOpcode(f, OP_JMP_IF_FALSE));
+        EXPECT_FALSE(hasOpcode(f, OP_CALL));
+    }
+}
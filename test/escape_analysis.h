@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+// Code object of the first closure `co` makes
+CodeObject *closureCode(CodeObject *co)
+{
+    for (auto &constant : co->constants)
+        if (IS_CODE(constant))
+            return AS_CODE(constant);
+    return nullptr;
+}
+
+// Objects of `type` on the heap
+size_t heapObjects(ObjectType type)
+{
+    size_t count = 0;
+    for (auto object : Traceable::objects)
+        count += ((Object *)object)->type == type;
+    return count;
+}
+
+TEST(EscapeAnalysis, ImmediatelyInvokedLambdaUsesTheFrame)
+{
+    EvaVM vm;
+    auto result = vm.exec(R"(
+        (def f (y) ((lambda (x) (+ x y)) 5))
+        (f 2)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 7);
+
+    // y stays a local of f
+    auto f = globalCode(vm, "f");
+    EXPECT_TRUE(f->cellNames.empty());
+    EXPECT_FALSE(hasOpcode(f, OP_LOAD_CELL));
+
+    auto lambda = closureCode(f);
+    ASSERT_NE(lambda, nullptr);
+    // By f's slot: y is its first parameter
+    EXPECT_EQ(lambda->outerNames, std::vector<std::string>({"", "y"}));
+    EXPECT_TRUE(hasOpcode(lambda, OP_GET_OUTER));
+}
+
+TEST(EscapeAnalysis, ImmediatelyInvokedLambdasDoNotAllocate)
+{
+    auto program = [](int n)
+    {
+        return R"(
+            (def sum (n)
+                (begin
+                    (var total 0)
+                    (var i 0)
+                    (while (< i n)
+                        (begin
+                            ((lambda (k) (set total (+ total k))) i)
+                            (set i (+ i 1))))
+                    total))
+            (var k 0)
+            (var result 0)
+            (while (< k )" + std::to_string(n) + R"()
+                (begin
+                    (set result (sum 10))
+                    (set k (+ k 1))))
+            result
+        )";
+    };
+
+    EXPECT_EQ(AS_NUMBER(execOnBothTiers(program(1))), 45);
+
+    // Functions and cells on the heap after 1 and 1000 runs
+    auto allocated = [&](int n)
+    {
+        EvaVM vm;
+        auto result = vm.exec(program(n));
+        EXPECT_EQ(AS_NUMBER(result), 45);
+
+        auto sum = globalCode(vm, "sum");
+        EXPECT_TRUE(sum->cellNames.empty());
+        EXPECT_TRUE(hasOpcode(closureCode(sum), OP_SET_OUTER));
+        EXPECT_EQ(heapObjects(ObjectType::CELL), 0);
+        return heapObjects(ObjectType::FUNCTION);
+    };
+    EXPECT_EQ(allocated(1), allocated(1000));
+}
+
+TEST(EscapeAnalysis, CallbacksAreLateBound)
+{
+    // A lambda passed to a function may be kept by it,
+    // and the function redefined by a later program
+    EvaVM vm;
+    vm.exec(R"(
+        (def apply (f) (f))
+        (def run ()
+            (begin
+                (var x 1)
+                (apply (lambda () x))))
+    )");
+    EXPECT_EQ(AS_NUMBER(vm.exec("(run)")), 1);
+
+    vm.exec(R"(
+        (var kept 0)
+        (def apply (f) (begin (set kept f) 2))
+    )");
+    EXPECT_EQ(AS_NUMBER(vm.exec("(run)")), 2);
+    EXPECT_EQ(AS_NUMBER(vm.exec("(kept)")), 1);
+}
+
+TEST(EscapeAnalysis, EscapingLambdasUseCells)
+{
+    // Returned, kept by a function that returns its
+    // argument, and captured by a returned closure
+    auto result = execOnBothTiers(R"(
+        (def keep (f) f)
+        (def counter ()
+            (begin
+                (var value 0)
+                (def inc () (set value (+ value 1)))
+                inc))
+        (def kept (x) (keep (lambda () x)))
+        (def shared (x)
+            (begin
+                ((lambda () (set x (+ x 1))))
+                (lambda () x)))
+        (var c (counter))
+        (c)
+        (c)
+        (+ (c) (+ ((kept 10)) ((shared 20))))
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 34);
+}
+
+TEST(EscapeAnalysis, RecursionThroughImmediatelyInvokedLambdas)
+{
+    // Each `walk` frame makes the lambda again while
+    // the ones made below it are still running
+    auto result = execOnBothTiers(R"(
+        (def walk (n)
+            (begin
+                (var depth n)
+                (if (== n 0)
+                    0
+                    ((lambda (x) (+ depth (walk x))) (- n 1)))))
+        (walk 16)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 136);
+}
@@ -7,4 +7,25 @@
 #include "localvars.h"
 #include "functions.h"
 #include "closures.h"
-#include "classes.h"
\ No newline at end of file
+#include "classes.h"
+#include "quickening.h"
+#include "prop_caches.h"
+#include "shapes.h"
+#include "interning.h"
+#include "fused_branches.h"
+#include "register_tier.h"
+#include "wide_operands.h"
+#include "bytecode_verifier.h"
+#include "execution_stack.h"
+#include "tail_calls.h"
+#include "invoke.h"
+#include "baseline_jit.h"
+#include "trace_jit.h"
+#include "integers.h"
+#include "bytecode_linker.h"
+#include "tiering.h"
+#include "preemption.h"
+#include "ropes.h"
+#include "string_objects.h"
+#include "escape_analysis.h"
+#include "constant_folding.h"
\ No newline at end of file
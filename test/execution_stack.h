@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+TEST(ExecutionStack, DeepRecursion)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (def count (n)
+            (if (== n 0) 0 (+ 1 (count (- n 1)))))
+        (count 100000)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 100000);
+    EXPECT_EQ(vm.frameTop, vm.stack.frames.begin());
+}
+
+TEST(ExecutionStack, DeepRecursionRegisterTier)
+{
+    EvaVM vm(ExecutionTier::REGISTER);
+
+    auto result = vm.exec(R"(
+        (def count (n)
+            (if (== n 0) 0 (+ 1 (count (- n 1)))))
+        (count 100000)
+    )");
+    EXPECT_EQ(vm.activeTier, ExecutionTier::REGISTER);
+    EXPECT_EQ(AS_NUMBER(result), 100000);
+}
+
+TEST(ExecutionStack, GrowsWithoutMovingFrames)
+{
+    ReservedArray<EvaValue> slots(1 << 20);
+    auto begin = slots.begin();
+    auto committed = slots.end();
+
+    EXPECT_TRUE(slots.commit(begin + 200000));
+    EXPECT_EQ(slots.begin(), begin);
+    EXPECT_GT(slots.end(), committed);
+    EXPECT_GE(slots.end(), begin + 200000);
+
+    // Committed memory is usable, reservations have a hard limit
+    begin[199999] = NUMBER(42);
+    EXPECT_EQ(AS_NUMBER(begin[199999]), 42);
+    EXPECT_FALSE(slots.commit(begin + (1 << 20) + 1));
+}
+
+TEST(ExecutionStack, FramesLimit)
+{
+    EvaVM vm(ExecutionTier::STACK, 100);
+
+    EXPECT_DEATH(vm.exec(R"(
+        (def count (n)
+            (if (== n 0) 0 (+ 1 (count (- n 1)))))
+        (count 1000)
+    )"),
+                 "Call stack overflow");
+}
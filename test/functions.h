@@ -9,7 +9,7 @@ TEST(Functions, NativeFunctions)
         (square 2)
     )");
     log(result);
-    EXPECT_EQ(result.number, 4);
+    EXPECT_EQ(AS_NUMBER(result), 4);
 }
 
 TEST(Functions, NativeSum)
@@ -20,7 +20,7 @@ TEST(Functions, NativeSum)
         (sum 1 2)
     )");
     log(result);
-    EXPECT_EQ(result.number, 3);
+    EXPECT_EQ(AS_NUMBER(result), 3);
 }
 
 TEST(Functions, NativeSumWithVars)
@@ -32,7 +32,34 @@ TEST(Functions, NativeSumWithVars)
         (sum 2 x)
     )");
     log(result);
-    EXPECT_EQ(result.number, 5);
+    EXPECT_EQ(AS_NUMBER(result), 5);
+}
+
+// Natives are plain functions of the VM and their arguments
+EvaValue nativeMin(EvaVM &, NativeArgs args)
+{
+    return AS_NUMBER(args[0]) < AS_NUMBER(args[1]) ? args[0] : args[1];
+}
+
+TEST(Functions, NativeFunctionPointer)
+{
+    for (auto tier : {ExecutionTier::STACK, ExecutionTier::REGISTER})
+    {
+        EvaVM vm(tier);
+        vm.global->addNativeFunction("min", nativeMin, 2);
+
+        auto result = vm.exec(R"(
+            (def clamp (x) (min (sum x 1) 10))
+            (+ (clamp 3) (clamp 42))
+        )");
+        EXPECT_EQ(AS_NUMBER(result), 14);
+    }
+}
+
+TEST(Functions, NativeArityIsChecked)
+{
+    EvaVM vm;
+    EXPECT_DEATH(vm.exec("(sum 1)"), "sum expects 2 arguments");
 }
 
 TEST(Functions, UserDefFunc1)
@@ -45,7 +72,7 @@ TEST(Functions, UserDefFunc1)
         (mysquare 2)
     )");
     log(result);
-    EXPECT_EQ(result.number, 4);
+    EXPECT_EQ(AS_NUMBER(result), 4);
 }
 
 TEST(Functions, UserDefFunc2)
@@ -61,7 +88,7 @@ TEST(Functions, UserDefFunc2)
         (factorial 5)
     )");
     log(result);
-    EXPECT_EQ(result.number, 120);
+    EXPECT_EQ(AS_NUMBER(result), 120);
 }
 
 // The scope analyzer breaks this, unsurprisingly.
@@ -73,7 +100,7 @@ TEST(Functions, UserDefFunc2)
 //         ((lambda (x) (* x x)) 2) // IILE
 //     )");
 //     log(result);
-//     EXPECT_EQ(result.number, 4);
+//     EXPECT_EQ(AS_NUMBER(result), 4);
 // }
 
 TEST(Functions, LambdaToVar)
@@ -85,5 +112,5 @@ TEST(Functions, LambdaToVar)
         (newsquare 2)
     )");
     log(result);
-    EXPECT_EQ(result.number, 4);
+    EXPECT_EQ(AS_NUMBER(result), 4);
 }
\ No newline at end of file
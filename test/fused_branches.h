@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+TEST(FusedBranches, IfCompare)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (var x 5)
+        (if (>= x 5) "yes" "no")
+    )");
+    EXPECT_EQ(AS_CPPSTRING(result), "yes");
+
+    auto co = vm.compiler->getMainFunction()->co;
+    EXPECT_TRUE(hasOpcode(co, OP_JMP_IF_NOT_GE));
+    EXPECT_FALSE(hasOpcode(co, OP_COMPARE));
+}
+
+TEST(FusedBranches, LocalAgainstConstant)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (def count (n)
+            (begin
+                (var i 0)
+                (while (!= i 10)
+                    (set i (+ i 1)))
+                (if (<= n 3) i (- 0 i))))
+        (+ (count 3) (count 2))
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 20);
+
+    auto fn = AS_FUNCTION(vm.global->get(vm.global->getGlobalIndex("count")).value);
+    EXPECT_TRUE(hasOpcode(fn->co, OP_JMP_IF_NOT_CMP_LC));
+}
+
+TEST(FusedBranches, Strings)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (var s "abc")
+        (if (== s "abc")
+            (if (< s "abd") 1 2)
+            3)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 1);
+}
+
+TEST(FusedBranches, MismatchedTypes)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (def check (x)
+            (if (== x 1) "one" "other"))
+        (check "1")
+    )");
+    EXPECT_EQ(AS_CPPSTRING(result), "other");
+}
+
+TEST(FusedBranches, EqualityOfAnyTypes)
+{
+    // Different types are unequal, booleans equal by value,
+    // neither is ordered. Bits: ==, !=, <
+    auto program = R"(
+        (def bits (a b)
+            (+ (if (== a b) 1 0)
+               (+ (if (!= a b) 2 0)
+                  (if (< a b) 4 0))))
+        (def flag (x) (< x 2))
+        (+ (bits 1 "1")
+           (+ (* 16 (bits (flag 1) (flag 1)))
+              (* 256 (bits (flag 1) (flag 5)))))
+    )";
+
+    for (auto tier : {ExecutionTier::STACK, ExecutionTier::REGISTER})
+    {
+        EvaVM vm(tier);
+        EXPECT_EQ(AS_NUMBER(vm.exec(program)), 2 + 16 * 1 + 256 * 2);
+
+        EvaVM pushed(tier);
+        auto result = pushed.exec(R"(
+            (def ne (a b) (!= a b))
+            (def eq (a b) (== a b))
+            (def gt (a b) (> a b))
+            (if (ne 1 "a") (if (eq (ne 1 2) (ne 3 4)) (if (gt (ne 1 2) (ne 1 1)) 1 2) 3) 4)
+        )");
+        EXPECT_EQ(AS_NUMBER(result), 2);
+    }
+}
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+#include "src/vm/Logger.h"
+
+TEST(Integers, LiteralsAreIntegers)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (- (* 6 7) (+ 1 1))
+    )");
+    log(result);
+    EXPECT_TRUE(IS_INTEGER(result));
+    EXPECT_EQ(AS_INTEGER(result), 40);
+}
+
+TEST(Integers, DivisionGivesDouble)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (/ 7 2)
+    )");
+    log(result);
+    EXPECT_TRUE(IS_DOUBLE(result));
+    EXPECT_EQ(AS_NUMBER(result), 3.5);
+}
+
+TEST(Integers, MixedWithDoubles)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (begin
+            (var half (/ 1 2))
+            (if (< 1 (+ 1 half))
+                (* 3 half)
+                0))
+    )");
+    log(result);
+    EXPECT_TRUE(IS_DOUBLE(result));
+    EXPECT_EQ(AS_NUMBER(result), 1.5);
+}
+
+TEST(Integers, OverflowPromotesToDouble)
+{
+    // 2^70 doesn't fit an integer, on any tier
+    auto program = R"(
+        (begin
+            (var x 1)
+            (var i 0)
+            (while (< i 70)
+                (begin
+                    (set x (* x 2))
+                    (set i (+ i 1))))
+            x)
+    )";
+
+    EvaVM vm;
+    auto result = vm.exec(program);
+    EXPECT_TRUE(IS_DOUBLE(result));
+    EXPECT_EQ(AS_NUMBER(result), 1180591620717411303424.0);
+
+    execOnBothTiers(program);
+    execWithTraces(program, 2);
+
+    if (EVA_JIT)
+        execWithJit(R"(
+            (def power (n)
+                (begin
+                    (var x 1)
+                    (var i 0)
+                    (while (< i n)
+                        (begin
+                            (set x (* x 2))
+                            (set i (+ i 1))))
+                    x))
+            (+ (power 70) (power 10))
+        )");
+}
+
+TEST(Integers, TracedLoopStaysInteger)
+{
+    if (!EVA_JIT)
+        GTEST_SKIP() << "no JIT on this platform";
+
+    auto traced = execWithTraces(R"(
+        (begin
+            (var i 0)
+            (var total 0)
+            (while (< i 100000)
+                (begin
+                    (set total (+ total (* i 3)))
+                    (set i (+ i 1))))
+            total)
+    )");
+    EXPECT_EQ(traced, 1);
+}
@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+TEST(Interning, ConstantsAreSymbols)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (def greet () "hello")
+        (var s "hello")
+        (greet)
+    )");
+
+    auto symbol = vm.symbols->intern("hello");
+    EXPECT_TRUE(symbol->interned);
+    EXPECT_EQ(AS_STRING(result), symbol);
+    EXPECT_EQ(symbol->hash, std::hash<std::string_view>{}("hello"));
+}
+
+TEST(Interning, SymbolEquality)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (== "abc" "abc")
+    )");
+    EXPECT_TRUE(result.boolean);
+
+    result = vm.exec(R"(
+        (!= "abc" "abd")
+    )");
+    EXPECT_TRUE(result.boolean);
+}
+
+TEST(Interning, ComputedStringsCompareByContent)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (== (+ "ab" "c") "abc")
+    )");
+    EXPECT_TRUE(result.boolean);
+
+    result = vm.exec(R"(
+        (!= "abc" (+ "ab" "c"))
+    )");
+    EXPECT_FALSE(result.boolean);
+}
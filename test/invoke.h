@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+TEST(Invoke, MethodCallOnReceiver)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (class Counter null
+            (def constructor (self n) (set (prop self n) n))
+            (def add (self x) (set (prop self n) (+ (prop self n) x))))
+        (var c (new Counter 1))
+        (var i 0)
+        (while (< i 10)
+            (begin
+                ((prop c add) c i)
+                (set i (+ i 1))))
+        (prop c n)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 46);
+
+    // The method isn't read with GET_PROP at the call site
+    auto main = vm.compiler->getMainFunction()->co;
+    EXPECT_TRUE(hasOpcode(main, OP_INVOKE));
+    EXPECT_TRUE(main->verified);
+}
+
+TEST(Invoke, SuperCallsAreStaticallyBound)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (class Point null
+            (def constructor (self x y)
+                (begin
+                    (set (prop self x) x)
+                    (set (prop self y) y)))
+            (def calc (self) (+ (prop self x) (prop self y))))
+        (class Point3D Point
+            (def constructor (self x y z)
+                (begin
+                    ((prop (super Point3D) constructor) self x y)
+                    (set (prop self z) z)))
+            (def calc (self)
+                (+ ((prop (super Point3D) calc) self) (prop self z))))
+        (var p (new Point3D 10 20 30))
+        ((prop p calc) p)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 60);
+
+    auto point3D = AS_CLASS(vm.global->get(vm.global->getGlobalIndex("Point3D")).value);
+    auto calc = AS_FUNCTION(point3D->getProp(vm.symbols->intern("calc")));
+    EXPECT_TRUE(hasOpcode(calc->co, OP_INVOKE_SUPER));
+}
+
+TEST(Invoke, BothTiers)
+{
+    auto result = execOnBothTiers(R"(
+        (class Shape null
+            (def constructor (self side) (set (prop self side) side))
+            (def area (self) 0)
+            (def scaled (self k) (* k ((prop self area) self))))
+        (class Square Shape
+            (def constructor (self side)
+                ((prop (super Square) constructor) self side))
+            (def area (self) (* (prop self side) (prop self side)))
+            (def scaled (self k) (+ 1 ((prop (super Square) scaled) self k))))
+        (var s (new Square 3))
+        (+ ((prop s scaled) s 2) ((prop s area) s))
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 28);
+}
+
+TEST(Invoke, TailPositionKeepsTailCall)
+{
+    EvaVM vm;
+
+    vm.exec(R"(
+        (class Node null
+            (def constructor (self n) (set (prop self n) n))
+            (def down (self k)
+                (if (== k 0)
+                    (prop self n)
+                    ((prop self down) self (- k 1)))))
+        (var node (new Node 7))
+        ((prop node down) node 100000)
+    )");
+
+    auto node = AS_CLASS(vm.global->get(vm.global->getGlobalIndex("Node")).value);
+    auto down = AS_FUNCTION(node->getProp(vm.symbols->intern("down")));
+    EXPECT_TRUE(hasOpcode(down->co, OP_TAIL_CALL));
+    EXPECT_FALSE(hasOpcode(down->co, OP_INVOKE));
+}
@@ -21,7 +21,7 @@ TEST(LocalVariables, NestedScope)
         x
         
     )");
-    EXPECT_EQ(result.number, 1000);
+    EXPECT_EQ(AS_NUMBER(result), 1000);
 }
 
 TEST(LocalVariables, FurtherNestedScope)
@@ -42,7 +42,7 @@ TEST(LocalVariables, FurtherNestedScope)
             z)
         z
     )");
-    EXPECT_EQ(result.number, 15);
+    EXPECT_EQ(AS_NUMBER(result), 15);
 }
 
 TEST(LocalVariables, FormerSegFaultLvarPop)
@@ -57,7 +57,7 @@ TEST(LocalVariables, FormerSegFaultLvarPop)
         )
         z
     )");
-    EXPECT_EQ(result.number, 100);
+    EXPECT_EQ(AS_NUMBER(result), 100);
 }
 
 TEST(LocalVariables, FixingWithBCOptimizedCausesStackUnderflow)
@@ -74,5 +74,5 @@ TEST(LocalVariables, FixingWithBCOptimizedCausesStackUnderflow)
             (set a 100)
             (+ a b))
     )");
-    EXPECT_EQ(result.number, 120);
+    EXPECT_EQ(AS_NUMBER(result), 120);
 }
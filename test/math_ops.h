@@ -10,7 +10,7 @@ TEST(MathOps, AddTwo)
         (+ 2 3)
     )");
     log(result);
-    EXPECT_EQ(result.number, 5);
+    EXPECT_EQ(AS_NUMBER(result), 5);
 }
 
 TEST(MathOps, AddThree)
@@ -21,7 +21,7 @@ TEST(MathOps, AddThree)
         (+ 2 (+ 3 1))
     )");
     log(result);
-    EXPECT_EQ(result.number, 6);
+    EXPECT_EQ(AS_NUMBER(result), 6);
 }
 
 TEST(MathOps, SubTwo)
@@ -32,7 +32,7 @@ TEST(MathOps, SubTwo)
         (- 2 1)
     )");
     log(result);
-    EXPECT_EQ(result.number, 1);
+    EXPECT_EQ(AS_NUMBER(result), 1);
 }
 
 TEST(MathOps, MulTwo)
@@ -43,7 +43,7 @@ TEST(MathOps, MulTwo)
         (* 2 8)
     )");
     log(result);
-    EXPECT_EQ(result.number, 16);
+    EXPECT_EQ(AS_NUMBER(result), 16);
 }
 
 TEST(MathOps, DivTwo)
@@ -55,5 +55,5 @@ TEST(MathOps, DivTwo)
     )");
 
     log(result);
-    EXPECT_EQ(result.number, 4);
+    EXPECT_EQ(AS_NUMBER(result), 4);
 }
\ No newline at end of file
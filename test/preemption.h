@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+// Runs `program` in slices of `fuel`, returns the result
+// and how many times it was suspended
+std::pair<EvaValue, size_t> execInSlices(EvaVM &vm, const std::string &program, int64_t fuel)
+{
+    vm.setFuel(fuel);
+    auto result = vm.exec(program);
+    size_t suspensions = 0;
+    while (vm.status == ExecStatus::SUSPENDED)
+    {
+        suspensions++;
+        vm.setFuel(fuel);
+        result = vm.resume();
+    }
+    EXPECT_EQ(vm.status, ExecStatus::DONE);
+    return {result, suspensions};
+}
+
+TEST(Preemption, UnlimitedByDefault)
+{
+    EvaVM vm;
+    auto result = vm.exec(R"(
+        (var i 0)
+        (while (< i 100000) (set i (+ i 1)))
+        i
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 100000);
+    EXPECT_EQ(vm.status, ExecStatus::DONE);
+    EXPECT_EQ(vm.preemption.fuelLeft(), FUEL_UNLIMITED);
+}
+
+TEST(Preemption, LoopsSuspendAndResume)
+{
+    // 1000 back-edges, suspended every 150
+    auto program = R"(
+        (var i 0)
+        (var total 0)
+        (while (< i 1000)
+            (begin
+                (set total (+ total i))
+                (set i (+ i 1))))
+        total
+    )";
+
+    for (auto tier : {ExecutionTier::STACK, ExecutionTier::REGISTER})
+    {
+        EvaVM vm(tier);
+        auto [result, suspensions] = execInSlices(vm, program, 150);
+        EXPECT_EQ(AS_NUMBER(result), 499500);
+        EXPECT_EQ(suspensions, 6);
+    }
+}
+
+TEST(Preemption, CallsSpendFuel)
+{
+    // No loops: 501 calls, suspended every 50
+    EvaVM vm;
+    auto [result, suspensions] = execInSlices(vm, R"(
+        (def count (n)
+            (if (== n 0) 0 (+ 1 (count (- n 1)))))
+        (count 500)
+    )", 50);
+    EXPECT_EQ(AS_NUMBER(result), 500);
+    EXPECT_EQ(suspensions, 10);
+}
+
+TEST(Preemption, RunawayLoopTimesOut)
+{
+    // In main (traced with the JIT on) and in a function
+    // (compiled with the JIT on)
+    for (auto program : {"(var i 0) (while (> 1 0) (set i (+ i 1))) i",
+                         "(def spin () (begin (var i 0) (while (> 1 0) (set i (+ i 1))) i)) (spin)"})
+    {
+        EvaVM vm;
+        vm.setDeadline(Preemption::Clock::now() + std::chrono::milliseconds(20));
+        vm.exec(program);
+        EXPECT_EQ(vm.status, ExecStatus::TIMED_OUT);
+    }
+}
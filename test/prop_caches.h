@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+TEST(PropCaches, MonomorphicHits)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (class Point null
+            (def constructor (self x y)
+                (begin
+                    (set (prop self x) x)
+                    (set (prop self y) y)
+                    self)))
+
+        (var p (new Point 1 2))
+        (var sum 0)
+        (for (var i 0) (< i 100) (set i (+ i 1))
+            (set sum (+ sum (prop p x))))
+        sum
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 100);
+
+    auto &stats = vm.getPropCacheStats();
+    EXPECT_GT(stats.hits, 90);
+    EXPECT_GT(stats.hitRatio(), 0.9);
+}
+
+TEST(PropCaches, Polymorphic)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (class Point null
+            (def constructor (self x y)
+                (begin
+                    (set (prop self x) x)
+                    (set (prop self y) y)
+                    self)))
+
+        (var p (new Point 1 2))
+        (var q (new Point 10 20))
+        (def getX (obj) (prop obj x))
+
+        (var sum 0)
+        (for (var i 0) (< i 50) (set i (+ i 1))
+            (set sum (+ sum (+ (getX p) (getX q)))))
+        sum
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 550);
+    EXPECT_GT(vm.getPropCacheStats().hits, 90);
+}
+
+TEST(PropCaches, OwnPropertyShadowsCachedMethod)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (class Point null
+            (def constructor (self x) (set (prop self x) x))
+            (def calc (self) (prop self x)))
+
+        (var p (new Point 7))
+        (def getCalc (obj) (prop obj calc))
+
+        (var first ((getCalc p) p))
+        (set (prop p calc) 100)
+        (+ first (getCalc p))
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 107);
+}
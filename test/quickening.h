@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+// Checks whether the code object contains the given opcode, in the
+// linked code it runs as (which is what gets quickened) once linked
+bool hasOpcode(CodeObject *co, uint8_t opcode)
+{
+    for (size_t offset = 0; offset < co->code.size(); offset += instructionLength(co->code, offset))
+    {
+        auto running = co->linked.empty() ? co->code[offset] : co->linked[co->linkedAt[offset]];
+        if (running == opcode)
+            return true;
+    }
+    return false;
+}
+
+TEST(Quickening, NumericLoopIsQuickened)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (var i 0)
+        (var sum 0)
+        (var small true)
+        (while (< i 10)
+            (begin
+                (set i (+ i 1))
+                (set sum (+ sum i))
+                (set small (< sum 20))))
+        sum
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 55);
+
+    auto co = vm.compiler->getMainFunction()->co;
+    EXPECT_TRUE(hasOpcode(co, OP_ADD_NUM));
+    EXPECT_TRUE(hasOpcode(co, OP_LT_NUM));
+    EXPECT_TRUE(hasOpcode(co, OP_JMP_IF_NOT_LT));
+    EXPECT_FALSE(hasOpcode(co, OP_ADD));
+    EXPECT_FALSE(hasOpcode(co, OP_COMPARE));
+}
+
+TEST(Quickening, DeoptimizesOnStrings)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (def add (a b) (+ a b))
+        (def less (a b) (< a b))
+        (add 1 2)
+        (less 1 2)
+        (if (less "a" "b") (add "x" "y") "wrong")
+    )");
+    EXPECT_EQ(AS_CPPSTRING(result), "xy");
+}
+
+TEST(Quickening, RequickensAfterDeopt)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (def add (a b) (+ a b))
+        (add "x" "y")
+        (add 1 2)
+        (add 3 4)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 7);
+}
@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+// Runs a program on both tiers, checks they agree. Objects
+// the result points to are freed with the VMs: read numbers
+// and booleans
+EvaValue execOnBothTiers(const std::string &program)
+{
+    EvaVM stackVM;
+    auto expected = stackVM.exec(program);
+
+    // Copied out before the other VM runs: its collections can free it
+    auto isNumber = IS_NUMBER(expected), isString = IS_STRING(expected);
+    auto isBoolean = IS_BOOLEAN(expected);
+    auto isInteger = isNumber && IS_INTEGER(expected);
+    auto expectedNumber = isNumber ? AS_NUMBER(expected) : 0;
+    auto expectedString = isString ? AS_CPPSTRING(expected) : "";
+    auto expectedBoolean = isBoolean && AS_BOOLEAN(expected);
+
+    EvaVM registerVM(ExecutionTier::REGISTER);
+    auto result = registerVM.exec(program);
+    EXPECT_EQ(registerVM.activeTier, ExecutionTier::REGISTER);
+
+    if (isNumber)
+    {
+        EXPECT_EQ(AS_NUMBER(result), expectedNumber);
+        EXPECT_EQ(IS_INTEGER(result), isInteger);
+    }
+    else if (isString)
+        EXPECT_EQ(AS_CPPSTRING(result), expectedString);
+    else if (isBoolean)
+        EXPECT_EQ(AS_BOOLEAN(result), expectedBoolean);
+
+    return result;
+}
+
+TEST(RegisterTier, LocalLoop)
+{
+    auto result = execOnBothTiers(R"(
+        (def count (n)
+            (begin
+                (var i 0)
+                (var sum 0)
+                (while (< i n)
+                    (begin
+                        (set i (+ i 1))
+                        (set sum (+ sum i))))
+                sum))
+        (count 100)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 5050);
+}
+
+TEST(RegisterTier, ThreeAddressCode)
+{
+    EvaVM vm(ExecutionTier::REGISTER);
+    vm.exec(R"(
+        (def inc (x)
+            (begin
+                (set x (+ x 1))
+                x))
+        (inc 1)
+    )");
+
+    // (set x (+ x 1)) is a single ADD writing the local
+    auto fn = AS_FUNCTION(vm.global->get(vm.global->getGlobalIndex("inc")).value);
+    auto &code = fn->co->regCode;
+    ASSERT_GE(code.size(), 4);
+    EXPECT_EQ(code[0], ROP_ADD);
+    EXPECT_EQ(code[1], 1);
+    EXPECT_EQ(code[2], 1);
+    EXPECT_EQ(code[3] & RK_CONST, RK_CONST);
+}
+
+TEST(RegisterTier, Recursion)
+{
+    auto result = execOnBothTiers(R"(
+        (def fib (n)
+            (if (< n 2)
+                n
+                (+ (fib (- n 1)) (fib (- n 2)))))
+        (fib 15)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 610);
+}
+
+TEST(RegisterTier, ReadBeforeWrite)
+{
+    auto result = execOnBothTiers(R"(
+        (def f (x)
+            (+ x (set x 10)))
+        (f 1)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 11);
+}
+
+TEST(RegisterTier, ClosuresAndNatives)
+{
+    auto result = execOnBothTiers(R"(
+        (def makeCounter (start)
+            (begin
+                (def next ()
+                    (set start (+ start 1)))
+                next))
+        (var next (makeCounter 10))
+        (next)
+        (sum (next) (square 2))
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 16);
+}
+
+TEST(RegisterTier, Classes)
+{
+    auto result = execOnBothTiers(R"(
+        (class Point null
+            (def constructor (self x y)
+                (begin
+                    (set (prop self x) x)
+                    (set (prop self y) y)))
+            (def calc (self)
+                (+ (prop self x) (prop self y))))
+        (var p (new Point 10 20))
+        ((prop p calc) p)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 30);
+}
+
+TEST(RegisterTier, Strings)
+{
+    auto result = execOnBothTiers(R"(
+        (var s "a")
+        (== (if (== s "a") (+ s "b") "c") "ab")
+    )");
+    EXPECT_TRUE(AS_BOOLEAN(result));
+}
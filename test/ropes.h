@@ -0,0 +1,54 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+TEST(Ropes, ShortConcatenationIsFlat)
+{
+    EvaVM vm;
+    auto result = vm.exec(R"( (+ "ab" "cd") )");
+    EXPECT_FALSE(AS_STRING(result)->isRope());
+    EXPECT_EQ(AS_CPPSTRING(result), "abcd");
+}
+
+TEST(Ropes, AppendingBuildsARope)
+{
+    EvaVM vm;
+    auto result = vm.exec(R"(
+        (var s "")
+        (var i 0)
+        (while (< i 5000)
+            (begin
+                (set s (+ s "log line;"))
+                (set i (+ i 1))))
+        s
+    )");
+
+    auto string = AS_STRING(result);
+    EXPECT_TRUE(string->isRope());
+    EXPECT_EQ(string->length, 5000 * 9);
+
+    // Flattened on read
+    std::string expected;
+    for (auto i = 0; i < 5000; i++)
+        expected += "log line;";
+    EXPECT_EQ(AS_CPPSTRING(result), expected);
+    EXPECT_FALSE(string->isRope());
+}
+
+TEST(Ropes, ReadAsStrings)
+{
+    // Shared parts, compared to flat strings
+    std::string part(40, 'x');
+    auto program = R"(
+        (var a ")" + part + R"(")
+        (var b (+ a a))
+        (var c (+ b (+ b "y")))
+        (if (== c ")" + part + part + part + part + R"(y") (+ "<" (+ c ">")) "different")
+    )";
+
+    for (auto tier : {ExecutionTier::STACK, ExecutionTier::REGISTER})
+    {
+        EvaVM vm(tier);
+        auto result = vm.exec(program);
+        EXPECT_EQ(AS_CPPSTRING(result), "<" + part + part + part + part + "y>");
+    }
+}
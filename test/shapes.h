@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+// Gets an instance stored in a global variable
+InstanceObject *getGlobalInstance(EvaVM &vm, const std::string &name)
+{
+    return AS_INSTANCE(vm.global->get(vm.global->getGlobalIndex(name)).value);
+}
+
+TEST(Shapes, SameConstructorSharesShape)
+{
+    EvaVM vm;
+
+    vm.exec(R"(
+        (class Point null
+            (def constructor (self x y)
+                (begin
+                    (set (prop self x) x)
+                    (set (prop self y) y)
+                    self)))
+
+        (var a (new Point 1 2))
+        (var b (new Point 3 4))
+        0
+    )");
+
+    auto a = getGlobalInstance(vm, "a");
+    auto b = getGlobalInstance(vm, "b");
+
+    EXPECT_EQ(a->shape, b->shape);
+    EXPECT_EQ(a->slots.size(), 2);
+    EXPECT_EQ(AS_NUMBER(b->slots[a->shape->getSlot(vm.symbols->intern("y"))]), 4);
+}
+
+TEST(Shapes, PropertyOrderMakesDistinctShapes)
+{
+    EvaVM vm;
+
+    vm.exec(R"(
+        (class Point null
+            (def constructor (self) self))
+
+        (var a (new Point))
+        (var b (new Point))
+        (set (prop a x) 1)
+        (set (prop a y) 2)
+        (set (prop b y) 2)
+        (set (prop b x) 1)
+        0
+    )");
+
+    auto a = getGlobalInstance(vm, "a");
+    auto b = getGlobalInstance(vm, "b");
+
+    EXPECT_NE(a->shape, b->shape);
+    EXPECT_EQ(a->shape->getSlot(vm.symbols->intern("x")), 0);
+    EXPECT_EQ(b->shape->getSlot(vm.symbols->intern("x")), 1);
+}
+
+TEST(Shapes, ManyInstancesHitCaches)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (class Point null
+            (def constructor (self x y)
+                (begin
+                    (set (prop self x) x)
+                    (set (prop self y) y)
+                    self))
+            (def calc (self)
+                (+ (prop self x) (prop self y))))
+
+        (var sum 0)
+        (for (var i 0) (< i 100) (set i (+ i 1))
+            (begin
+                (var p (new Point i 1))
+                (set sum (+ sum ((prop p calc) p)))))
+        sum
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 5150);
+    EXPECT_GT(vm.getPropCacheStats().hitRatio(), 0.9);
+}
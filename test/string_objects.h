@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+TEST(Strings, CharactersAreInline)
+{
+    EvaVM vm;
+    auto result = vm.exec(R"( (+ "hello, " "world of strings") )");
+
+    auto string = AS_STRING(result);
+    EXPECT_EQ(string->str(), "hello, world of strings");
+    EXPECT_EQ(string->length, 23);
+
+    // One allocation: header, characters and terminator
+    EXPECT_EQ(string->size, sizeof(StringObject) + 23 + 1);
+    EXPECT_EQ((const char *)(string + 1), string->str().data());
+    EXPECT_EQ(string->str().data()[23], '\0');
+}
+
+TEST(Strings, HashIsCached)
+{
+    EvaVM vm;
+    // Concatenated at runtime (literals are at compile time)
+    auto result = vm.exec(R"( (var a "abc") (+ a "def") )");
+
+    auto string = AS_STRING(result);
+    EXPECT_FALSE(string->hashed);
+    EXPECT_EQ(string->hashCode(), std::hash<std::string_view>{}("abcdef"));
+    EXPECT_TRUE(string->hashed);
+}
+
+TEST(Strings, EqualityWithoutReading)
+{
+    // Lengths differ: ropes compare unequal without being flattened
+    std::string part(40, 'x');
+    EvaVM vm;
+    vm.exec(R"(
+        (var a ")" + part + R"(")
+        (var b (+ a a))
+        (var c (+ a (+ a "y")))
+        (var same (== b c))
+    )");
+
+    auto global = [&](const std::string &name)
+    { return vm.global->get(vm.global->getGlobalIndex(name)).value; };
+    EXPECT_FALSE(AS_BOOLEAN(global("same")));
+    EXPECT_TRUE(AS_STRING(global("b"))->isRope());
+    EXPECT_TRUE(AS_STRING(global("c"))->isRope());
+}
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+TEST(TailCalls, AccumulatorInConstantStack)
+{
+    auto program = R"(
+        (def sum (n acc)
+            (if (== n 0)
+                acc
+                (sum (- n 1) (+ acc n))))
+        (sum 100000 0)
+    )";
+
+    // A handful of frames is enough: the recursion reuses one
+    for (auto tier : {ExecutionTier::STACK, ExecutionTier::REGISTER})
+    {
+        EvaVM vm(tier, 4);
+        auto result = vm.exec(program);
+        EXPECT_EQ(vm.activeTier, tier);
+        EXPECT_EQ(AS_NUMBER(result), 5000050000);
+        EXPECT_EQ(vm.frameTop, vm.stack.frames.begin());
+
+        auto fn = AS_FUNCTION(vm.global->get(vm.global->getGlobalIndex("sum")).value);
+        EXPECT_TRUE(hasOpcode(fn->co, OP_TAIL_CALL));
+    }
+}
+
+TEST(TailCalls, OnlyCallsInTailPosition)
+{
+    EvaVM vm;
+
+    auto result = vm.exec(R"(
+        (def factorial (x)
+            (if (== x 1)
+                1
+                (* x (factorial (- x 1)))))
+        (factorial 5)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 120);
+
+    auto fn = AS_FUNCTION(vm.global->get(vm.global->getGlobalIndex("factorial")).value);
+    EXPECT_TRUE(hasOpcode(fn->co, OP_CALL));
+    EXPECT_FALSE(hasOpcode(fn->co, OP_TAIL_CALL));
+
+    // Main returns through OP_HALT, it has no tail calls
+    EXPECT_FALSE(hasOpcode(vm.compiler->getMainFunction()->co, OP_TAIL_CALL));
+}
+
+TEST(TailCalls, MutualRecursionAndLocals)
+{
+    auto result = execOnBothTiers(R"(
+        (var isOdd 0)
+        (def isEven (n)
+            (begin
+                (var m (- n 1))
+                (if (== n 0) true (isOdd m))))
+        (def isOdd (n)
+            (begin
+                (var m (- n 1))
+                (if (== n 0) false (isEven m))))
+        (if (isEven 10001) 1 2)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 2);
+}
+
+TEST(TailCalls, NativeAndLambdaCallees)
+{
+    auto result = execOnBothTiers(R"(
+        (def squared (x) (square x))
+        (def apply (f x) (f x))
+        (+ (squared 3) (apply (lambda (y) (* y 10)) 4))
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 49);
+}
+
+TEST(TailCalls, ZeroArityFunction)
+{
+    // The callee slot is popped even without params or locals
+    auto result = execOnBothTiers(R"(
+        (def one () (begin 1))
+        (+ (one) (one))
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 2);
+}
@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+// Code object of a global function
+CodeObject *globalCode(EvaVM &vm, const std::string &name)
+{
+    return AS_FUNCTION(vm.global->get(vm.global->getGlobalIndex(name)).value)->co;
+}
+
+TEST(Tiering, QuickensOnceHot)
+{
+    EvaVM vm;
+    vm.tiering.thresholds = {2, SIZE_MAX, SIZE_MAX};
+
+    auto result = vm.exec(R"(
+        (def cold (a b) (+ a b))
+        (def hot (a b) (+ a b))
+        (cold 1 2)
+        (hot 1 2)
+        (hot 3 4)
+        (hot 5 6)
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 11);
+
+    auto cold = globalCode(vm, "cold");
+    EXPECT_EQ(cold->tier, CodeTier::GENERIC);
+    EXPECT_FALSE(hasOpcode(cold, OP_ADD_NUM));
+
+    auto hot = globalCode(vm, "hot");
+    EXPECT_EQ(hot->tier, CodeTier::QUICKENED);
+    EXPECT_TRUE(hasOpcode(hot, OP_ADD_NUM));
+
+    auto &transitions = vm.tiering.stats.transitions;
+    ASSERT_EQ(transitions.size(), 1);
+    EXPECT_EQ(transitions[0].name, "hot");
+    EXPECT_EQ(transitions[0].from, CodeTier::GENERIC);
+    EXPECT_EQ(transitions[0].to, CodeTier::QUICKENED);
+    EXPECT_EQ(transitions[0].trigger, TierTrigger::CALLS);
+    EXPECT_EQ(transitions[0].calls, 3);
+}
+
+TEST(Tiering, CallsCompileToMachineCode)
+{
+    if (!EVA_JIT)
+        GTEST_SKIP() << "no JIT on this platform";
+
+    EvaVM vm;
+    vm.enableJit(5);
+
+    std::vector<std::string> logged;
+    vm.tiering.stats.onTransition = [&](const TierTransition &transition)
+    {
+        std::stringstream ss;
+        ss << transition;
+        logged.push_back(ss.str());
+    };
+
+    auto result = vm.exec(R"(
+        (def inc (x) (+ x 1))
+        (var i 0)
+        (var n 0)
+        (while (< i 10)
+            (begin
+                (set n (inc n))
+                (set i (+ i 1))))
+        n
+    )");
+    EXPECT_EQ(AS_NUMBER(result), 10);
+
+    EXPECT_EQ(globalCode(vm, "inc")->tier, CodeTier::JIT);
+    EXPECT_NE(globalCode(vm, "inc")->jitCode, nullptr);
+    EXPECT_EQ(vm.tiering.stats.count(CodeTier::JIT), 1);
+
+    ASSERT_EQ(logged.size(), 3);
+    EXPECT_EQ(logged[0], "inc: GENERIC -> QUICKENED (2 calls, 0 back-edges)");
+    EXPECT_EQ(logged[1], "main: GENERIC -> QUICKENED (0 calls, 2 back-edges)");
+    EXPECT_EQ(logged[2], "inc: QUICKENED -> JIT (6 calls, 0 back-edges)");
+}
+
+TEST(Tiering, LongLoopEntersMachineCode)
+{
+    if (!EVA_JIT)
+        GTEST_SKIP() << "no JIT on this platform";
+
+    // Called once, with a loop the trace JIT can't
+    // compile (it calls): on-stack replacement
+    auto program = R"(
+        (def work (n)
+            (begin
+                (var i 0)
+                (var total 0)
+                (while (< i n)
+                    (begin
+                        (set total (+ total (square i)))
+                        (set i (+ i 1))))
+                total))
+        (work 500)
+    )";
+
+    EvaVM interpreted;
+    auto expected = AS_NUMBER(interpreted.exec(program));
+
+    EvaVM vm;
+    vm.enableJit(1000);
+    vm.tiering.thresholds.osrBackEdges = 100;
+    auto result = vm.exec(program);
+    EXPECT_EQ(AS_NUMBER(result), expected);
+
+    auto work = globalCode(vm, "work");
+    EXPECT_EQ(work->tier, CodeTier::JIT);
+    EXPECT_EQ(work->callCount, 1);
+    EXPECT_EQ(work->backEdges, 101);
+    EXPECT_EQ(vm.tiering.stats.osrEntries, 1);
+
+    auto &last = vm.tiering.stats.transitions.back();
+    EXPECT_EQ(last.name, "work");
+    EXPECT_EQ(last.to, CodeTier::JIT);
+    EXPECT_EQ(last.trigger, TierTrigger::BACK_EDGES);
+}
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+// Runs a program interpreted and with loops traced after `threshold`
+// back-edges, checks they agree. Returns how many loops were traced.
+size_t execWithTraces(const std::string &program, size_t threshold = 10)
+{
+    // Copied out: the other VM's collections can free it
+    EvaVM interpreted;
+    auto expected = interpreted.exec(program);
+    auto expectedString = IS_STRING(expected) ? AS_CPPSTRING(expected) : "";
+
+    EvaVM vm;
+    vm.enableJit(threshold);
+    auto result = vm.exec(program);
+
+    if (IS_NUMBER(expected))
+    {
+        EXPECT_EQ(AS_NUMBER(result), AS_NUMBER(expected));
+        EXPECT_EQ(IS_INTEGER(result), IS_INTEGER(expected));
+    }
+    else
+        EXPECT_EQ(AS_CPPSTRING(result), expectedString);
+
+    return vm.traceJit->compiledCount;
+}
+
+TEST(TraceJIT, LocalLoop)
+{
+    if (!EVA_JIT)
+        GTEST_SKIP() << "no JIT on this platform";
+
+    // The branch flips half way: a side exit
+    // on every iteration after that
+    auto traced = execWithTraces(R"(
+        (begin
+            (var i 0)
+            (var total 0)
+            (while (< i 1000)
+                (begin
+                    (if (< i 500)
+                        (set total (+ total (* i 2)))
+                        (set total (- total (/ i 4))))
+                    (set i (+ i 1))))
+            total)
+    )");
+    EXPECT_EQ(traced, 1);
+
+    traced = execWithTraces(R"(
+        (begin
+            (var sum 0)
+            (for (var i 0) (< i 100) (set i (+ i 1))
+                (begin
+                    (var square (* i i))
+                    (set sum (+ sum square))))
+            sum)
+    )");
+    EXPECT_EQ(traced, 1);
+}
+
+TEST(TraceJIT, GlobalLoop)
+{
+    if (!EVA_JIT)
+        GTEST_SKIP() << "no JIT on this platform";
+
+    auto traced = execWithTraces(R"(
+        (var a 0)
+        (var b 1)
+        (var i 0)
+        (while (< i 50)
+            (begin
+                (var next (+ a b))
+                (set a b)
+                (set b next)
+                (set i (+ i 1))))
+        a
+    )");
+    EXPECT_EQ(traced, 1);
+}
+
+TEST(TraceJIT, NestedLoops)
+{
+    if (!EVA_JIT)
+        GTEST_SKIP() << "no JIT on this platform";
+
+    // The inner loop is traced, the outer one has another
+    // loop in it: recording it fails
+    auto traced = execWithTraces(R"(
+        (begin
+            (var total 0)
+            (var i 0)
+            (while (< i 30)
+                (begin
+                    (var j 0)
+                    (while (< j i)
+                        (begin
+                            (set total (+ total j))
+                            (set j (+ j 1))))
+                    (set i (+ i 1))))
+            total)
+    )");
+    EXPECT_EQ(traced, 1);
+}
+
+TEST(TraceJIT, UnsupportedLoopIsBlacklisted)
+{
+    if (!EVA_JIT)
+        GTEST_SKIP() << "no JIT on this platform";
+
+    // Strings and calls aren't traced
+    auto traced = execWithTraces(R"(
+        (def twice (x) (* x 2))
+        (begin
+            (var s "")
+            (var i 0)
+            (var n 0)
+            (while (< i 100)
+                (begin
+                    (set s (+ s "x"))
+                    (set i (+ i 1))))
+            (while (< n 100)
+                (set n (+ (twice n) 1)))
+            (+ s "!"))
+    )");
+    EXPECT_EQ(traced, 0);
+}
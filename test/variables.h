@@ -15,7 +15,7 @@ TEST(Variables, GetPredefinedGlobal)
         x
     )");
     log(result);
-    EXPECT_EQ(result.number, 10);
+    EXPECT_EQ(AS_NUMBER(result), 10);
 }
 
 TEST(Variables, CreateBasic)
@@ -26,7 +26,7 @@ TEST(Variables, CreateBasic)
         (var c 100)
     )");
     log(result);
-    EXPECT_EQ(result.number, 100);
+    EXPECT_EQ(AS_NUMBER(result), 100);
 }
 
 TEST(Variables, CreateComplex)
@@ -38,7 +38,7 @@ TEST(Variables, CreateComplex)
         (var c (+ x 10))
     )");
     log(result);
-    EXPECT_EQ(result.number, 20);
+    EXPECT_EQ(AS_NUMBER(result), 20);
 }
 
 TEST(Variables, SetExistingNewValue)
@@ -50,7 +50,7 @@ TEST(Variables, SetExistingNewValue)
         (set x 20)
     )");
     log(result);
-    EXPECT_EQ(result.number, 20);
+    EXPECT_EQ(AS_NUMBER(result), 20);
 }
 
 TEST(Variables, SetNewNewValue)
@@ -64,5 +64,5 @@ TEST(Variables, SetNewNewValue)
         z
     )");
     log(result);
-    EXPECT_EQ(result.number, 40);
+    EXPECT_EQ(AS_NUMBER(result), 40);
 }
\ No newline at end of file
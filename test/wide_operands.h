@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include "src/vm/EvaVM.h"
+
+TEST(WideOperands, ManyGlobalsAndConstants)
+{
+    EvaVM vm;
+
+    std::string program;
+    for (auto i = 0; i < 300; i++)
+        program += "(var g" + std::to_string(i) + " " + std::to_string(i * 2) + ")\n";
+    program += "(+ g0 (+ g256 g299))";
+
+    auto result = vm.exec(program);
+    EXPECT_EQ(AS_NUMBER(result), 1110);
+
+    auto co = vm.compiler->getMainFunction()->co;
+    EXPECT_GT(co->constants.size(), 256);
+    EXPECT_TRUE(hasOpcode(co, OP_WIDE));
+}
+
+TEST(WideOperands, ManyLocals)
+{
+    EvaVM vm;
+
+    std::string program = "(def f (x) (begin\n";
+    for (auto i = 0; i < 300; i++)
+        program += "(var l" + std::to_string(i) + " " + std::to_string(i) + ")\n";
+    program += "(set l299 (+ l299 x))\n";
+    program += "(if (< l299 300) (+ l0 l299) l298)))\n";
+    program += "(f 1)";
+
+    auto result = vm.exec(program);
+    EXPECT_EQ(AS_NUMBER(result), 298);
+}
+
+TEST(WideOperands, ManyCells)
+{
+    EvaVM vm;
+
+    // 300 captured variables, each closure captures a few of them
+    std::string program = "(def f () (begin\n";
+    for (auto i = 0; i < 300; i++)
+        program += "(var c" + std::to_string(i) + " " + std::to_string(i) + ")\n";
+    for (auto i = 0; i < 300; i += 30)
+    {
+        program += "(def get" + std::to_string(i) + " () ";
+        for (auto j = i; j < i + 29; j++)
+            program += "(+ c" + std::to_string(j) + " ";
+        program += "c" + std::to_string(i + 29) + std::string(29, ')') + ")\n";
+    }
+    program += "(set c299 1)\n";
+    program += "(get270)))\n";
+    program += "(f)";
+
+    auto result = vm.exec(program);
+
+    // c270 + ... + c298, and c299 = 1
+    double expected = 1;
+    for (auto j = 270; j < 299; j++)
+        expected += j;
+    EXPECT_EQ(AS_NUMBER(result), expected);
+}
+
+TEST(WideOperands, LongCode)
+{
+    EvaVM vm;
+
+    // Loop body longer than 64 KiB: the jumps need 32-bit addresses
+    std::string program = "(var i 0) (var x 0)\n(while (< i 3) (begin (set i (+ i 1))\n";
+    for (auto n = 0; n < 10000; n++)
+        program += "(set x (+ x 1))\n";
+    program += "))\n(if (> x 100) x 0)";
+
+    auto result = vm.exec(program);
+    EXPECT_EQ(AS_NUMBER(result), 30000);
+
+    auto co = vm.compiler->getMainFunction()->co;
+    EXPECT_GT(co->code.size(), 0xFFFF);
+}
+
+TEST(WideOperands, LongLoopsCountBackEdges)
+{
+    EvaVM vm;
+
+    // A wide back-edge per iteration
+    std::string program = "(var i 0) (var x 0)\n(while (< i 5) (begin (set i (+ i 1))\n";
+    for (auto n = 0; n < 10000; n++)
+        program += "(set x (+ x 1))\n";
+    program += "))\nx";
+
+    EXPECT_EQ(AS_NUMBER(vm.exec(program)), 50000);
+    EXPECT_EQ(vm.compiler->getMainFunction()->co->backEdges, 5);
+}